@@ -0,0 +1,210 @@
+//
+// View frustum culling for bounding volumes stored as structures of arrays.
+//
+
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULLING_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CULLING_NEON
+#endif
+
+void BoundingSpheres::resize(size_t count)
+{
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    radius.resize(count);
+}
+
+size_t BoundingSpheres::size() const
+{
+    return radius.size();
+}
+
+void frustumFromMatrix(const float* viewProj, Frustum& frustum)
+{
+    // Row r of a column-major matrix is m[r], m[4 + r], m[8 + r], m[12 + r]
+    auto row = [viewProj](int r, int c) { return viewProj[4 * c + r]; };
+    for (int p = 0; p < 6; ++p)
+    {
+        int axis = p / 2;
+        float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+        float* plane = frustum.planes[p];
+        for (int c = 0; c < 4; ++c)
+        {
+            plane[c] = row(3, c) + sign * row(axis, c);
+        }
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                plane[c] /= length;
+            }
+        }
+    }
+}
+
+bool sphereInFrustum(const Frustum& frustum, float x, float y, float z, float radius)
+{
+    for (const float* plane : frustum.planes)
+    {
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool boxInFrustum(const Frustum& frustum, const float* center, const float* extents)
+{
+    for (const float* plane : frustum.planes)
+    {
+        float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+        float projectedRadius = std::fabs(plane[0]) * extents[0] + std::fabs(plane[1]) * extents[1] +
+                                std::fabs(plane[2]) * extents[2];
+        if (distance < -projectedRadius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible)
+{
+    const size_t count = spheres.size();
+    const float* xs = spheres.x.data();
+    const float* ys = spheres.y.data();
+    const float* zs = spheres.z.data();
+    const float* rs = spheres.radius.data();
+    size_t visibleCount = 0;
+    size_t i = 0;
+
+#if defined(CULLING_SSE2)
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; ++p)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+        }
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+                                         _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            visible[visibleCount] = (uint32_t)(i + lane);
+            visibleCount += (mask >> lane) & 1;
+        }
+    }
+#elif defined(CULLING_NEON)
+    float32x4_t planes[6][4];
+    for (int p = 0; p < 6; ++p)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            planes[p][c] = vdupq_n_f32(frustum.planes[p][c]);
+        }
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t x = vld1q_f32(xs + i);
+        float32x4_t y = vld1q_f32(ys + i);
+        float32x4_t z = vld1q_f32(zs + i);
+        float32x4_t negRadius = vnegq_f32(vld1q_f32(rs + i));
+        uint32x4_t inside = vdupq_n_u32(~0u);
+        for (int p = 0; p < 6; ++p)
+        {
+            float32x4_t distance = vmlaq_f32(planes[p][3], planes[p][0], x);
+            distance = vmlaq_f32(distance, planes[p][1], y);
+            distance = vmlaq_f32(distance, planes[p][2], z);
+            inside = vandq_u32(inside, vcgeq_f32(distance, negRadius));
+        }
+        uint32_t lanes[4];
+        vst1q_u32(lanes, inside);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            visible[visibleCount] = (uint32_t)(i + lane);
+            visibleCount += lanes[lane] & 1;
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        visible[visibleCount] = (uint32_t)i;
+        visibleCount += sphereInFrustum(frustum, xs[i], ys[i], zs[i], rs[i]) ? 1 : 0;
+    }
+    return visibleCount;
+}
+
+namespace {
+    // Spread the lower 10 bits of v so that there are two zero bits between each of them
+    uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+}
+
+std::vector<uint32_t> spatialOrder(const BoundingSpheres& spheres)
+{
+    const size_t count = spheres.size();
+    std::vector<uint32_t> order(count);
+    if (count == 0)
+    {
+        return order;
+    }
+
+    const std::vector<float>* axes[3] = {&spheres.x, &spheres.y, &spheres.z};
+    float lo[3], scale[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        auto range = std::minmax_element(axes[a]->begin(), axes[a]->end());
+        lo[a] = *range.first;
+        float extent = *range.second - *range.first;
+        scale[a] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+    }
+
+    std::vector<uint32_t> codes(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t code = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            uint32_t q = (uint32_t)(((*axes[a])[i] - lo[a]) * scale[a] + 0.5f);
+            code |= spreadBits(q) << a;
+        }
+        codes[i] = code;
+        order[i] = (uint32_t)i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&codes](uint32_t a, uint32_t b) {
+        return codes[a] < codes[b];
+    });
+    return order;
+}
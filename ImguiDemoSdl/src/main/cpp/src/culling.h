@@ -0,0 +1,67 @@
+//
+// View frustum culling for bounding volumes stored as structures of arrays.
+// No GL or glm dependencies; matrices are plain column-major float[16].
+//
+
+#ifndef IMGUI_DEMO_CULLING_H
+#define IMGUI_DEMO_CULLING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Six planes (left, right, bottom, top, near, far) as (a, b, c, d), normalized so that
+ * a*x + b*y + c*z + d is the signed distance to the plane, positive inside.
+ */
+struct Frustum {
+    float planes[6][4];
+};
+
+/**
+ * Bounding spheres, one per object, as a structure of arrays so that
+ * several objects can be tested at once.
+ */
+struct BoundingSpheres {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    void resize(size_t count);
+    size_t size() const;
+};
+
+/**
+ * Extract frustum planes from a view-projection matrix (Gribb/Hartmann)
+ * @param viewProj Column-major view-projection matrix with GL clip space conventions
+ * @param frustum Receives the planes; objects are in world space if viewProj is
+ */
+void frustumFromMatrix(const float* viewProj, Frustum& frustum);
+
+bool sphereInFrustum(const Frustum& frustum, float x, float y, float z, float radius);
+
+/**
+ * Test an axis-aligned box against the frustum
+ * @param center Box center
+ * @param extents Half sizes along each axis
+ * @return false if the box is completely outside of at least one plane
+ */
+bool boxInFrustum(const Frustum& frustum, const float* center, const float* extents);
+
+/**
+ * Test all spheres against the frustum, four at a time where SSE2 or NEON is available
+ * @param visible Receives indices of the spheres that are at least partially inside,
+ *                in increasing order; must have room for spheres.size() entries
+ * @return Number of visible spheres
+ */
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible);
+
+/**
+ * Order objects along a Morton (Z-order) curve so that consecutive objects are close
+ * to each other; cutting the result into runs gives reasonably tight clusters.
+ * @return Permutation: element i is the index of the object that should come i-th
+ */
+std::vector<uint32_t> spatialOrder(const BoundingSpheres& spheres);
+
+#endif //IMGUI_DEMO_CULLING_H
@@ -0,0 +1,194 @@
+//
+// Dynamic resolution for the scene.
+//
+
+#include "dynamic_resolution.h"
+#include "trace.h"
+
+#include <cmath>
+
+// Below this fraction of the budget, there's room to go up again; between it and the budget, nothing changes
+static const float budgetLowWater = 0.85f;
+// How far towards the estimated scale each update goes
+static const float scaleDamping = 0.2f;
+// scale() rounds to multiples of this
+static const float scaleStep = 1.0f / 64.0f;
+
+ResolutionController::ResolutionController() : minScale(0.5f), current(1.0f)
+{
+}
+
+void ResolutionController::setMinScale(float minScale)
+{
+    this->minScale = minScale < scaleStep ? scaleStep : minScale > 1.0f ? 1.0f : minScale;
+}
+
+float ResolutionController::update(float gpuFrameMs, float budgetMs)
+{
+    if (gpuFrameMs > 0.0f && budgetMs > 0.0f &&
+        (gpuFrameMs > budgetMs || gpuFrameMs < budgetMs * budgetLowWater))
+    {
+        // Aim for the middle of the band, so that a frame that just made it doesn't bounce right back
+        float target = budgetMs * (1.0f + budgetLowWater) * 0.5f;
+        float estimate = current * std::sqrt(target / gpuFrameMs);
+        current += (estimate - current) * scaleDamping;
+    }
+    current = current < minScale ? minScale : current > 1.0f ? 1.0f : current;
+    traceCounter("resolution scale", scale());
+    return scale();
+}
+
+float ResolutionController::scale()
+{
+    float rounded = std::floor(current / scaleStep + 0.5f) * scaleStep;
+    return rounded > 1.0f ? 1.0f : rounded;
+}
+
+void ResolutionController::reset()
+{
+    current = 1.0f;
+}
+
+static const char* upscaleVtxShader =
+"attribute vec2 g_Position;\n"
+"uniform vec2 uvScale;\n"
+"varying vec2 uv;\n"
+"\n"
+"void main() {\n"
+"  uv = (g_Position * 0.5 + 0.5) * uvScale;\n"
+"  gl_Position = vec4(g_Position, 0.0, 1.0);\n"
+"}";
+
+static const char* upscaleFragShader =
+"uniform sampler2D source;\n"
+"// Last texel center inside the rendered part; keeps bilinear taps from reaching what's outside of it\n"
+"uniform vec2 uvMax;\n"
+"uniform vec2 texelSize;\n"
+"uniform float sharpness;\n"
+"varying vec2 uv;\n"
+"\n"
+"vec3 tap(vec2 p) {\n"
+"  return texture2D(source, clamp(p, vec2(0.0), uvMax)).rgb;\n"
+"}\n"
+"\n"
+"void main() {\n"
+"  vec3 color = tap(uv);\n"
+"#ifdef SHARPEN\n"
+"  vec3 neighbours = tap(uv + vec2(texelSize.x, 0.0)) + tap(uv - vec2(texelSize.x, 0.0)) +\n"
+"                    tap(uv + vec2(0.0, texelSize.y)) + tap(uv - vec2(0.0, texelSize.y));\n"
+"  color = clamp(color + (color * 4.0 - neighbours) * (0.25 * sharpness), 0.0, 1.0);\n"
+"#endif\n"
+"  FRAG_COLOR = vec4(color, 1.0);\n"
+"}";
+
+// One triangle covering the whole viewport
+static const GLfloat fullscreenTriangle[] = {
+        -1.0f, -1.0f,   3.0f, -1.0f,   -1.0f, 3.0f
+};
+
+Upscaler::Upscaler() : vbo(0)
+#ifdef GL_PROFILE_GL3
+        , vao(0)
+#endif
+{
+    for (int i = 0; i < FILTER_COUNT; ++i)
+    {
+        programs[i].resolved = false;
+    }
+}
+
+Upscaler::~Upscaler()
+{
+    if (vbo)
+    {
+        glDeleteBuffers(1, &vbo);
+    }
+#ifdef GL_PROFILE_GL3
+    if (vao)
+    {
+        glDeleteVertexArrays(1, &vao);
+    }
+#endif
+}
+
+void Upscaler::init()
+{
+    programs[FILTER_BILINEAR].build.start("", upscaleVtxShader, upscaleFragShader);
+    programs[FILTER_SHARPEN].build.start("#define SHARPEN\n", upscaleVtxShader, upscaleFragShader);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreenTriangle), fullscreenTriangle, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool Upscaler::ready(Filter filter)
+{
+    filterProgram& prog = programs[filter];
+    if (prog.resolved)
+    {
+        return true;
+    }
+    if (prog.build.poll() != ShaderProgram::PROGRAM_READY)
+    {
+        return false;
+    }
+    GLuint id = prog.build.id();
+    prog.position = glGetAttribLocation(id, "g_Position");
+    prog.uvScale = glGetUniformLocation(id, "uvScale");
+    prog.uvMax = glGetUniformLocation(id, "uvMax");
+    prog.texelSize = glGetUniformLocation(id, "texelSize");
+    prog.sharpness = glGetUniformLocation(id, "sharpness");
+    prog.source = glGetUniformLocation(id, "source");
+    prog.resolved = true;
+
+#ifdef GL_PROFILE_GL3
+    if (vao == 0)
+    {
+        glGenVertexArrays(1, &vao);
+    }
+    // The attribute is at the same location in both programs in practice, but don't rely on it
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray((GLuint) prog.position);
+    glVertexAttribPointer((GLuint) prog.position, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glBindVertexArray(0);
+#endif
+    return true;
+}
+
+void Upscaler::draw(const RenderTarget& source, int width, int height, Filter filter, float sharpness)
+{
+    TRACE_SCOPE("upscale");
+    const filterProgram& prog = programs[filter];
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glDepthMask(GL_FALSE);
+
+    glUseProgram(prog.build.id());
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source.texture());
+    glUniform1i(prog.source, 0);
+    float texelW = 1.0f / source.width();
+    float texelH = 1.0f / source.height();
+    glUniform2f(prog.uvScale, width * texelW, height * texelH);
+    glUniform2f(prog.uvMax, (width - 0.5f) * texelW, (height - 0.5f) * texelH);
+    glUniform2f(prog.texelSize, texelW, texelH);
+    glUniform1f(prog.sharpness, sharpness);
+
+#ifdef GL_PROFILE_GL3
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+#else
+    // No VAOs on ES2; leave the attribute disabled again so it doesn't leak into the teapot's draws
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray((GLuint) prog.position);
+    glVertexAttribPointer((GLuint) prog.position, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisableVertexAttribArray((GLuint) prog.position);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+    glDepthMask(GL_TRUE);
+}
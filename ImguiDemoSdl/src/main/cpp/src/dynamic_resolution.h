@@ -0,0 +1,102 @@
+//
+// Dynamic resolution for the scene: the scene is drawn into part of an offscreen target, and that
+// part is stretched over the window afterwards. How large a part is picked from the measured
+// GPU frame time, so that the frame stays within a time budget.
+//
+
+#ifndef IMGUI_DEMO_DYNAMIC_RESOLUTION_H
+#define IMGUI_DEMO_DYNAMIC_RESOLUTION_H
+
+#include "gl_ext.h"
+#include "shader_program.h"
+#include "render_target.h"
+
+/**
+ * Picks the scene scale from GPU frame times. Shading cost goes with the pixel count, i.e. with the
+ * square of the scale; the scale is moved part of the way towards the estimate each frame, since
+ * the measured times lag a few frames behind.
+ */
+class ResolutionController {
+public:
+    ResolutionController();
+
+    /**
+     * @param minScale Lowest scale to go down to, on each axis
+     */
+    void setMinScale(float minScale);
+
+    /**
+     * @param gpuFrameMs Measured GPU time per frame; values <= 0 (no measurement) are ignored
+     * @param budgetMs GPU time a frame is allowed to take
+     * @return Scale to render the scene at, (0, 1]
+     */
+    float update(float gpuFrameMs, float budgetMs);
+    float scale();
+
+    /**
+     * Forget the adjustments so far and start over at full resolution
+     */
+    void reset();
+
+private:
+    float minScale;
+    // Unrounded; scale() hands out a rounded value, so that small corrections don't make the image swim
+    float current;
+};
+
+/**
+ * Stretches the rendered part of a target over the current viewport
+ */
+class Upscaler {
+public:
+    enum Filter {
+        FILTER_BILINEAR = 0,
+        // Bilinear plus a 5-tap unsharp mask, to win back some of the detail lost to the lower resolution
+        FILTER_SHARPEN,
+        FILTER_COUNT
+    };
+
+    Upscaler();
+    ~Upscaler();
+
+    /**
+     * Start compiling the programs. Requires a current context.
+     */
+    void init();
+
+    /**
+     * @return true once draw() can be used with this filter
+     */
+    bool ready(Filter filter);
+
+    /**
+     * Draw the bottom left width x height pixels of the source over the whole viewport. Depth test,
+     * blending and culling are left disabled.
+     * @param sharpness Strength of FILTER_SHARPEN, 0..1
+     */
+    void draw(const RenderTarget& source, int width, int height, Filter filter, float sharpness);
+
+private:
+    Upscaler(const Upscaler&);
+    Upscaler& operator=(const Upscaler&);
+
+    struct filterProgram {
+        ShaderProgram build;
+        // Set once the locations below have been looked up
+        bool resolved;
+        GLint position;
+        GLint uvScale;
+        GLint uvMax;
+        GLint texelSize;
+        GLint sharpness;
+        GLint source;
+    };
+
+    filterProgram programs[FILTER_COUNT];
+    GLuint vbo;
+#ifdef GL_PROFILE_GL3
+    GLuint vao;
+#endif
+};
+
+#endif //IMGUI_DEMO_DYNAMIC_RESOLUTION_H
@@ -0,0 +1,688 @@
+//
+// Prefiltered environment maps, convolved on the CPU and cached on disk.
+//
+// Each output texel is a weighted sum over all texels of a (downsampled) copy of the sky. The
+// specular lobes are cos^p around the texel's direction, with p a power of two so that it can be
+// raised to by repeated squaring; p is picked per level from the roughness, the way GGX roughness
+// maps to a Phong exponent. The irradiance map uses the plain cosine lobe. Sums are taken in linear
+// space, weighted by each source texel's solid angle. Source texels are grouped in small tiles,
+// and tiles where the lobe has dropped to nothing are skipped, which is most of them for sharp lobes.
+//
+
+#include "environment_prefilter.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PREFILTER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PREFILTER_NEON
+#endif
+
+namespace {
+    // Top level of the specular map; the sharpest lobes need about this much detail and no more
+    const int specularSize = 128;
+    const int roughLevels = 6;
+    const int irradianceSize = 32;
+    // Wide lobes are convolved from a copy of the sky at least this large, but no larger than the output
+    const int minSourceSize = 32;
+    // p = 2^maxSquarings for the sharpest lobe
+    const int maxSquarings = 12;
+    // Lobe weight below which source texels are skipped
+    const float lobeCutoff = 1e-4f;
+
+    const char prefilterCacheMagic[4] = {'P', 'E', 'N', 'V'};
+    // Bump when the convolution changes, so stale results aren't picked up
+    const uint32_t prefilterCacheVersion = 1;
+
+    struct PrefilterCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceKey;
+        uint32_t specularSize;
+        uint32_t levels;
+        uint32_t roughLevels;
+        uint32_t irradianceSize;
+    };
+
+    static_assert(sizeof(PrefilterCacheHeader) == 32, "PrefilterCacheHeader must not have padding");
+
+    bool g_cacheEnabled = false;
+    std::string g_directory;
+
+    // 64-bit FNV-1a, same as the program cache
+    const uint64_t hashSeed = 14695981039346656037ull;
+
+    uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string cachePath(uint64_t key)
+    {
+        char name[40];
+        snprintf(name, sizeof(name), "environment-%016llx.bin", (unsigned long long)key);
+        return g_directory + name;
+    }
+
+    /**
+     * Cube faces in linear RGB floats
+     */
+    struct linearCube {
+        int size;
+        std::vector<float> faces[6];
+    };
+
+    /**
+     * A square block of texels on one face, and a cone around axis that holds all of them
+     */
+    struct sourceTile {
+        size_t begin;
+        size_t end;
+        float axis[3];
+        // Angle between the axis and the texel furthest from it
+        float spread;
+    };
+
+    /**
+     * Texels to convolve over, as a structure of arrays: unit directions, and linear color and
+     * weight premultiplied by the solid angle the texel covers. Stored tile by tile, each padded to
+     * a multiple of four with texels that weigh nothing, so that tiles outside a lobe can be skipped.
+     */
+    struct sourceTexels {
+        std::vector<float> x, y, z;
+        std::vector<float> r, g, b, w;
+        std::vector<sourceTile> tiles;
+    };
+
+    /**
+     * Unit direction through the center of a texel, as GL looks cubemaps up
+     */
+    void texelDirection(int face, int size, int s, int t, float* dir)
+    {
+        float u = 2.0f * (s + 0.5f) / size - 1.0f;
+        float v = 2.0f * (t + 0.5f) / size - 1.0f;
+        float x, y, z;
+        switch (face)
+        {
+            case 0: x = 1.0f; y = -v; z = -u; break;
+            case 1: x = -1.0f; y = -v; z = u; break;
+            case 2: x = u; y = 1.0f; z = v; break;
+            case 3: x = u; y = -1.0f; z = -v; break;
+            case 4: x = u; y = -v; z = 1.0f; break;
+            default: x = -u; y = -v; z = -1.0f; break;
+        }
+        float invLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+        dir[0] = x * invLength;
+        dir[1] = y * invLength;
+        dir[2] = z * invLength;
+    }
+
+    float texelSolidAngle(int size, int s, int t)
+    {
+        float u = 2.0f * (s + 0.5f) / size - 1.0f;
+        float v = 2.0f * (t + 0.5f) / size - 1.0f;
+        float texelArea = 4.0f / ((float) size * size);
+        float d = 1.0f + u * u + v * v;
+        return texelArea / (d * std::sqrt(d));
+    }
+
+    uint8_t linearToSrgb(float value)
+    {
+        float encoded = std::pow(std::max(value, 0.0f), 1.0f / 2.2f) * 255.0f + 0.5f;
+        return (uint8_t) std::min(encoded, 255.0f);
+    }
+
+    void decode(const CubeImage& image, linearCube& result)
+    {
+        float table[256];
+        for (int i = 0; i < 256; ++i)
+        {
+            table[i] = std::pow(i / 255.0f, 2.2f);
+        }
+        result.size = image.size;
+        for (int f = 0; f < 6; ++f)
+        {
+            const std::vector<uint8_t>& src = image.faces[f];
+            result.faces[f].resize(src.size());
+            for (size_t i = 0; i < src.size(); ++i)
+            {
+                result.faces[f][i] = table[src[i]];
+            }
+        }
+    }
+
+    /**
+     * Area average down to a smaller size
+     */
+    void downsample(const linearCube& source, int size, linearCube& result)
+    {
+        result.size = size;
+        for (int f = 0; f < 6; ++f)
+        {
+            const std::vector<float>& src = source.faces[f];
+            std::vector<float>& dst = result.faces[f];
+            dst.assign((size_t) size * size * 3, 0.0f);
+            for (int t = 0; t < size; ++t)
+            {
+                int t0 = t * source.size / size;
+                int t1 = std::max(t0 + 1, (t + 1) * source.size / size);
+                for (int s = 0; s < size; ++s)
+                {
+                    int s0 = s * source.size / size;
+                    int s1 = std::max(s0 + 1, (s + 1) * source.size / size);
+                    float sum[3] = {0.0f, 0.0f, 0.0f};
+                    for (int y = t0; y < t1; ++y)
+                    {
+                        const float* row = &src[((size_t) y * source.size + s0) * 3];
+                        for (int x = 0; x < s1 - s0; ++x)
+                        {
+                            sum[0] += row[x * 3];
+                            sum[1] += row[x * 3 + 1];
+                            sum[2] += row[x * 3 + 2];
+                        }
+                    }
+                    float scale = 1.0f / ((t1 - t0) * (s1 - s0));
+                    float* out = &dst[((size_t) t * size + s) * 3];
+                    out[0] = sum[0] * scale;
+                    out[1] = sum[1] * scale;
+                    out[2] = sum[2] * scale;
+                }
+            }
+        }
+    }
+
+    void encode(const linearCube& cube, CubeImage& result)
+    {
+        result.size = cube.size;
+        for (int f = 0; f < 6; ++f)
+        {
+            result.faces[f].resize(cube.faces[f].size());
+            for (size_t i = 0; i < cube.faces[f].size(); ++i)
+            {
+                result.faces[f][i] = linearToSrgb(cube.faces[f][i]);
+            }
+        }
+    }
+
+    void gatherTexels(const linearCube& cube, sourceTexels& texels)
+    {
+        const int tileSize = std::min(8, cube.size);
+        std::vector<float>* arrays[] = {&texels.x, &texels.y, &texels.z, &texels.r, &texels.g, &texels.b, &texels.w};
+        for (std::vector<float>* array : arrays)
+        {
+            array->clear();
+            array->reserve((size_t) cube.size * cube.size * 6 + 3);
+        }
+        texels.tiles.clear();
+        for (int f = 0; f < 6; ++f)
+        {
+            for (int tileT = 0; tileT < cube.size; tileT += tileSize)
+            {
+                for (int tileS = 0; tileS < cube.size; tileS += tileSize)
+                {
+                    sourceTile tile;
+                    tile.begin = texels.w.size();
+                    float axis[3] = {0.0f, 0.0f, 0.0f};
+                    for (int t = tileT; t < std::min(tileT + tileSize, cube.size); ++t)
+                    {
+                        for (int s = tileS; s < std::min(tileS + tileSize, cube.size); ++s)
+                        {
+                            float dir[3];
+                            texelDirection(f, cube.size, s, t, dir);
+                            float weight = texelSolidAngle(cube.size, s, t);
+                            const float* color = &cube.faces[f][((size_t) t * cube.size + s) * 3];
+                            texels.x.push_back(dir[0]);
+                            texels.y.push_back(dir[1]);
+                            texels.z.push_back(dir[2]);
+                            texels.r.push_back(color[0] * weight);
+                            texels.g.push_back(color[1] * weight);
+                            texels.b.push_back(color[2] * weight);
+                            texels.w.push_back(weight);
+                            for (int c = 0; c < 3; ++c)
+                            {
+                                axis[c] += dir[c];
+                            }
+                        }
+                    }
+                    while ((texels.w.size() - tile.begin) % 4 != 0)
+                    {
+                        for (std::vector<float>* array : arrays)
+                        {
+                            array->push_back(0.0f);
+                        }
+                    }
+                    tile.end = texels.w.size();
+
+                    float invLength = 1.0f / std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+                    float minCos = 1.0f;
+                    for (size_t i = tile.begin; i < tile.end; ++i)
+                    {
+                        if (texels.w[i] > 0.0f)
+                        {
+                            minCos = std::min(minCos, (texels.x[i] * axis[0] + texels.y[i] * axis[1] +
+                                                       texels.z[i] * axis[2]) * invLength);
+                        }
+                    }
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        tile.axis[c] = axis[c] * invLength;
+                    }
+                    tile.spread = std::acos(std::max(-1.0f, std::min(minCos, 1.0f)));
+                    texels.tiles.push_back(tile);
+                }
+            }
+        }
+    }
+
+    bool tileInLobe(const sourceTile& tile, float minCos, const float* dir)
+    {
+        return tile.axis[0] * dir[0] + tile.axis[1] * dir[1] + tile.axis[2] * dir[2] >= minCos;
+    }
+
+    /**
+     * Weighted sum of the source texels with a cos^(2^squarings) lobe around dir
+     * @param tileMinCos Per tile: the lobe misses the tile if the tile's axis is further from dir than this
+     * @param sums Receives r, g, b and the total weight
+     */
+    void convolveTexel(const sourceTexels& src, const float* tileMinCos, const float* dir, int squarings,
+                       float* sums)
+    {
+        const size_t tileCount = src.tiles.size();
+#if defined(PREFILTER_SSE2)
+        const __m128 nx = _mm_set1_ps(dir[0]);
+        const __m128 ny = _mm_set1_ps(dir[1]);
+        const __m128 nz = _mm_set1_ps(dir[2]);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 accR = zero, accG = zero, accB = zero, accW = zero;
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            const sourceTile& tile = src.tiles[t];
+            if (!tileInLobe(tile, tileMinCos[t], dir))
+            {
+                continue;
+            }
+            for (size_t i = tile.begin; i < tile.end; i += 4)
+            {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(&src.x[i])), _mm_mul_ps(ny, _mm_loadu_ps(&src.y[i]))),
+                                      _mm_mul_ps(nz, _mm_loadu_ps(&src.z[i])));
+                d = _mm_max_ps(d, zero);
+                for (int k = 0; k < squarings; ++k)
+                {
+                    d = _mm_mul_ps(d, d);
+                }
+                accR = _mm_add_ps(accR, _mm_mul_ps(d, _mm_loadu_ps(&src.r[i])));
+                accG = _mm_add_ps(accG, _mm_mul_ps(d, _mm_loadu_ps(&src.g[i])));
+                accB = _mm_add_ps(accB, _mm_mul_ps(d, _mm_loadu_ps(&src.b[i])));
+                accW = _mm_add_ps(accW, _mm_mul_ps(d, _mm_loadu_ps(&src.w[i])));
+            }
+        }
+        float lanes[4][4];
+        _mm_storeu_ps(lanes[0], accR);
+        _mm_storeu_ps(lanes[1], accG);
+        _mm_storeu_ps(lanes[2], accB);
+        _mm_storeu_ps(lanes[3], accW);
+        for (int c = 0; c < 4; ++c)
+        {
+            sums[c] = lanes[c][0] + lanes[c][1] + lanes[c][2] + lanes[c][3];
+        }
+#elif defined(PREFILTER_NEON)
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        float32x4_t accR = zero, accG = zero, accB = zero, accW = zero;
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            const sourceTile& tile = src.tiles[t];
+            if (!tileInLobe(tile, tileMinCos[t], dir))
+            {
+                continue;
+            }
+            for (size_t i = tile.begin; i < tile.end; i += 4)
+            {
+                float32x4_t d = vmulq_n_f32(vld1q_f32(&src.x[i]), dir[0]);
+                d = vmlaq_n_f32(d, vld1q_f32(&src.y[i]), dir[1]);
+                d = vmlaq_n_f32(d, vld1q_f32(&src.z[i]), dir[2]);
+                d = vmaxq_f32(d, zero);
+                for (int k = 0; k < squarings; ++k)
+                {
+                    d = vmulq_f32(d, d);
+                }
+                accR = vmlaq_f32(accR, d, vld1q_f32(&src.r[i]));
+                accG = vmlaq_f32(accG, d, vld1q_f32(&src.g[i]));
+                accB = vmlaq_f32(accB, d, vld1q_f32(&src.b[i]));
+                accW = vmlaq_f32(accW, d, vld1q_f32(&src.w[i]));
+            }
+        }
+        float lanes[4][4];
+        vst1q_f32(lanes[0], accR);
+        vst1q_f32(lanes[1], accG);
+        vst1q_f32(lanes[2], accB);
+        vst1q_f32(lanes[3], accW);
+        for (int c = 0; c < 4; ++c)
+        {
+            sums[c] = lanes[c][0] + lanes[c][1] + lanes[c][2] + lanes[c][3];
+        }
+#else
+        sums[0] = sums[1] = sums[2] = sums[3] = 0.0f;
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            const sourceTile& tile = src.tiles[t];
+            if (!tileInLobe(tile, tileMinCos[t], dir))
+            {
+                continue;
+            }
+            for (size_t i = tile.begin; i < tile.end; ++i)
+            {
+                float d = std::max(dir[0] * src.x[i] + dir[1] * src.y[i] + dir[2] * src.z[i], 0.0f);
+                for (int k = 0; k < squarings; ++k)
+                {
+                    d *= d;
+                }
+                sums[0] += d * src.r[i];
+                sums[1] += d * src.g[i];
+                sums[2] += d * src.b[i];
+                sums[3] += d * src.w[i];
+            }
+        }
+#endif
+    }
+
+    /**
+     * Run body(0) .. body(count - 1) on all cores; the calling thread takes part
+     */
+    template <typename F>
+    void parallelFor(int count, const F& body)
+    {
+        std::atomic<int> next(0);
+        auto worker = [&next, count, &body]() {
+            for (int i = next++; i < count; i = next++)
+            {
+                body(i);
+            }
+        };
+        const unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (unsigned t = 1; t < threadCount; ++t)
+        {
+            threads.push_back(std::thread(worker));
+        }
+        worker();
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    /**
+     * Convolve the sky into a cube of the given size; rows are handed out to the threads one by one
+     */
+    void convolve(const sourceTexels& src, int size, int squarings, CubeImage& result)
+    {
+        result.size = size;
+        for (int f = 0; f < 6; ++f)
+        {
+            result.faces[f].resize((size_t) size * size * 3);
+        }
+        // Past this angle from its center the lobe weighs less than lobeCutoff; a tile that's entirely
+        // further out than that is left out
+        const float p = (float) (1 << squarings);
+        const float cutoffAngle = std::acos(std::pow(lobeCutoff, 1.0f / p));
+        std::vector<float> tileMinCos(src.tiles.size());
+        for (size_t t = 0; t < src.tiles.size(); ++t)
+        {
+            float angle = src.tiles[t].spread + cutoffAngle;
+            tileMinCos[t] = angle >= (float) M_PI ? -2.0f : std::cos(angle);
+        }
+        const float* minCos = tileMinCos.data();
+        parallelFor(6 * size, [&src, minCos, size, squarings, &result](int row) {
+            const int f = row / size;
+            const int t = row % size;
+            uint8_t* out = &result.faces[f][(size_t) t * size * 3];
+            for (int s = 0; s < size; ++s)
+            {
+                float dir[3];
+                texelDirection(f, size, s, t, dir);
+                float sums[4];
+                convolveTexel(src, minCos, dir, squarings, sums);
+                float invWeight = sums[3] > 0.0f ? 1.0f / sums[3] : 0.0f;
+                out[s * 3] = linearToSrgb(sums[0] * invWeight);
+                out[s * 3 + 1] = linearToSrgb(sums[1] * invWeight);
+                out[s * 3 + 2] = linearToSrgb(sums[2] * invWeight);
+            }
+        });
+    }
+
+    /**
+     * @return Squarings for the lobe of a roughness: GGX alpha = roughness^2 matches a Phong
+     * exponent of 2 / alpha^2 - 2, rounded to a power of two here
+     */
+    int lobeSquarings(float roughness)
+    {
+        float alpha = roughness * roughness;
+        if (alpha <= 0.0f)
+        {
+            return maxSquarings;
+        }
+        float exponent = std::max(2.0f / (alpha * alpha) - 2.0f, 1.0f);
+        int squarings = (int) std::floor(std::log2(exponent) + 0.5f);
+        return std::max(0, std::min(squarings, maxSquarings));
+    }
+
+    size_t cubeBytes(int size)
+    {
+        return (size_t) size * size * 3;
+    }
+
+    uint64_t sourceKey(const CubeImage& source)
+    {
+        uint64_t hash = hashSeed;
+        const uint32_t params[] = {prefilterCacheVersion, (uint32_t) source.size, (uint32_t) specularSize,
+                                   (uint32_t) roughLevels, (uint32_t) irradianceSize};
+        hash = hashBytes(hash, params, sizeof(params));
+        for (int f = 0; f < 6; ++f)
+        {
+            hash = hashBytes(hash, source.faces[f].data(), source.faces[f].size());
+        }
+        return hash;
+    }
+
+    int levelCount()
+    {
+        int levels = 1;
+        while ((specularSize >> (levels - 1)) > 1)
+        {
+            ++levels;
+        }
+        return levels;
+    }
+
+    void allocate(CubeImage& image, int size)
+    {
+        image.size = size;
+        for (int f = 0; f < 6; ++f)
+        {
+            image.faces[f].resize(cubeBytes(size));
+        }
+    }
+
+    bool loadCached(uint64_t key, PrefilteredEnvironment& result)
+    {
+        if (!g_cacheEnabled)
+        {
+            return false;
+        }
+        const std::string path = cachePath(key);
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+        {
+            return false;
+        }
+        PrefilterCacheHeader header;
+        bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+                  memcmp(header.magic, prefilterCacheMagic, sizeof(prefilterCacheMagic)) == 0 &&
+                  header.version == prefilterCacheVersion &&
+                  header.sourceKey == key &&
+                  header.specularSize == (uint32_t) specularSize &&
+                  header.levels == (uint32_t) levelCount() &&
+                  header.roughLevels == (uint32_t) roughLevels &&
+                  header.irradianceSize == (uint32_t) irradianceSize;
+        if (ok)
+        {
+            result.specular.resize(header.levels);
+            for (uint32_t level = 0; ok && level < header.levels; ++level)
+            {
+                allocate(result.specular[level], specularSize >> level);
+                for (int face = 0; ok && face < 6; ++face)
+                {
+                    std::vector<uint8_t>& data = result.specular[level].faces[face];
+                    ok = fread(data.data(), data.size(), 1, f) == 1;
+                }
+            }
+            allocate(result.irradiance, irradianceSize);
+            for (int face = 0; ok && face < 6; ++face)
+            {
+                std::vector<uint8_t>& data = result.irradiance.faces[face];
+                ok = fread(data.data(), data.size(), 1, f) == 1;
+            }
+            result.roughLevels = roughLevels;
+        }
+        fclose(f);
+        if (!ok)
+        {
+            Log(LOG_INFO) << "Cached environment " << path << " is stale, convolving again";
+        }
+        return ok;
+    }
+
+    void storeCached(uint64_t key, const PrefilteredEnvironment& result)
+    {
+        if (!g_cacheEnabled)
+        {
+            return;
+        }
+        PrefilterCacheHeader header;
+        memcpy(header.magic, prefilterCacheMagic, sizeof(prefilterCacheMagic));
+        header.version = prefilterCacheVersion;
+        header.sourceKey = key;
+        header.specularSize = (uint32_t) specularSize;
+        header.levels = (uint32_t) result.specular.size();
+        header.roughLevels = (uint32_t) result.roughLevels;
+        header.irradianceSize = (uint32_t) irradianceSize;
+
+        // Write to a temporary file first, so a crash halfway through never leaves a truncated entry
+        const std::string path = cachePath(key);
+        const std::string tempPath = path + ".tmp";
+        FILE* f = fopen(tempPath.c_str(), "wb");
+        if (!f)
+        {
+            Log(LOG_WARN) << "Could not write environment cache file " << tempPath;
+            return;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        for (size_t level = 0; ok && level < result.specular.size(); ++level)
+        {
+            for (int face = 0; ok && face < 6; ++face)
+            {
+                const std::vector<uint8_t>& data = result.specular[level].faces[face];
+                ok = fwrite(data.data(), data.size(), 1, f) == 1;
+            }
+        }
+        for (int face = 0; ok && face < 6; ++face)
+        {
+            const std::vector<uint8_t>& data = result.irradiance.faces[face];
+            ok = fwrite(data.data(), data.size(), 1, f) == 1;
+        }
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            Log(LOG_WARN) << "Could not write environment cache file " << path;
+            remove(tempPath.c_str());
+        }
+    }
+}
+
+void prefilterCacheInit(const char* directory)
+{
+    g_cacheEnabled = directory != NULL;
+    g_directory = directory != NULL ? directory : "";
+}
+
+bool prefilterEnvironment(const CubeImage& source, PrefilteredEnvironment& result)
+{
+    if (source.size < specularSize)
+    {
+        Log(LOG_WARN) << "Sky is " << source.size << " texels across, too small to prefilter";
+        return false;
+    }
+    for (int f = 0; f < 6; ++f)
+    {
+        if (source.faces[f].size() != cubeBytes(source.size))
+        {
+            Log(LOG_WARN) << "Sky faces differ in size, not prefiltering";
+            return false;
+        }
+    }
+
+    TRACE_SCOPE("prefilter environment");
+    const uint64_t key = sourceKey(source);
+    if (loadCached(key, result))
+    {
+        return true;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    linearCube sky;
+    decode(source, sky);
+    const int levels = levelCount();
+    result.specular.resize(levels);
+    result.roughLevels = roughLevels;
+
+    // The top level is a mirror: nothing to convolve, just a smaller copy of the sky
+    linearCube top;
+    downsample(sky, specularSize, top);
+    encode(top, result.specular[0]);
+
+    sourceTexels texels;
+    int texelsSize = 0;
+    for (int level = 1; level < levels; ++level)
+    {
+        const int size = specularSize >> level;
+        const float roughness = std::min(1.0f, level / (float) (roughLevels - 1));
+        // A lobe a few output texels wide doesn't need a source much finer than the output
+        const int sourceSize = std::min(specularSize, std::max(size, minSourceSize));
+        if (sourceSize != texelsSize)
+        {
+            linearCube reduced;
+            downsample(sky, sourceSize, reduced);
+            gatherTexels(reduced, texels);
+            texelsSize = sourceSize;
+        }
+        convolve(texels, size, lobeSquarings(roughness), result.specular[level]);
+    }
+
+    // Cosine lobe: p = 1, no squarings
+    linearCube reduced;
+    downsample(sky, std::min(irradianceSize, minSourceSize), reduced);
+    gatherTexels(reduced, texels);
+    convolve(texels, irradianceSize, 0, result.irradiance);
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    Log(LOG_INFO) << "Prefiltered the environment in " << (long long) elapsed.count() << " ms";
+    storeCached(key, result);
+    return true;
+}
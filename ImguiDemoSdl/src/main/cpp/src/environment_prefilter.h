@@ -0,0 +1,45 @@
+//
+// Prefiltered environment maps for rough reflections, computed on the CPU at load time: a mip chain
+// of ever blurrier copies of the sky for the specular part, and an irradiance map for the diffuse
+// part. The work is spread across threads with SIMD inner loops, and the results are cached on disk
+// keyed by the source pixels, so it's only done once. Shaders then need a single lookup per part.
+// No GL dependencies.
+//
+
+#ifndef IMGUI_DEMO_ENVIRONMENT_PREFILTER_H
+#define IMGUI_DEMO_ENVIRONMENT_PREFILTER_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Six square RGB8 faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, rows in upload order
+ */
+struct CubeImage {
+    int size;
+    std::vector<uint8_t> faces[6];
+};
+
+struct PrefilteredEnvironment {
+    // Mip levels of the specular map, down to 1x1. Level l is convolved for roughness
+    // l / (roughLevels - 1); the levels past that are as rough as it gets.
+    std::vector<CubeImage> specular;
+    int roughLevels;
+    // Cosine weighted average of the sky around each direction
+    CubeImage irradiance;
+};
+
+/**
+ * @param directory Directory for cache files, with a trailing separator (as returned by SDL_GetPrefPath);
+ * NULL to convolve on every start
+ */
+void prefilterCacheInit(const char* directory);
+
+/**
+ * Load the prefiltered maps for the sky from the cache, or convolve and cache them
+ * @param source Sky in sRGB; faces need to be the same size, at least as large as the top specular level
+ * @return false if the source can't be used
+ */
+bool prefilterEnvironment(const CubeImage& source, PrefilteredEnvironment& result);
+
+#endif //IMGUI_DEMO_ENVIRONMENT_PREFILTER_H
@@ -0,0 +1,254 @@
+//
+// Environment cubemap rendered from the scene, a few faces per frame.
+//
+
+#include "environment_probe.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// Directions and up vectors in GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order. Cubemap faces are
+// laid out with t going down, hence the flipped up vectors.
+static const glm::vec3 faceDirections[EnvironmentProbe::faceCount] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+static const glm::vec3 faceUps[EnvironmentProbe::faceCount] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+static const char* skyVtxShader =
+"attribute vec2 g_Position;\n"
+"// View space to world space, for directions\n"
+"uniform mat4 faceRotation;\n"
+"varying vec3 direction;\n"
+"\n"
+"void main() {\n"
+"  // 90 degree field of view, so the view space direction through (x, y) is (x, y, -1)\n"
+"  direction = (faceRotation * vec4(g_Position, -1.0, 0.0)).xyz;\n"
+"  gl_Position = vec4(g_Position, 0.0, 1.0);\n"
+"}";
+
+static const char* skyFragShader =
+"uniform samplerCube sky;\n"
+"varying vec3 direction;\n"
+"\n"
+"void main() {\n"
+"  FRAG_COLOR = textureCube(sky, direction);\n"
+"}";
+
+// One triangle covering the whole viewport
+static const GLfloat fullscreenTriangle[] = {
+        -1.0f, -1.0f,   3.0f, -1.0f,   -1.0f, 3.0f
+};
+
+EnvironmentProbe::EnvironmentProbe() : cubemap(0), framebuffer(0), depth(0), faceSize(0), framebufferComplete(false),
+                                       skyResolved(false), skyPosition(-1), skyFaceRotation(-1), skySampler(-1),
+                                       vbo(0),
+#ifdef GL_PROFILE_GL3
+                                       vao(0),
+#endif
+                                       cursor(0)
+{
+    for (int i = 0; i < faceCount; ++i)
+    {
+        faceDrawn[i] = false;
+        faceVersion[i] = 0;
+    }
+}
+
+EnvironmentProbe::~EnvironmentProbe()
+{
+    release();
+}
+
+bool EnvironmentProbe::init(int size)
+{
+    faceSize = size;
+    glGenTextures(1, &cubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    for (int i = 0; i < faceCount; ++i)
+    {
+#ifdef GL_PROFILE_GL3
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#else
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, glCaps().major >= 3 ? GL_RGBA8 : GL_RGBA, size, size, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#endif
+    }
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    // One depth buffer for all faces; it's cleared for each one anyway
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, size, size);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, cubemap, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    framebufferComplete = (status == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!framebufferComplete)
+    {
+        Log(LOG_ERROR) << "Environment cubemap " << size << "x" << size << " is incomplete: " << (unsigned) status;
+        return false;
+    }
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(fullscreenTriangle), fullscreenTriangle, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    skyBuild.start("", skyVtxShader, skyFragShader);
+    return true;
+}
+
+bool EnvironmentProbe::ready()
+{
+    if (skyResolved)
+    {
+        return true;
+    }
+    if (!framebufferComplete || skyBuild.poll() != ShaderProgram::PROGRAM_READY)
+    {
+        return false;
+    }
+    GLuint id = skyBuild.id();
+    skyPosition = glGetAttribLocation(id, "g_Position");
+    skyFaceRotation = glGetUniformLocation(id, "faceRotation");
+    skySampler = glGetUniformLocation(id, "sky");
+    skyResolved = true;
+
+#ifdef GL_PROFILE_GL3
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray((GLuint) skyPosition);
+    glVertexAttribPointer((GLuint) skyPosition, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glBindVertexArray(0);
+#endif
+    return true;
+}
+
+int EnvironmentProbe::nextFace(unsigned sceneVersion)
+{
+    for (int i = 0; i < faceCount; ++i)
+    {
+        int face = (cursor + i) % faceCount;
+        if (!faceDrawn[face] || faceVersion[face] != sceneVersion)
+        {
+            cursor = (face + 1) % faceCount;
+            return face;
+        }
+    }
+    return -1;
+}
+
+void EnvironmentProbe::beginFace(int face, GLuint sky, const glm::vec3& center, float zNear, float zFar,
+                                 glm::mat4& view, glm::mat4& projection)
+{
+    view = glm::lookAt(center, center + faceDirections[face], faceUps[face]);
+    projection = glm::perspective(glm::radians(90.0f), 1.0f, zNear, zFar);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubemap, 0);
+    glViewport(0, 0, faceSize, faceSize);
+    // The sky covers every pixel, but a clear tells tiled GPUs not to load the old contents
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDepthMask(GL_FALSE);
+    glUseProgram(skyBuild.id());
+    glm::mat4 faceRotation = glm::inverse(view);
+    glUniformMatrix4fv(skyFaceRotation, 1, GL_FALSE, &faceRotation[0][0]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, sky);
+    glUniform1i(skySampler, 1);
+#ifdef GL_PROFILE_GL3
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+#else
+    // No VAOs on ES2; leave the attribute disabled again so it doesn't leak into the teapot's draws
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray((GLuint) skyPosition);
+    glVertexAttribPointer((GLuint) skyPosition, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisableVertexAttribArray((GLuint) skyPosition);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+    glDepthMask(GL_TRUE);
+}
+
+void EnvironmentProbe::endFace(int face, unsigned sceneVersion)
+{
+    faceDrawn[face] = true;
+    faceVersion[face] = sceneVersion;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool EnvironmentProbe::complete() const
+{
+    for (int i = 0; i < faceCount; ++i)
+    {
+        if (!faceDrawn[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+GLuint EnvironmentProbe::texture() const
+{
+    return cubemap;
+}
+
+void EnvironmentProbe::release()
+{
+    if (framebuffer)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = 0;
+    }
+    if (depth)
+    {
+        glDeleteRenderbuffers(1, &depth);
+        depth = 0;
+    }
+    if (cubemap)
+    {
+        glDeleteTextures(1, &cubemap);
+        cubemap = 0;
+    }
+    if (vbo)
+    {
+        glDeleteBuffers(1, &vbo);
+        vbo = 0;
+    }
+#ifdef GL_PROFILE_GL3
+    if (vao)
+    {
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+#endif
+    skyBuild.release();
+    skyResolved = false;
+    framebufferComplete = false;
+    for (int i = 0; i < faceCount; ++i)
+    {
+        faceDrawn[i] = false;
+    }
+}
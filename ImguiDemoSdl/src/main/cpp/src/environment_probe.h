@@ -0,0 +1,89 @@
+//
+// Environment cubemap rendered from the scene. Faces are redrawn a few at a time, in round robin
+// order, so keeping reflections live costs the same small amount every frame.
+//
+
+#ifndef IMGUI_DEMO_ENVIRONMENT_PROBE_H
+#define IMGUI_DEMO_ENVIRONMENT_PROBE_H
+
+#include "gl_ext.h"
+#include "shader_program.h"
+
+#include <glm/matrix.hpp>
+
+class EnvironmentProbe {
+public:
+    static const int faceCount = 6;
+
+    EnvironmentProbe();
+    ~EnvironmentProbe();
+
+    /**
+     * Allocate the cubemap and its framebuffer, and start compiling the background program
+     * @param size Edge length of a face, in texels
+     * @return false if the framebuffer can't be rendered to
+     */
+    bool init(int size);
+
+    /**
+     * @return true once init() succeeded and the background program is ready
+     */
+    bool ready();
+
+    /**
+     * @param sceneVersion Changes whenever something that shows up in the faces changes
+     * @return Face to redraw next, going round robin over the faces that weren't drawn with
+     * sceneVersion yet; -1 if every face is up to date
+     */
+    int nextFace(unsigned sceneVersion);
+
+    /**
+     * Bind the face for drawing and fill it with the static sky as the background; the scene
+     * is then drawn on top with the returned matrices.
+     * @param sky Static environment cubemap
+     * @param center Where the probe sits, in world space
+     * @param zNear Near plane; anything closer to the center, like the object the probe sits in, is left out
+     */
+    void beginFace(int face, GLuint sky, const glm::vec3& center, float zNear, float zFar,
+                   glm::mat4& view, glm::mat4& projection);
+
+    /**
+     * Mark the face as drawn and go back to drawing into the window
+     */
+    void endFace(int face, unsigned sceneVersion);
+
+    /**
+     * @return true once every face was drawn at least once; until then the cubemap has holes
+     */
+    bool complete() const;
+    GLuint texture() const;
+
+    void release();
+
+private:
+    EnvironmentProbe(const EnvironmentProbe&);
+    EnvironmentProbe& operator=(const EnvironmentProbe&);
+
+    GLuint cubemap;
+    GLuint framebuffer;
+    GLuint depth;
+    int faceSize;
+    bool framebufferComplete;
+
+    ShaderProgram skyBuild;
+    bool skyResolved;
+    GLint skyPosition;
+    GLint skyFaceRotation;
+    GLint skySampler;
+    GLuint vbo;
+#ifdef GL_PROFILE_GL3
+    GLuint vao;
+#endif
+
+    // Round robin position, and what each face was drawn with
+    int cursor;
+    bool faceDrawn[faceCount];
+    unsigned faceVersion[faceCount];
+};
+
+#endif //IMGUI_DEMO_ENVIRONMENT_PROBE_H
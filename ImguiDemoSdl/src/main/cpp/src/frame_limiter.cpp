@@ -0,0 +1,181 @@
+//
+// Frames-in-flight limiter on top of fence sync objects.
+//
+
+#include "frame_limiter.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <SDL.h>
+#include <cstring>
+
+// How much a single frame moves the averages in FrameLimiterStats
+static const float statsWeight = 0.1f;
+// glClientWaitSync timeout; the wait is simply repeated, this only keeps a hung GPU from hanging us silently
+static const GLuint64 waitTimeoutNs = 100000000;
+
+static void average(float& value, float sample)
+{
+    value += (sample - value) * statsWeight;
+}
+
+FrameLimiter::FrameLimiter() : frames(2), first(0), queued(0), lastEnd(0)
+{
+    memset(queue, 0, sizeof(queue));
+    memset(&frameStats, 0, sizeof(frameStats));
+    frameStats.gpuTimes = glCaps().timerQuery;
+}
+
+FrameLimiter::~FrameLimiter()
+{
+    for (int i = 0; i < maxFramesInFlight; ++i)
+    {
+        if (queue[i].fence)
+        {
+            glDeleteSync(queue[i].fence);
+        }
+        if (queue[i].startQuery)
+        {
+            glDeleteQueries(1, &queue[i].startQuery);
+            glDeleteQueries(1, &queue[i].endQuery);
+        }
+    }
+}
+
+void FrameLimiter::setFramesInFlight(int frames)
+{
+    this->frames = frames < 1 ? 1 : frames > maxFramesInFlight ? maxFramesInFlight : frames;
+}
+
+int FrameLimiter::framesInFlight()
+{
+    return frames;
+}
+
+bool FrameLimiter::supported()
+{
+    return glCaps().fenceSync;
+}
+
+void FrameLimiter::beginFrame()
+{
+    if (!supported())
+    {
+        return;
+    }
+    if (frameStats.gpuTimes && queue[0].startQuery == 0)
+    {
+        for (int i = 0; i < maxFramesInFlight; ++i)
+        {
+            glGenQueries(1, &queue[i].startQuery);
+            glGenQueries(1, &queue[i].endQuery);
+        }
+    }
+
+    float cpuWait = 0.0f;
+    while (queued >= frames)
+    {
+        cpuWait += retireOldest();
+    }
+    average(frameStats.cpuWaitMs, cpuWait);
+    traceCounter("cpu wait ms", cpuWait);
+
+    if (frameStats.gpuTimes)
+    {
+        glQueryCounter(queue[(first + queued) % maxFramesInFlight].startQuery, GL_TIMESTAMP);
+    }
+}
+
+void FrameLimiter::endRendering()
+{
+    if (!supported() || !frameStats.gpuTimes)
+    {
+        return;
+    }
+    glQueryCounter(queue[(first + queued) % maxFramesInFlight].endQuery, GL_TIMESTAMP);
+}
+
+void FrameLimiter::endFrame()
+{
+    if (!supported())
+    {
+        return;
+    }
+    // After the swap, so that whatever work the swap queues is covered as well
+    queuedFrame& frame = queue[(first + queued) % maxFramesInFlight];
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++queued;
+}
+
+const FrameLimiterStats& FrameLimiter::stats()
+{
+    return frameStats;
+}
+
+float FrameLimiter::retireOldest()
+{
+    queuedFrame& frame = queue[first];
+    first = (first + 1) % maxFramesInFlight;
+    --queued;
+
+    Uint64 waitStart = SDL_GetPerformanceCounter();
+    {
+        TRACE_SCOPE("wait for GPU");
+        GLenum result;
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        do
+        {
+            result = glClientWaitSync(frame.fence, flags, waitTimeoutNs);
+            flags = 0;
+        } while (result == GL_TIMEOUT_EXPIRED);
+        if (result == GL_WAIT_FAILED)
+        {
+            Log(LOG_WARN) << "Waiting for a frame fence failed";
+        }
+    }
+    float waited = (float)((double)(SDL_GetPerformanceCounter() - waitStart) * 1000.0 / SDL_GetPerformanceFrequency());
+    glDeleteSync(frame.fence);
+    frame.fence = NULL;
+
+    if (!frameStats.gpuTimes)
+    {
+        return waited;
+    }
+    // The fence covers both timestamps, so these shouldn't stall; still, don't count on it
+    GLuint available = 0;
+    glGetQueryObjectuiv(frame.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        lastEnd = 0;
+        return waited;
+    }
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(frame.startQuery, GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame.endQuery, GL_QUERY_RESULT, &end);
+#ifndef GL_PROFILE_GL3
+    // Power management or a context switch on the GPU makes timestamps incomparable
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint)
+    {
+        lastEnd = 0;
+        return waited;
+    }
+#endif
+    float gpuFrame = (float)((double)(end - start) / 1.0e6);
+    average(frameStats.gpuFrameMs, gpuFrame);
+    frameStats.lastGpuFrameMs = gpuFrame;
+    frameStats.gpuFramesTimed++;
+    if (lastEnd != 0 && start > lastEnd)
+    {
+        float gpuWait = (float)((double)(start - lastEnd) / 1.0e6);
+        average(frameStats.gpuWaitMs, gpuWait);
+        traceCounter("gpu wait ms", gpuWait);
+    }
+    else if (lastEnd != 0)
+    {
+        average(frameStats.gpuWaitMs, 0.0f);
+    }
+    lastEnd = end;
+    return waited;
+}
@@ -0,0 +1,95 @@
+//
+// Keeps the CPU from running more than a set number of frames ahead of the GPU. Every frame ends
+// with a fence; before the next one starts, the fence from N frames back is waited for, so at most
+// N frames are ever queued, instead of however many the driver feels like (usually 3).
+//
+
+#ifndef IMGUI_DEMO_FRAME_LIMITER_H
+#define IMGUI_DEMO_FRAME_LIMITER_H
+
+#include "gl_ext.h"
+
+/**
+ * Where the time between frames went, averaged over the last few frames unless noted otherwise
+ */
+struct FrameLimiterStats {
+    // CPU blocked on the fence, waiting for the GPU to catch up
+    float cpuWaitMs;
+    // Time between the end of one frame's rendering and the start of the next, including the swap
+    float gpuWaitMs;
+    // GPU time from the start of a frame to the end of its rendering, without the swap
+    float gpuFrameMs;
+    // The same for the last timed frame alone, and how many frames have been timed so far; a new
+    // count tells a new measurement from the old one read again
+    float lastGpuFrameMs;
+    unsigned gpuFramesTimed;
+    // The GPU numbers need timer queries; they stay at 0 without them
+    bool gpuTimes;
+};
+
+class FrameLimiter {
+public:
+    static const int maxFramesInFlight = 3;
+
+    FrameLimiter();
+    ~FrameLimiter();
+
+    /**
+     * @param frames 1 waits for each frame to finish before starting the next one (lowest latency),
+     *               3 is about what drivers allow by default (highest throughput)
+     */
+    void setFramesInFlight(int frames);
+    int framesInFlight();
+
+    /**
+     * @return false if the context has no fences; the limiter does nothing then
+     */
+    bool supported();
+
+    /**
+     * Call before the first GL command of a frame. Waits until fewer than framesInFlight() frames
+     * are still queued on the GPU.
+     */
+    void beginFrame();
+
+    /**
+     * Call after the frame's last draw, right before the buffer swap. Swap and vsync waits aren't
+     * work done for the frame, so they stay out of its GPU time.
+     */
+    void endRendering();
+
+    /**
+     * Call after the frame's buffer swap
+     */
+    void endFrame();
+
+    const FrameLimiterStats& stats();
+
+private:
+    FrameLimiter(const FrameLimiter&);
+    FrameLimiter& operator=(const FrameLimiter&);
+
+    // A submitted frame the GPU may still be working on
+    struct queuedFrame {
+        GLsync fence;
+        GLuint startQuery;
+        GLuint endQuery;
+    };
+
+    /**
+     * Wait for the oldest queued frame to finish, then take its GPU timestamps
+     * @return Time spent waiting, in milliseconds
+     */
+    float retireOldest();
+
+    int frames;
+    queuedFrame queue[maxFramesInFlight];
+    // Oldest entry and number of entries in queue; the one after the newest is being recorded
+    int first;
+    int queued;
+    // GPU timestamp at the end of the last retired frame, 0 if unknown
+    GLuint64 lastEnd;
+    FrameLimiterStats frameStats;
+};
+
+#endif //IMGUI_DEMO_FRAME_LIMITER_H
@@ -0,0 +1,534 @@
+//
+// Scene, UI and swap, inline or on a rendering thread of their own.
+//
+
+#include "frame_renderer.h"
+#include "logger.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+static bool sameColor(const ImVec4& a, const ImVec4& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+}
+
+template <typename T>
+static void copyVector(ImVector<T>& dst, const ImVector<T>& src)
+{
+    dst.resize(src.Size);
+    if (src.Size != 0)
+    {
+        memcpy(dst.Data, src.Data, src.Size * sizeof(T));
+    }
+}
+
+DrawDataCopy::DrawDataCopy()
+{
+}
+
+DrawDataCopy::~DrawDataCopy()
+{
+    for (size_t i = 0; i < lists.size(); ++i)
+    {
+        delete lists[i];
+    }
+}
+
+void DrawDataCopy::copyFrom(const ImDrawData* source)
+{
+    while ((int) lists.size() < source->CmdListsCount)
+    {
+        lists.push_back(new ImDrawList());
+    }
+    for (int n = 0; n < source->CmdListsCount; ++n)
+    {
+        // ImVector has no copy constructor worth using; resize() keeps the capacity from earlier frames
+        const ImDrawList* src = source->CmdLists[n];
+        ImDrawList* dst = lists[n];
+        copyVector(dst->CmdBuffer, src->CmdBuffer);
+        copyVector(dst->IdxBuffer, src->IdxBuffer);
+        copyVector(dst->VtxBuffer, src->VtxBuffer);
+    }
+    drawData.Valid = source->Valid;
+    drawData.CmdLists = lists.empty() ? NULL : &lists[0];
+    drawData.CmdListsCount = source->CmdListsCount;
+    drawData.TotalVtxCount = source->TotalVtxCount;
+    drawData.TotalIdxCount = source->TotalIdxCount;
+}
+
+ImDrawData* DrawDataCopy::data()
+{
+    return &drawData;
+}
+
+FrameRenderer::FrameRenderer(SDL_Window* window, SDL_GLContext context, Teapot& teapot, InputLatch& cameraInput,
+                             renderDrawData_t* renderUi)
+        : window(window), context(context), teapot(teapot), cameraInput(cameraInput), renderUi(renderUi),
+          mainThread(std::this_thread::get_id()), frustumCulling(true), occlusionCulling(false),
+          swapInterval(SDL_GL_GetSwapInterval()), swapIntervalInEffect(swapInterval), cacheValid(false),
+          cachedWidth(0), cachedHeight(0), cachedFrames(0),
+          // Measurements lag by up to the frames in flight; a few more let the GPU settle into the mode.
+          // The restarts allow for about ten seconds of compiling at 60 fps.
+          prepassBenchmark(FrameLimiter::maxFramesInFlight + 5, 600), timedFrames(0), nextFrame(0),
+          running(false), pending(NULL), rendering(NULL)
+{
+    teapot.setFrustumCulling(frustumCulling);
+    teapot.setOcclusionCulling(occlusionCulling);
+    memset(&cameraMotion, 0, sizeof(cameraMotion));
+    sceneCulling = teapot.cullingStats();
+    sceneStatus.culling = sceneCulling;
+    sceneStatus.zoom = teapot.zoomValue();
+    sceneStatus.instanceCount = teapot.instanceCount();
+    sceneStatus.occlusionCullingSupported = teapot.occlusionCullingSupported();
+    sceneStatus.lodLevels = teapot.lodCount();
+    sceneStatus.roughReflectionsSupported = teapot.roughReflectionsSupported();
+    sceneStatus.reflectionFacesUpdated = 0;
+    sceneStatus.frameLimiterSupported = limiter.supported();
+    sceneStatus.frameTiming = limiter.stats();
+    sceneStatus.swapIntervalRequested = swapInterval;
+    sceneStatus.swapInterval = swapInterval;
+    sceneStatus.resolutionScale = 1.0f;
+    sceneStatus.sceneWidth = 0;
+    sceneStatus.sceneHeight = 0;
+    sceneStatus.cachedFrames = 0;
+    sceneStatus.prepassBenchmarkRunning = false;
+    sceneStatus.prepassBenchmarkProgress = 0;
+    sceneStatus.prepassBenchmarkTotal = 0;
+    sceneStatus.prepassBenchmark = prepassBenchmark.result();
+    memset(sceneStatus.viewports, 0, sizeof(sceneStatus.viewports));
+    upscaler.init();
+}
+
+FrameRenderer::~FrameRenderer()
+{
+    setThreaded(false);
+}
+
+void FrameRenderer::setThreaded(bool enabled)
+{
+    if (enabled == running)
+    {
+        return;
+    }
+    if (enabled)
+    {
+        // A context can only be current on one thread at a time
+        SDL_GL_MakeCurrent(window, NULL);
+        running = true;
+        thread = std::thread(&FrameRenderer::run, this);
+        Log(LOG_INFO) << "Rendering on a separate thread";
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        // Whatever was submitted is still drawn before the thread gives the context back
+        thread.join();
+        SDL_GL_MakeCurrent(window, context);
+        Log(LOG_INFO) << "Rendering on the main thread";
+    }
+}
+
+bool FrameRenderer::threaded()
+{
+    return running;
+}
+
+FrameSubmission& FrameRenderer::beginFrame()
+{
+    FrameSubmission* frame = &frames[nextFrame];
+    std::unique_lock<std::mutex> lock(mutex);
+    if (pending == frame || rendering == frame)
+    {
+        TRACE_SCOPE("wait for renderer");
+        wake.wait(lock, [this, frame] { return pending != frame && rendering != frame; });
+    }
+    return *frame;
+}
+
+void FrameRenderer::submitFrame()
+{
+    FrameSubmission& frame = frames[nextFrame];
+    nextFrame ^= 1;
+    if (!running)
+    {
+        render(frame);
+        return;
+    }
+
+    {
+        // ImGui reuses its draw lists for the next frame, so the renderer gets a copy of its own
+        TRACE_SCOPE("copy draw data");
+        frame.uiCopy.copyFrom(frame.drawData);
+        frame.drawData = frame.uiCopy.data();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = &frame;
+    }
+    wake.notify_all();
+}
+
+SceneStatus FrameRenderer::status()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sceneStatus;
+}
+
+void FrameRenderer::run()
+{
+    traceThreadName("render");
+    SDL_GL_MakeCurrent(window, context);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait(lock, [this] { return pending != NULL || !running; });
+        if (pending == NULL)
+        {
+            break;
+        }
+        rendering = pending;
+        pending = NULL;
+        lock.unlock();
+        // The other buffer is free now, so the main thread can already start on the frame after this one
+        wake.notify_all();
+        render(*rendering);
+        lock.lock();
+        rendering = NULL;
+        wake.notify_all();
+    }
+    lock.unlock();
+    SDL_GL_MakeCurrent(window, NULL);
+}
+
+void FrameRenderer::render(FrameSubmission& frame)
+{
+    if (frame.swapInterval != swapInterval)
+    {
+        applySwapInterval(frame.swapInterval);
+    }
+    limiter.setFramesInFlight(frame.framesInFlight);
+    limiter.beginFrame();
+    const FrameLimiterStats& timing = limiter.stats();
+    if (frame.prepassBenchmarkFrames > 0)
+    {
+        prepassBenchmark.start(frame.prepassBenchmarkFrames);
+    }
+    else if (frame.cancelPrepassBenchmark)
+    {
+        abortPrepassBenchmark("cancelled");
+    }
+    else if (prepassBenchmark.running() && !frame.sceneBehindUi)
+    {
+        // Nothing left to measure; the scene isn't drawn at all
+        abortPrepassBenchmark("the scene was hidden");
+    }
+    else if (prepassBenchmark.running() && timing.gpuFramesTimed != timedFrames)
+    {
+        prepassBenchmark.addFrame(timing.lastGpuFrameMs);
+        if (!prepassBenchmark.running())
+        {
+            const ToggleBenchmarkResult& result = prepassBenchmark.result();
+            Log(LOG_INFO) << "Depth pre-pass benchmark, " << result.frames << " frames each: off "
+                          << result.offMs << " ms, on " << result.onMs << " ms, difference "
+                          << result.onMs - result.offMs << " ms";
+        }
+    }
+    timedFrames = timing.gpuFramesTimed;
+
+    traceBegin("scene");
+    updateScene(frame);
+    // Render to texture passes go first, so tiled GPUs don't have to store and reload the window halfway
+    const int reflectionFaces = teapot.updateEnvironment();
+    traceCounter("environment faces drawn", reflectionFaces);
+    updateViewports(frame);
+
+    const int width = frame.viewportWidth;
+    const int height = frame.viewportHeight;
+    float scale = frame.resolutionScale;
+    if (frame.dynamicResolution && prepassBenchmark.running())
+    {
+        // Both modes have to be measured at the same resolution
+        scale = resolution.scale();
+    }
+    else if (frame.dynamicResolution)
+    {
+        resolution.setMinScale(frame.minResolutionScale);
+        scale = resolution.update(limiter.stats().gpuFrameMs, frame.gpuBudgetMs);
+    }
+    else
+    {
+        resolution.reset();
+    }
+    // At full resolution the copy into the window has to be exact, so no sharpening there
+    Upscaler::Filter filter = scale < 1.0f ? (Upscaler::Filter) frame.upscaleFilter : Upscaler::FILTER_BILINEAR;
+    // Full resolution without caching goes straight to the window; so does everything until the
+    // upscale program is ready
+    bool offscreen = frame.sceneBehindUi && (scale < 1.0f || frame.cacheScene) && width > 0 && height > 0 && upscaler.ready(filter);
+    bool reallocated = false;
+    if (offscreen)
+    {
+        // Allocated at full size, so that a change of scale is only a change of viewport
+        reallocated = sceneTarget.resize(width, height);
+        offscreen = sceneTarget.valid();
+    }
+    else if (!frame.dynamicResolution && !frame.cacheScene && sceneTarget.valid())
+    {
+        sceneTarget.release();
+    }
+    int sceneWidth = width;
+    int sceneHeight = height;
+    if (offscreen)
+    {
+        sceneWidth = std::max(1, (int) (width * scale + 0.5f));
+        sceneHeight = std::max(1, (int) (height * scale + 0.5f));
+    }
+    else
+    {
+        scale = 1.0f;
+    }
+
+    // Whatever is in the target can be shown again as long as nothing that goes into it has changed
+    bool redraw = !offscreen || !frame.cacheScene || !cacheValid || reallocated || teapot.needsRedraw() ||
+                  prepassBenchmark.running() ||
+                  sceneWidth != cachedWidth || sceneHeight != cachedHeight ||
+                  !sameColor(frame.clearColor, cachedClearColor) || frame.uiOccluders != cachedOccluders;
+    if (redraw)
+    {
+        if (offscreen)
+        {
+            sceneTarget.bind();
+        }
+        drawScene(frame, sceneWidth, sceneHeight, scale);
+        if (prepassBenchmark.running() && frame.sceneBehindUi)
+        {
+            switch (teapot.depthPrepassState())
+            {
+                case Teapot::PREPASS_NOTHING_DRAWN:
+                    // The camera is held still during the run, so that's not going to change
+                    abortPrepassBenchmark("no teapot in view");
+                    break;
+                case Teapot::PREPASS_FAILED:
+                    abortPrepassBenchmark("the depth-only program failed to build");
+                    break;
+                case Teapot::PREPASS_COMPILING:
+                    // Drawn without the pre-pass; that's not what's being measured
+                    if (!prepassBenchmark.restartMode())
+                    {
+                        abortPrepassBenchmark("the depth-only program took too long to compile");
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        cacheValid = offscreen;
+        cachedWidth = sceneWidth;
+        cachedHeight = sceneHeight;
+        cachedClearColor = frame.clearColor;
+        cachedOccluders = frame.uiOccluders;
+    }
+    else
+    {
+        ++cachedFrames;
+    }
+    traceCounter("scene redrawn", redraw ? 1 : 0);
+    traceEnd("scene");
+
+    if (offscreen)
+    {
+        RenderTarget::bindDefault();
+        glViewport(0, 0, width, height);
+        // Everything gets overwritten, but a clear tells tiled GPUs not to load the old contents
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        upscaler.draw(sceneTarget, sceneWidth, sceneHeight, filter, frame.sharpness);
+    }
+
+    // The UI is always drawn at the window's resolution, so text stays sharp
+    resolveViewportTextures(frame.drawData);
+    renderUi(frame.drawData, frame.displaySize, frame.framebufferScale);
+    limiter.endRendering();
+    {
+        TRACE_SCOPE("swap");
+        SDL_GL_SwapWindow(window);
+    }
+    limiter.endFrame();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sceneStatus.culling = sceneCulling;
+    sceneStatus.zoom = teapot.zoomValue();
+    sceneStatus.instanceCount = teapot.instanceCount();
+    sceneStatus.occlusionCullingSupported = teapot.occlusionCullingSupported();
+    sceneStatus.lodLevels = teapot.lodCount();
+    sceneStatus.roughReflectionsSupported = teapot.roughReflectionsSupported();
+    sceneStatus.reflectionFacesUpdated = reflectionFaces;
+    sceneStatus.frameTiming = limiter.stats();
+    // Reported together, so the UI can tell a fallback from a request that hasn't been applied yet
+    sceneStatus.swapIntervalRequested = swapInterval;
+    sceneStatus.swapInterval = swapIntervalInEffect;
+    sceneStatus.resolutionScale = scale;
+    sceneStatus.sceneWidth = sceneWidth;
+    sceneStatus.sceneHeight = sceneHeight;
+    sceneStatus.cachedFrames = cachedFrames;
+    sceneStatus.prepassBenchmarkRunning = prepassBenchmark.running();
+    sceneStatus.prepassBenchmarkProgress = prepassBenchmark.progress();
+    sceneStatus.prepassBenchmarkTotal = prepassBenchmark.total();
+    sceneStatus.prepassBenchmark = prepassBenchmark.result();
+    for (int i = 0; i < maxViewports; ++i)
+    {
+        if (viewports[i])
+        {
+            sceneStatus.viewports[i] = viewports[i]->status();
+        }
+        else
+        {
+            memset(&sceneStatus.viewports[i], 0, sizeof(sceneStatus.viewports[i]));
+        }
+    }
+}
+
+void FrameRenderer::updateScene(const FrameSubmission& frame)
+{
+    if (frame.frustumCulling != frustumCulling)
+    {
+        frustumCulling = frame.frustumCulling;
+        teapot.setFrustumCulling(frustumCulling);
+    }
+    if (frame.occlusionCulling != occlusionCulling)
+    {
+        occlusionCulling = frame.occlusionCulling;
+        teapot.setOcclusionCulling(occlusionCulling);
+    }
+    teapot.setLodSelection(frame.meshLod, frame.lodErrorPixels);
+    teapot.setDepthPrepass(prepassBenchmark.running() ? prepassBenchmark.enabled() : frame.depthPrepass);
+    if (frame.shaderFeatures != teapot.shaderFeatures())
+    {
+        teapot.setShaderFeatures(frame.shaderFeatures);
+    }
+    teapot.setRoughness(frame.roughness);
+    if (frame.instancesChanged)
+    {
+        teapot.setInstances(frame.instances);
+    }
+    teapot.setDynamicEnvironment(frame.dynamicReflections, frame.reflectionFacesPerFrame);
+    teapot.setFog(glm::vec3(frame.clearColor.x, frame.clearColor.y, frame.clearColor.z), 0.005f);
+    teapot.rotateTo(frame.teapotRotation);
+    if (frame.rotateSync)
+        teapot.rotateCameraTo(frame.teapotRotation);
+
+    cameraInput.latch(cameraMotion, std::this_thread::get_id() == mainThread);
+    traceCounter("input latency ms", cameraMotion.latency);
+    // Nothing to move while the main scene is hidden; it would only pile up until it's shown again.
+    // The pre-pass benchmark needs the same view in both modes.
+    if (frame.cameraInput && frame.sceneBehindUi && !prepassBenchmark.running())
+    {
+        if (std::abs(cameraMotion.zoom) > 0.001f)
+            teapot.zoomBy(cameraMotion.zoom);
+        if ((cameraMotion.dragX != 0.0f) || (cameraMotion.dragY != 0.0f))
+            teapot.rotateCameraBy(cameraMotion.dragX * 0.005f, cameraMotion.dragY * 0.005f);
+    }
+}
+
+void FrameRenderer::drawScene(const FrameSubmission& frame, int width, int height, float scale)
+{
+    glViewport(0, 0, width, height);
+    glClearColor(frame.clearColor.x, frame.clearColor.y, frame.clearColor.z, frame.clearColor.w);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!frame.sceneBehindUi)
+    {
+        return;
+    }
+    if (!frame.uiOccluders.empty())
+    {
+        writeUiOccluders(frame.uiOccluders, scale);
+    }
+    teapot.draw();
+    sceneCulling = teapot.cullingStats();
+    traceCounter("teapots drawn", sceneCulling.drawn);
+}
+
+void FrameRenderer::updateViewports(const FrameSubmission& frame)
+{
+    bool requested[maxViewports] = {};
+    if (!frame.viewports.empty())
+    {
+        TRACE_SCOPE("viewports");
+        const double now = (double) SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+        int redrawn = 0;
+        for (const ViewportRequest& request: frame.viewports)
+        {
+            // A collapsed window leaves no room for the image
+            if (request.id < 0 || request.id >= maxViewports || request.width <= 0 || request.height <= 0)
+            {
+                continue;
+            }
+            requested[request.id] = true;
+            std::unique_ptr<SceneViewport>& viewport = viewports[request.id];
+            if (!viewport)
+            {
+                viewport.reset(new SceneViewport());
+            }
+            if (viewport->update(teapot, request, frame.clearColor, now))
+            {
+                ++redrawn;
+            }
+        }
+        traceCounter("viewports redrawn", redrawn);
+    }
+    for (int i = 0; i < maxViewports; ++i)
+    {
+        if (!requested[i])
+        {
+            viewports[i].reset();
+        }
+    }
+}
+
+void FrameRenderer::resolveViewportTextures(ImDrawData* drawData)
+{
+    for (int n = 0; n < drawData->CmdListsCount; ++n)
+    {
+        ImVector<ImDrawCmd>& commands = drawData->CmdLists[n]->CmdBuffer;
+        for (int i = 0; i < commands.Size; ++i)
+        {
+            const int id = viewportFromTextureId(commands.Data[i].TextureId);
+            if (id >= 0)
+            {
+                // Texture 0 samples as black, which will do for a view that couldn't be drawn
+                GLuint texture = viewports[id] ? viewports[id]->texture() : 0;
+                commands.Data[i].TextureId = (ImTextureID) (intptr_t) texture;
+            }
+        }
+    }
+}
+
+void FrameRenderer::abortPrepassBenchmark(const char* reason)
+{
+    if (prepassBenchmark.running())
+    {
+        Log(LOG_WARN) << "Depth pre-pass benchmark stopped: " << reason;
+        prepassBenchmark.abort(reason);
+    }
+}
+
+void FrameRenderer::applySwapInterval(int interval)
+{
+    // Applies to the current context, so this has to happen on whichever thread renders
+    if (SDL_GL_SetSwapInterval(interval) != 0)
+    {
+        Log(LOG_WARN) << "Could not set swap interval " << interval << ": " << SDL_GetError();
+        if (interval == -1)
+        {
+            SDL_GL_SetSwapInterval(1);
+        }
+    }
+    swapInterval = interval;
+    swapIntervalInEffect = SDL_GL_GetSwapInterval();
+}
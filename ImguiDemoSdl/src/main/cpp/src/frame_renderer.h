@@ -0,0 +1,239 @@
+//
+// Everything that happens on the GL side of a frame: scene, UI and swap. Runs either inline on the
+// main thread or on a thread of its own that owns the context, in which case the main thread
+// only hands over a copy of the frame and can go on with the next one right away.
+//
+
+#ifndef IMGUI_DEMO_FRAME_RENDERER_H
+#define IMGUI_DEMO_FRAME_RENDERER_H
+
+#include <SDL.h>
+#include "imgui.h"
+#include "teapot.h"
+#include "ui_occluders.h"
+#include "input.h"
+#include "frame_limiter.h"
+#include "dynamic_resolution.h"
+#include "render_target.h"
+#include "scene_viewport.h"
+#include "toggle_benchmark.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Deep copy of ImDrawData; ImDrawList buffers are reused from frame to frame
+ */
+class DrawDataCopy {
+public:
+    DrawDataCopy();
+    ~DrawDataCopy();
+
+    void copyFrom(const ImDrawData* source);
+    ImDrawData* data();
+
+private:
+    DrawDataCopy(const DrawDataCopy&);
+    DrawDataCopy& operator=(const DrawDataCopy&);
+
+    std::vector<ImDrawList*> lists;
+    ImDrawData drawData;
+};
+
+/**
+ * Everything a frame needs from the main thread. Filled in by the main thread, read by the renderer.
+ */
+struct FrameSubmission {
+    ImVec4 clearColor;
+    // Framebuffer pixels
+    int viewportWidth;
+    int viewportHeight;
+
+    // Scene resolution: picked from GPU frame times when dynamicResolution is set, fixed otherwise
+    bool dynamicResolution;
+    float resolutionScale;
+    float minResolutionScale;
+    float gpuBudgetMs;
+    // Upscaler::Filter
+    int upscaleFilter;
+    float sharpness;
+    // Keep the scene in a render target and only redraw it when something in it changed
+    bool cacheScene;
+    // Draw the scene over the whole window, behind the UI; without it, only viewports show the scene
+    bool sceneBehindUi;
+    // Views shown in the UI with viewportTextureId(); drawn before the scene
+    std::vector<ViewportRequest> viewports;
+
+    float teapotRotation;
+    bool rotateSync;
+    // Camera input is latched by the renderer; this only says whether it goes to the camera
+    bool cameraInput;
+    bool frustumCulling;
+    bool occlusionCulling;
+    // See Teapot::setLodSelection()
+    bool meshLod;
+    float lodErrorPixels;
+    // See Teapot::setDepthPrepass()
+    bool depthPrepass;
+    // Start measuring GPU frame times with the pre-pass off and on, this many frames each; 0 leaves
+    // a run in progress alone. Meanwhile the scene is redrawn every frame and the camera holds still.
+    int prepassBenchmarkFrames;
+    // Stop a run in progress without a result
+    bool cancelPrepassBenchmark;
+    unsigned shaderFeatures;
+    // For Teapot::SHADER_ROUGH, 0 to 1
+    float roughness;
+    // Reflect a cubemap rendered from the scene, redrawing this many of its faces per frame at most
+    bool dynamicReflections;
+    int reflectionFacesPerFrame;
+    // See FrameLimiter::setFramesInFlight()
+    int framesInFlight;
+    // 0 immediate, 1 vsync, -1 adaptive vsync (late frames are swapped right away)
+    int swapInterval;
+    // Instances are only replaced when this is set
+    bool instancesChanged;
+    std::vector<glm::mat4> instances;
+
+    std::vector<UiOccluderRect> uiOccluders;
+
+    // UI as built by ImGui::Render(); points at uiCopy when rendering on a thread of its own
+    ImDrawData* drawData;
+    ImVec2 displaySize;
+    ImVec2 framebufferScale;
+    DrawDataCopy uiCopy;
+};
+
+/**
+ * What the renderer has to say back to the UI; as of the last rendered frame
+ */
+struct SceneStatus {
+    Teapot::CullingStats culling;
+    float zoom;
+    int instanceCount;
+    bool occlusionCullingSupported;
+    // Levels of detail in the teapot mesh, including the full one
+    int lodLevels;
+    bool roughReflectionsSupported;
+    // Environment cubemap faces redrawn in the last frame
+    int reflectionFacesUpdated;
+    bool frameLimiterSupported;
+    FrameLimiterStats frameTiming;
+    // Interval last asked for, and what the context ended up with; adaptive vsync falls back to
+    // plain vsync where it's not supported
+    int swapIntervalRequested;
+    int swapInterval;
+    // What the scene was last drawn at
+    float resolutionScale;
+    int sceneWidth;
+    int sceneHeight;
+    // Frames that reused the cached scene instead of drawing it
+    unsigned cachedFrames;
+    // Depth pre-pass comparison: frames measured of the run in progress, and the last finished result
+    bool prepassBenchmarkRunning;
+    int prepassBenchmarkProgress;
+    int prepassBenchmarkTotal;
+    ToggleBenchmarkResult prepassBenchmark;
+    ViewportStatus viewports[maxViewports];
+};
+
+class FrameRenderer {
+public:
+    typedef void (renderDrawData_t)(ImDrawData*, const ImVec2&, const ImVec2&);
+
+    /**
+     * @param teapot Initialized teapot; from here on, only the renderer may touch it
+     * @param renderUi Backend function drawing the UI
+     */
+    FrameRenderer(SDL_Window* window, SDL_GLContext context, Teapot& teapot, InputLatch& cameraInput,
+                  renderDrawData_t* renderUi);
+    ~FrameRenderer();
+
+    /**
+     * Move rendering to a thread of its own, or back to the calling (main) thread. Waits for the
+     * frame in flight; the context is current on the rendering thread only.
+     */
+    void setThreaded(bool enabled);
+    bool threaded();
+
+    /**
+     * @return Submission to fill for the next frame. May wait for the renderer to finish with it.
+     */
+    FrameSubmission& beginFrame();
+
+    /**
+     * Render the submission returned by beginFrame(). With threaded rendering this returns as soon
+     * as the renderer has picked it up; the UI draw data is copied first.
+     */
+    void submitFrame();
+
+    SceneStatus status();
+
+private:
+    FrameRenderer(const FrameRenderer&);
+    FrameRenderer& operator=(const FrameRenderer&);
+
+    void run();
+    void render(FrameSubmission& frame);
+    // Settings and camera input
+    void updateScene(const FrameSubmission& frame);
+    void drawScene(const FrameSubmission& frame, int width, int height, float scale);
+    void updateViewports(const FrameSubmission& frame);
+    // Swap the stand-in ids from viewportTextureId() for the viewports' textures
+    void resolveViewportTextures(ImDrawData* drawData);
+    void applySwapInterval(int interval);
+    void abortPrepassBenchmark(const char* reason);
+
+    SDL_Window* window;
+    SDL_GLContext context;
+    Teapot& teapot;
+    InputLatch& cameraInput;
+    renderDrawData_t* renderUi;
+    // Events can only be pumped here
+    std::thread::id mainThread;
+    CameraMotion cameraMotion;
+    FrameLimiter limiter;
+    ResolutionController resolution;
+    Upscaler upscaler;
+    // Scene drawn below full resolution or kept for later frames, before it's copied into the window
+    RenderTarget sceneTarget;
+    // Indexed by id, created when a view is first asked for
+    std::unique_ptr<SceneViewport> viewports[maxViewports];
+    // Viewports draw with the same teapot, so its stats are kept from right after the scene was drawn
+    Teapot::CullingStats sceneCulling;
+
+    // Settings last applied to the teapot and context; some setters are not free, so they're only called on changes
+    bool frustumCulling;
+    bool occlusionCulling;
+    int swapInterval;
+    // What the context reported after swapInterval was set
+    int swapIntervalInEffect;
+
+    // What the scene in sceneTarget was drawn with
+    bool cacheValid;
+    int cachedWidth;
+    int cachedHeight;
+    ImVec4 cachedClearColor;
+    std::vector<UiOccluderRect> cachedOccluders;
+    unsigned cachedFrames;
+
+    ToggleBenchmark prepassBenchmark;
+    // FrameLimiterStats::gpuFramesTimed as of the last frame, to spot new measurements
+    unsigned timedFrames;
+
+    // Double buffered: the main thread fills one while the renderer draws the other
+    FrameSubmission frames[2];
+    int nextFrame;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+    FrameSubmission* pending;
+    FrameSubmission* rendering;
+    SceneStatus sceneStatus;
+};
+
+#endif //IMGUI_DEMO_FRAME_RENDERER_H
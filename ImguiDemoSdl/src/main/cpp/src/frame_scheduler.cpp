@@ -0,0 +1,126 @@
+//
+// Frame pacing on the performance counter.
+//
+
+#include "frame_scheduler.h"
+#include "trace.h"
+
+#include <cstring>
+
+FrameScheduler::FrameScheduler() : frequency(SDL_GetPerformanceFrequency()), period(0), fps(0.0f), nextFrame(0),
+                                   lastFrame(0), sleepSlack(0), historyPos(0), historyCount(0)
+{
+    // Until the first sleep says otherwise, assume the OS wakes us up within a millisecond
+    sleepSlack = frequency / 1000;
+    memset(frameTimes, 0, sizeof(frameTimes));
+    memset(&frameStats, 0, sizeof(frameStats));
+}
+
+void FrameScheduler::setTargetFps(float fps)
+{
+    if (fps == this->fps)
+    {
+        return;
+    }
+    this->fps = fps;
+    period = fps > 0.0f ? (Uint64)((double)frequency / fps) : 0;
+    nextFrame = 0;
+}
+
+float FrameScheduler::targetFps()
+{
+    return fps;
+}
+
+void FrameScheduler::waitForFrame()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (period != 0)
+    {
+        if (nextFrame == 0 || now > nextFrame + period)
+        {
+            // First frame, or more than a whole frame late: start over from here rather than
+            // rushing a few frames out to catch up with the old schedule
+            nextFrame = now;
+        }
+        TRACE_SCOPE("frame pacing");
+        const Uint64 ms = frequency / 1000;
+        // Sleep through most of the wait...
+        if (nextFrame > now && nextFrame - now > sleepSlack + ms)
+        {
+            Uint32 sleepMs = (Uint32)((nextFrame - now - sleepSlack) / ms);
+            Uint64 before = now;
+            SDL_Delay(sleepMs);
+            now = SDL_GetPerformanceCounter();
+            Uint64 slept = now - before;
+            Uint64 overshoot = slept > sleepMs * ms ? slept - sleepMs * ms : 0;
+            // Grows right away, shrinks slowly; a late wakeup costs a frame, a long spin only CPU time
+            sleepSlack = overshoot > sleepSlack ? overshoot : sleepSlack - (sleepSlack - overshoot) / 16;
+        }
+        // ...and spin through the rest, which the sleep can't hit precisely
+        while (now < nextFrame)
+        {
+            now = SDL_GetPerformanceCounter();
+        }
+        nextFrame += period;
+    }
+    if (lastFrame != 0)
+    {
+        record((float)((double)(now - lastFrame) * 1000.0 / frequency));
+    }
+    lastFrame = now;
+}
+
+const FrameTimeStats& FrameScheduler::stats()
+{
+    return frameStats;
+}
+
+const float* FrameScheduler::history()
+{
+    return frameTimes;
+}
+
+int FrameScheduler::historyLength()
+{
+    return historyCount;
+}
+
+int FrameScheduler::historyOffset()
+{
+    return historyCount < historySize ? 0 : historyPos;
+}
+
+void FrameScheduler::record(float frameMs)
+{
+    frameTimes[historyPos] = frameMs;
+    historyPos = (historyPos + 1) % historySize;
+    if (historyCount < historySize)
+    {
+        ++historyCount;
+    }
+
+    // Only historySize additions; simpler to redo than to keep a running sum from drifting
+    double sum = 0.0;
+    float minMs = frameMs, maxMs = frameMs;
+    for (int i = 0; i < historyCount; ++i)
+    {
+        sum += frameTimes[i];
+        minMs = frameTimes[i] < minMs ? frameTimes[i] : minMs;
+        maxMs = frameTimes[i] > maxMs ? frameTimes[i] : maxMs;
+    }
+    double mean = sum / historyCount;
+    double squares = 0.0;
+    for (int i = 0; i < historyCount; ++i)
+    {
+        double d = frameTimes[i] - mean;
+        squares += d * d;
+    }
+    frameStats.meanMs = (float)mean;
+    frameStats.varianceMs2 = (float)(squares / historyCount);
+    frameStats.minMs = minMs;
+    frameStats.maxMs = maxMs;
+
+    traceCounter("frame time ms", frameMs);
+    traceCounter("frame time variance", frameStats.varianceMs2);
+}
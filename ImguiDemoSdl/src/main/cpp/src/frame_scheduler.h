@@ -0,0 +1,71 @@
+//
+// Frame pacing on the performance counter. With a target frame rate, each frame starts on a fixed
+// grid of points in time: the scheduler sleeps for most of the gap and spins through the rest,
+// so that input for the frame is sampled as late as possible and frames come out evenly spaced
+// instead of at whatever granularity the OS sleep happens to have.
+//
+
+#ifndef IMGUI_DEMO_FRAME_SCHEDULER_H
+#define IMGUI_DEMO_FRAME_SCHEDULER_H
+
+#include <SDL.h>
+
+/**
+ * Time between the starts of consecutive frames, over the last historySize frames
+ */
+struct FrameTimeStats {
+    float meanMs;
+    // In ms squared; its square root is the typical deviation from one frame to the next
+    float varianceMs2;
+    float minMs;
+    float maxMs;
+};
+
+class FrameScheduler {
+public:
+    static const int historySize = 120;
+
+    FrameScheduler();
+
+    /**
+     * @param fps Frames per second to pace to; 0 leaves pacing to the swap interval
+     */
+    void setTargetFps(float fps);
+    float targetFps();
+
+    /**
+     * Wait until it's time to start the next frame, then record the frame time. Call at the top of
+     * the frame, right before the input is read.
+     */
+    void waitForFrame();
+
+    const FrameTimeStats& stats();
+
+    /**
+     * @return Frame times in milliseconds, historyLength() of them, oldest at historyOffset();
+     *         laid out for ImGui::PlotLines()
+     */
+    const float* history();
+    int historyLength();
+    int historyOffset();
+
+private:
+    void record(float frameMs);
+
+    Uint64 frequency;
+    // Frame period in counter ticks, 0 if not pacing
+    Uint64 period;
+    float fps;
+    // Counter value the next frame should start at
+    Uint64 nextFrame;
+    Uint64 lastFrame;
+    // How much longer SDL_Delay() tends to take than asked for, in counter ticks; the spin has to cover it
+    Uint64 sleepSlack;
+
+    float frameTimes[historySize];
+    int historyPos;
+    int historyCount;
+    FrameTimeStats frameStats;
+};
+
+#endif //IMGUI_DEMO_FRAME_SCHEDULER_H
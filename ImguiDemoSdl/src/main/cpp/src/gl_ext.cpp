@@ -0,0 +1,221 @@
+//
+// Optional GL entry points and runtime capability checks.
+//
+
+#include "gl_ext.h"
+
+#include <SDL.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "logger.h"
+
+#ifndef GL_PROFILE_GL3
+PFNGLDRAWELEMENTSINSTANCEDPROC _ext_glDrawElementsInstanced = NULL;
+PFNGLVERTEXATTRIBDIVISORPROC _ext_glVertexAttribDivisor = NULL;
+PFNGLGETUNIFORMBLOCKINDEXPROC _ext_glGetUniformBlockIndex = NULL;
+PFNGLUNIFORMBLOCKBINDINGPROC _ext_glUniformBlockBinding = NULL;
+PFNGLBINDBUFFERBASEPROC _ext_glBindBufferBase = NULL;
+PFNGLFENCESYNCPROC _ext_glFenceSync = NULL;
+PFNGLCLIENTWAITSYNCPROC _ext_glClientWaitSync = NULL;
+PFNGLDELETESYNCPROC _ext_glDeleteSync = NULL;
+PFNGLGENQUERIESPROC _ext_glGenQueries = NULL;
+PFNGLDELETEQUERIESPROC _ext_glDeleteQueries = NULL;
+PFNGLGETQUERYOBJECTUIVPROC _ext_glGetQueryObjectuiv = NULL;
+PFN_glQueryCounter _ext_glQueryCounter = NULL;
+PFN_glGetQueryObjectui64v _ext_glGetQueryObjectui64v = NULL;
+#endif
+
+PFNGLGETPROGRAMBINARYPROC _ext_glGetProgramBinary = NULL;
+PFNGLPROGRAMBINARYPROC _ext_glProgramBinary = NULL;
+PFNGLPROGRAMPARAMETERIPROC _ext_glProgramParameteri = NULL;
+PFN_glMaxShaderCompilerThreads _ext_glMaxShaderCompilerThreads = NULL;
+
+template<typename T>
+static bool loadProc(T& proc, const char* name)
+{
+    proc = reinterpret_cast<T>(SDL_GL_GetProcAddress(name));
+    if (proc == NULL)
+    {
+        Log(LOG_WARN) << "Could not load " << name;
+    }
+    return proc != NULL;
+}
+
+static GlCaps g_caps;
+
+bool glHasExtension(const char* name)
+{
+#ifdef GL_PROFILE_GL3
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, (GLuint)i));
+        if (extension && strcmp(extension, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+#else
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    const size_t length = strlen(name);
+    for (const char* found = extensions ? strstr(extensions, name) : NULL; found; found = strstr(found + length, name))
+    {
+        // Must be a whole entry of the space separated list, not a prefix of a longer name
+        bool starts = (found == extensions) || (found[-1] == ' ');
+        bool ends = (found[length] == ' ') || (found[length] == '\0');
+        if (starts && ends)
+        {
+            return true;
+        }
+    }
+    return false;
+#endif
+}
+
+/**
+ * Load the program binary entry points
+ * @param suffix Extension suffix of the function names, empty for core ones
+ * @param hasParameteri Whether glProgramParameteri should be there as well
+ * @return true if program binaries can be used
+ */
+static bool loadProgramBinary(const char* suffix, bool hasParameteri)
+{
+    std::string getName = std::string("glGetProgramBinary") + suffix;
+    std::string binaryName = std::string("glProgramBinary") + suffix;
+    bool loaded = true;
+    loaded &= loadProc(_ext_glGetProgramBinary, getName.c_str());
+    loaded &= loadProc(_ext_glProgramBinary, binaryName.c_str());
+    if (hasParameteri)
+    {
+        loadProc(_ext_glProgramParameteri, "glProgramParameteri");
+    }
+    if (!loaded)
+    {
+        return false;
+    }
+    // Drivers may support the API but no formats at all, which makes it useless
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+bool glExtInit()
+{
+    memset(&g_caps, 0, sizeof(g_caps));
+
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    if (version == NULL)
+    {
+        Log(LOG_ERROR) << "Could not get GL version; is there a current context?";
+        return false;
+    }
+    Log(LOG_INFO) << "GL_VERSION: " << version;
+
+    // ES contexts report "OpenGL ES M.m <vendor-specific>", desktop ones start with "M.m"
+    const char* esPrefix = "OpenGL ES ";
+    const char* versionNumber = version;
+    if (strncmp(version, esPrefix, strlen(esPrefix)) == 0)
+    {
+        g_caps.es = true;
+        versionNumber += strlen(esPrefix);
+    }
+    if (sscanf(versionNumber, "%d.%d", &g_caps.major, &g_caps.minor) != 2)
+    {
+        Log(LOG_ERROR) << "Could not parse GL version string";
+        return false;
+    }
+
+#ifdef GL_PROFILE_GL3
+    g_caps.instancing = true;
+    g_caps.uniformBuffers = true;
+    g_caps.packedVertices = true;
+    g_caps.glsl3 = true;
+    g_caps.conditionalRender = true;
+    g_caps.fenceSync = true;
+    g_caps.timerQuery = true;
+    g_caps.textureLod = true;
+    if ((g_caps.major > 4 || (g_caps.major == 4 && g_caps.minor >= 1)) || glHasExtension("GL_ARB_get_program_binary"))
+    {
+        // The ARB extension uses the core names
+        g_caps.programBinary = loadProgramBinary("", true);
+    }
+#else
+    if (g_caps.major >= 3)
+    {
+        bool loaded = true;
+        loaded &= loadProc(_ext_glDrawElementsInstanced, "glDrawElementsInstanced");
+        loaded &= loadProc(_ext_glVertexAttribDivisor, "glVertexAttribDivisor");
+        g_caps.instancing = loaded;
+
+        loaded = true;
+        loaded &= loadProc(_ext_glGetUniformBlockIndex, "glGetUniformBlockIndex");
+        loaded &= loadProc(_ext_glUniformBlockBinding, "glUniformBlockBinding");
+        loaded &= loadProc(_ext_glBindBufferBase, "glBindBufferBase");
+        g_caps.uniformBuffers = loaded;
+
+        // Both are core in ES 3.0, no entry points needed
+        g_caps.packedVertices = true;
+        g_caps.glsl3 = true;
+
+        loaded = true;
+        loaded &= loadProc(_ext_glFenceSync, "glFenceSync");
+        loaded &= loadProc(_ext_glClientWaitSync, "glClientWaitSync");
+        loaded &= loadProc(_ext_glDeleteSync, "glDeleteSync");
+        g_caps.fenceSync = loaded;
+
+        if (glHasExtension("GL_EXT_disjoint_timer_query"))
+        {
+            loaded = true;
+            loaded &= loadProc(_ext_glGenQueries, "glGenQueries");
+            loaded &= loadProc(_ext_glDeleteQueries, "glDeleteQueries");
+            loaded &= loadProc(_ext_glGetQueryObjectuiv, "glGetQueryObjectuiv");
+            loaded &= loadProc(_ext_glQueryCounter, "glQueryCounterEXT");
+            loaded &= loadProc(_ext_glGetQueryObjectui64v, "glGetQueryObjectui64vEXT");
+            g_caps.timerQuery = loaded;
+        }
+    }
+    g_caps.textureLod = g_caps.glsl3 || glHasExtension("GL_EXT_shader_texture_lod");
+    if (g_caps.major >= 3)
+    {
+        g_caps.programBinary = loadProgramBinary("", true);
+    }
+    else if (glHasExtension("GL_OES_get_program_binary"))
+    {
+        g_caps.programBinary = loadProgramBinary("OES", false);
+    }
+#endif
+
+    // Same on both profiles; without the extension, status queries simply block until the compile is done
+    const char* parallelCompileSuffix = glHasExtension("GL_KHR_parallel_shader_compile") ? "KHR" :
+                                        glHasExtension("GL_ARB_parallel_shader_compile") ? "ARB" : NULL;
+    if (parallelCompileSuffix)
+    {
+        std::string name = std::string("glMaxShaderCompilerThreads") + parallelCompileSuffix;
+        g_caps.parallelShaderCompile = loadProc(_ext_glMaxShaderCompilerThreads, name.c_str());
+    }
+    if (g_caps.parallelShaderCompile)
+    {
+        // Let the driver use as many threads as it likes
+        glMaxShaderCompilerThreads(0xFFFFFFFFu);
+    }
+
+    Log(LOG_INFO) << "GL caps: instancing " << (g_caps.instancing ? "yes" : "no")
+                  << ", uniform buffers " << (g_caps.uniformBuffers ? "yes" : "no")
+                  << ", packed vertices " << (g_caps.packedVertices ? "yes" : "no")
+                  << ", GLSL 3 " << (g_caps.glsl3 ? "yes" : "no")
+                  << ", conditional rendering " << (g_caps.conditionalRender ? "yes" : "no")
+                  << ", program binaries " << (g_caps.programBinary ? "yes" : "no")
+                  << ", parallel shader compile " << (g_caps.parallelShaderCompile ? "yes" : "no")
+                  << ", fences " << (g_caps.fenceSync ? "yes" : "no")
+                  << ", timer queries " << (g_caps.timerQuery ? "yes" : "no")
+                  << ", texture LOD " << (g_caps.textureLod ? "yes" : "no");
+    return true;
+}
+
+const GlCaps& glCaps()
+{
+    return g_caps;
+}
@@ -0,0 +1,132 @@
+//
+// Optional GL entry points and runtime capability checks.
+//
+
+#ifndef IMGUI_DEMO_GL_EXT_H
+#define IMGUI_DEMO_GL_EXT_H
+
+#ifdef GL_PROFILE_GL3
+#include "gl_glcore_3_3.h"
+#else
+#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
+
+// We're linking against libGLESv2.so, so ES3 functions are not guaranteed to be there.
+// Same as in imgui_impl_sdl_es3.cpp, we load them at runtime; the names below are
+// redirected to pointers that are filled in by glExtInit() (this is what glload does
+// for the desktop build as well).
+extern PFNGLDRAWELEMENTSINSTANCEDPROC _ext_glDrawElementsInstanced;
+#define glDrawElementsInstanced _ext_glDrawElementsInstanced
+extern PFNGLVERTEXATTRIBDIVISORPROC _ext_glVertexAttribDivisor;
+#define glVertexAttribDivisor _ext_glVertexAttribDivisor
+extern PFNGLGETUNIFORMBLOCKINDEXPROC _ext_glGetUniformBlockIndex;
+#define glGetUniformBlockIndex _ext_glGetUniformBlockIndex
+extern PFNGLUNIFORMBLOCKBINDINGPROC _ext_glUniformBlockBinding;
+#define glUniformBlockBinding _ext_glUniformBlockBinding
+extern PFNGLBINDBUFFERBASEPROC _ext_glBindBufferBase;
+#define glBindBufferBase _ext_glBindBufferBase
+extern PFNGLFENCESYNCPROC _ext_glFenceSync;
+#define glFenceSync _ext_glFenceSync
+extern PFNGLCLIENTWAITSYNCPROC _ext_glClientWaitSync;
+#define glClientWaitSync _ext_glClientWaitSync
+extern PFNGLDELETESYNCPROC _ext_glDeleteSync;
+#define glDeleteSync _ext_glDeleteSync
+extern PFNGLGENQUERIESPROC _ext_glGenQueries;
+#define glGenQueries _ext_glGenQueries
+extern PFNGLDELETEQUERIESPROC _ext_glDeleteQueries;
+#define glDeleteQueries _ext_glDeleteQueries
+extern PFNGLGETQUERYOBJECTUIVPROC _ext_glGetQueryObjectuiv;
+#define glGetQueryObjectuiv _ext_glGetQueryObjectuiv
+
+// GL_EXT_disjoint_timer_query; core GL 3.3 has the same thing without the suffix
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+typedef void (GL_APIENTRYP PFN_glQueryCounter)(GLuint id, GLenum target);
+typedef void (GL_APIENTRYP PFN_glGetQueryObjectui64v)(GLuint id, GLenum pname, GLuint64* params);
+extern PFN_glQueryCounter _ext_glQueryCounter;
+#define glQueryCounter _ext_glQueryCounter
+extern PFN_glGetQueryObjectui64v _ext_glGetQueryObjectui64v;
+#define glGetQueryObjectui64v _ext_glGetQueryObjectui64v
+#endif
+
+#ifdef GL_PROFILE_GL3
+// Program binaries are GL 4.1 / ARB_get_program_binary, so glload's 3.3 core header doesn't have them
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (CODEGEN_FUNCPTR *PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length,
+                                                          GLenum* binaryFormat, void* binary);
+typedef void (CODEGEN_FUNCPTR *PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary,
+                                                       GLsizei length);
+typedef void (CODEGEN_FUNCPTR *PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+#endif
+
+// Loaded on both profiles: ES3 core or GL_OES_get_program_binary, GL 4.1 or GL_ARB_get_program_binary.
+// glProgramParameteri may be NULL even if the other two are there (the OES extension doesn't have it).
+extern PFNGLGETPROGRAMBINARYPROC _ext_glGetProgramBinary;
+#define glGetProgramBinary _ext_glGetProgramBinary
+extern PFNGLPROGRAMBINARYPROC _ext_glProgramBinary;
+#define glProgramBinary _ext_glProgramBinary
+extern PFNGLPROGRAMPARAMETERIPROC _ext_glProgramParameteri;
+#define glProgramParameteri _ext_glProgramParameteri
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile (same token, different function suffix)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifdef GL_PROFILE_GL3
+typedef void (CODEGEN_FUNCPTR *PFN_glMaxShaderCompilerThreads)(GLuint count);
+#else
+typedef void (GL_APIENTRYP PFN_glMaxShaderCompilerThreads)(GLuint count);
+#endif
+extern PFN_glMaxShaderCompilerThreads _ext_glMaxShaderCompilerThreads;
+#define glMaxShaderCompilerThreads _ext_glMaxShaderCompilerThreads
+
+/**
+ * Features that may or may not be available depending on the context we got.
+ * On desktop everything here is core GL 3.3; on Android this depends on
+ * whether the driver gave us an ES3 context.
+ */
+struct GlCaps {
+    int major;
+    int minor;
+    bool es;
+    bool instancing;
+    bool uniformBuffers;
+    // Half float and GL_INT_2_10_10_10_REV vertex attributes
+    bool packedVertices;
+    // GLSL 3.30 on desktop, GLSL ES 3.00 on ES3 contexts
+    bool glsl3;
+    // Occlusion queries plus glBeginConditionalRender; ES3 has the former but not the latter
+    bool conditionalRender;
+    // glGetProgramBinary/glProgramBinary, with at least one binary format
+    bool programBinary;
+    // Compiles and links run on driver threads; GL_COMPLETION_STATUS_KHR can be polled without blocking
+    bool parallelShaderCompile;
+    // glFenceSync/glClientWaitSync: core in GL 3.2 and ES 3.0
+    bool fenceSync;
+    // GPU timestamps with glQueryCounter; ES needs GL_EXT_disjoint_timer_query, and the results are
+    // only meaningful if GL_GPU_DISJOINT_EXT stays clear
+    bool timerQuery;
+    // Explicit level of detail in fragment shaders (textureCubeLod); ES2 needs GL_EXT_shader_texture_lod
+    bool textureLod;
+};
+
+/**
+ * Query context version and load optional entry points. Requires a current context.
+ * @return false if the context version could not be determined
+ */
+bool glExtInit();
+
+const GlCaps& glCaps();
+
+/**
+ * @return true if the context advertises the extension
+ */
+bool glHasExtension(const char* name);
+
+#endif //IMGUI_DEMO_GL_EXT_H
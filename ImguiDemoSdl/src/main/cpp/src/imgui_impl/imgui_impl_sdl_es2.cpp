@@ -8,6 +8,8 @@
 #ifdef GL_PROFILE_GLES2
 #include "imgui.h"
 #include "imgui_impl_sdl_es2.h"
+#include "program_cache.h"
+#include "trace.h"
 
 // SDL,GL3W
 #include <SDL.h>
@@ -15,7 +17,7 @@
 #include <GLES2/gl2.h> // No need to use a loader, since we're linking against libGLES2.so
 
 // Data
-static double       g_Time = 0.0f;
+static Uint64       g_Time = 0;
 static bool         g_MousePressed[3] = { false, false, false };
 static float        g_MouseWheel = 0.0f;
 static GLuint       g_FontTexture = 0;
@@ -27,21 +29,15 @@ static unsigned int g_VboHandle = 0, /*g_VaoHandle = 0,*/ g_ElementsHandle = 0;
 // This is the main rendering function that you have to implement and provide to ImGui (via setting up 'RenderDrawListsFn' in the ImGuiIO structure)
 // If text or lines are blurry when integrating ImGui in your engine:
 // - in your Render function, try translating your projection matrix by (0.5f,0.5f) or (0.375f,0.375f)
-void ImGui_ImplSdlGLES2_RenderDrawLists(ImDrawData* draw_data)
+void ImGui_ImplSdlGLES2_RenderDrawData(ImDrawData* draw_data, const ImVec2& display_size, const ImVec2& framebuffer_scale)
 {
+    TRACE_SCOPE("ImGui render");
     // Avoid rendering when minimized, scale coordinates for retina displays (screen coordinates != framebuffer coordinates)
-    ImGuiIO& io = ImGui::GetIO();
-    // Because of some weird handling of Android's virtual keyboard, we have to check if the Backspace button is pressed
-    const Uint8* kbState = SDL_GetKeyboardState(NULL);
-    if (!kbState[SDL_SCANCODE_BACKSPACE])
-    {
-        io.KeysDown[SDLK_BACKSPACE] = 0;
-    }
-    int fb_width = (int)(io.DisplaySize.x * io.DisplayFramebufferScale.x);
-    int fb_height = (int)(io.DisplaySize.y * io.DisplayFramebufferScale.y);
+    int fb_width = (int)(display_size.x * framebuffer_scale.x);
+    int fb_height = (int)(display_size.y * framebuffer_scale.y);
     if (fb_width == 0 || fb_height == 0)
         return;
-    draw_data->ScaleClipRects(io.DisplayFramebufferScale);
+    draw_data->ScaleClipRects(framebuffer_scale);
 
     // Backup GL state
     GLint last_active_texture; glGetIntegerv(GL_ACTIVE_TEXTURE, &last_active_texture);
@@ -77,8 +73,8 @@ void ImGui_ImplSdlGLES2_RenderDrawLists(ImDrawData* draw_data)
     glViewport(0, 0, (GLsizei)fb_width, (GLsizei)fb_height);
     const float ortho_projection[4][4] =
     {
-        { 2.0f/io.DisplaySize.x, 0.0f,                   0.0f, 0.0f },
-        { 0.0f,                  2.0f/-io.DisplaySize.y, 0.0f, 0.0f },
+        { 2.0f/display_size.x,   0.0f,                   0.0f, 0.0f },
+        { 0.0f,                  2.0f/-display_size.y,   0.0f, 0.0f },
         { 0.0f,                  0.0f,                  -1.0f, 0.0f },
         {-1.0f,                  1.0f,                   0.0f, 1.0f },
     };
@@ -145,6 +141,12 @@ void ImGui_ImplSdlGLES2_RenderDrawLists(ImDrawData* draw_data)
     glScissor(last_scissor_box[0], last_scissor_box[1], (GLsizei)last_scissor_box[2], (GLsizei)last_scissor_box[3]);
 }
 
+void ImGui_ImplSdlGLES2_RenderDrawLists(ImDrawData* draw_data)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    ImGui_ImplSdlGLES2_RenderDrawData(draw_data, io.DisplaySize, io.DisplayFramebufferScale);
+}
+
 static const char* ImGui_ImplSdlGLES2_GetClipboardText(void*)
 {
     return SDL_GetClipboardText();
@@ -228,6 +230,7 @@ void ImGui_ImplSdlGLES2_CreateFontsTexture()
 
 bool ImGui_ImplSdlGLES2_CreateDeviceObjects()
 {
+    TRACE_SCOPE("ImGui device objects");
     // Backup GL state
     GLint last_texture, last_array_buffer, last_vertex_array;
     glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
@@ -262,16 +265,25 @@ bool ImGui_ImplSdlGLES2_CreateDeviceObjects()
         "	gl_FragColor = Frag_Color * texture2D( Texture, Frag_UV.st);\n"
         "}\n";
 
-    g_ShaderHandle = glCreateProgram();
-    g_VertHandle = glCreateShader(GL_VERTEX_SHADER);
-    g_FragHandle = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(g_VertHandle, 1, &vertex_shader, 0);
-    glShaderSource(g_FragHandle, 1, &fragment_shader, 0);
-    glCompileShader(g_VertHandle);
-    glCompileShader(g_FragHandle);
-    glAttachShader(g_ShaderHandle, g_VertHandle);
-    glAttachShader(g_ShaderHandle, g_FragHandle);
-    glLinkProgram(g_ShaderHandle);
+    // Only compile from source if the program cache doesn't have a binary for this driver yet
+    const GLchar* sources[] = { vertex_shader, fragment_shader };
+    const uint64_t cache_key = programCacheKey(sources, 2);
+    g_ShaderHandle = (int)programCacheLoad(cache_key);
+    if (g_ShaderHandle == 0)
+    {
+        g_ShaderHandle = glCreateProgram();
+        g_VertHandle = glCreateShader(GL_VERTEX_SHADER);
+        g_FragHandle = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(g_VertHandle, 1, &vertex_shader, 0);
+        glShaderSource(g_FragHandle, 1, &fragment_shader, 0);
+        glCompileShader(g_VertHandle);
+        glCompileShader(g_FragHandle);
+        glAttachShader(g_ShaderHandle, g_VertHandle);
+        glAttachShader(g_ShaderHandle, g_FragHandle);
+        programCacheBeforeLink(g_ShaderHandle);
+        glLinkProgram(g_ShaderHandle);
+        programCacheStore(cache_key, g_ShaderHandle);
+    }
 
     g_AttribLocationTex = glGetUniformLocation(g_ShaderHandle, "Texture");
     g_AttribLocationProjMtx = glGetUniformLocation(g_ShaderHandle, "ProjMtx");
@@ -393,9 +405,10 @@ void ImGui_ImplSdlGLES2_NewFrame(SDL_Window* window)
     io.DisplayFramebufferScale = ImVec2(w > 0 ? ((float)display_w / w) : 0, h > 0 ? ((float)display_h / h) : 0);
 
     // Setup time step
-    Uint32	time = SDL_GetTicks();
-    double current_time = time / 1000.0;
-    io.DeltaTime = g_Time > 0.0 ? (float)(current_time - g_Time) : (float)(1.0f / 60.0f);
+    // (SDL_GetTicks() only has millisecond resolution, which is a sizeable part of a frame at 90-120 Hz)
+    static const Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 current_time = SDL_GetPerformanceCounter();
+    io.DeltaTime = g_Time > 0 ? (float)((double)(current_time - g_Time) / frequency) : (float)(1.0f / 60.0f);
     g_Time = current_time;
 
     // Setup inputs
@@ -420,5 +433,13 @@ void ImGui_ImplSdlGLES2_NewFrame(SDL_Window* window)
 
     // Start the frame
     ImGui::NewFrame();
+
+    // Because of some weird handling of Android's virtual keyboard, we have to check if the Backspace button is pressed.
+    // The frame has already seen the press; this only decides whether the next one still does.
+    const Uint8* kbState = SDL_GetKeyboardState(NULL);
+    if (!kbState[SDL_SCANCODE_BACKSPACE])
+    {
+        io.KeysDown[SDLK_BACKSPACE] = 0;
+    }
 }
 #endif // GL_PROFILE_GLES2
\ No newline at end of file
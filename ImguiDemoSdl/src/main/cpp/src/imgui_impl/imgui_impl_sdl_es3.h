@@ -13,12 +13,21 @@
 
 struct SDL_Window;
 typedef union SDL_Event SDL_Event;
+struct ImDrawData;
+struct ImVec2;
 
 IMGUI_API bool        ImGui_ImplSdlGLES3_Init(SDL_Window* window);
 IMGUI_API void        ImGui_ImplSdlGLES3_Shutdown();
 IMGUI_API void        ImGui_ImplSdlGLES3_NewFrame(SDL_Window* window);
 IMGUI_API bool        ImGui_ImplSdlGLES3_ProcessEvent(SDL_Event* event);
 
+// Installed as io.RenderDrawListsFn by Init(). Call it yourself if you clear RenderDrawListsFn
+// and want to draw the UI later than ImGui::Render(), e.g. after the scene.
+IMGUI_API void        ImGui_ImplSdlGLES3_RenderDrawLists(ImDrawData* draw_data);
+// Same, with the display size and framebuffer scale of the frame passed in rather than taken from ImGuiIO;
+// only touches GL, so it can run on another thread (with the context current there) on a copy of the draw data.
+IMGUI_API void        ImGui_ImplSdlGLES3_RenderDrawData(ImDrawData* draw_data, const ImVec2& display_size, const ImVec2& framebuffer_scale);
+
 // Use if you want to reset your rendering device without losing ImGui state.
 IMGUI_API void        ImGui_ImplSdlGLES3_InvalidateDeviceObjects();
 IMGUI_API bool        ImGui_ImplSdlGLES3_CreateDeviceObjects();
@@ -0,0 +1,208 @@
+//
+// Per-frame input stage and latched camera input.
+//
+
+#include "input.h"
+
+#include <cstdint>
+
+InputPump::InputPump(eventHandler_t* handler) : handler(handler), hasPending(false) { }
+
+void InputPump::pump(InputFrame& frame)
+{
+    frame.quit = false;
+    frame.received = 0;
+    frame.dispatched = 0;
+
+    SDL_PumpEvents();
+    int count;
+    while ((count = SDL_PeepEvents(batch, batchSize, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT)) > 0)
+    {
+        frame.received += count;
+        for (int i = 0; i < count; ++i)
+        {
+            const SDL_Event& e = batch[i];
+            const bool coalescable = (e.type == SDL_MOUSEMOTION || e.type == SDL_MULTIGESTURE);
+            if (coalescable && hasPending && pending.type == e.type)
+            {
+                // Same kind of event as the one before: take over its position, keep the sums going.
+                // Button state can't change within a run, that would have been a button event.
+                if (e.type == SDL_MOUSEMOTION)
+                {
+                    int xrel = pending.motion.xrel + e.motion.xrel;
+                    int yrel = pending.motion.yrel + e.motion.yrel;
+                    pending = e;
+                    pending.motion.xrel = xrel;
+                    pending.motion.yrel = yrel;
+                }
+                else
+                {
+                    float dDist = pending.mgesture.dDist + e.mgesture.dDist;
+                    float dTheta = pending.mgesture.dTheta + e.mgesture.dTheta;
+                    pending = e;
+                    pending.mgesture.dDist = dDist;
+                    pending.mgesture.dTheta = dTheta;
+                }
+                continue;
+            }
+
+            flushPending(frame);
+            if (coalescable)
+            {
+                pending = e;
+                hasPending = true;
+            }
+            else
+            {
+                dispatch(e, frame);
+            }
+        }
+        if (count < batchSize)
+        {
+            break;
+        }
+    }
+    flushPending(frame);
+}
+
+void InputPump::flushPending(InputFrame& frame)
+{
+    if (!hasPending)
+    {
+        return;
+    }
+    hasPending = false;
+    ++frame.dispatched;
+    handler(&pending);
+}
+
+void InputPump::dispatch(const SDL_Event& event, InputFrame& frame)
+{
+    ++frame.dispatched;
+    SDL_Event e = event;
+    handler(&e);
+    if (e.type == SDL_QUIT)
+    {
+        frame.quit = true;
+    }
+}
+
+InputLatch::InputLatch() : enqueuePos(0), dequeuePos(0), droppedSamples(0)
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    // Watchers run as soon as an event is pushed, on the pushing thread: SDL's input thread on
+    // Android, the thread that pumps events on desktop
+    SDL_AddEventWatch(watch, this);
+}
+
+InputLatch::~InputLatch()
+{
+    SDL_DelEventWatch(watch, this);
+}
+
+int SDLCALL InputLatch::watch(void* userdata, SDL_Event* event)
+{
+    InputLatch* self = static_cast<InputLatch*>(userdata);
+    sample s = {SDL_GetPerformanceCounter(), 0.0f, 0.0f, 0.0f};
+    switch (event->type)
+    {
+        case SDL_MOUSEMOTION:
+            if (!(event->motion.state & SDL_BUTTON_LMASK))
+            {
+                return 1;
+            }
+            s.dragX = (float)-event->motion.xrel;
+            s.dragY = (float)-event->motion.yrel;
+            break;
+        case SDL_MULTIGESTURE:
+            if (event->mgesture.numFingers <= 1)
+            {
+                return 1;
+            }
+            s.zoom = event->mgesture.dDist * 10.0f;
+            break;
+        case SDL_MOUSEWHEEL:
+            s.zoom = event->wheel.y / 100.0f;
+            break;
+        default:
+            return 1;
+    }
+    self->push(s);
+    // The event stays in the queue for everyone else
+    return 1;
+}
+
+void InputLatch::push(const sample& s)
+{
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;)
+    {
+        c = &cells[pos & (capacity - 1)];
+        size_t sequence = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            droppedSamples.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    c->data = s;
+    c->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void InputLatch::latch(CameraMotion& motion, bool pumpEvents)
+{
+    if (pumpEvents)
+    {
+        SDL_PumpEvents();
+    }
+
+    motion.dragX = 0.0f;
+    motion.dragY = 0.0f;
+    motion.zoom = 0.0f;
+    motion.samples = 0;
+    motion.latency = 0.0f;
+    Uint64 oldest = 0;
+    for (;;)
+    {
+        cell& c = cells[dequeuePos & (capacity - 1)];
+        if (c.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+        {
+            break;
+        }
+        const sample& s = c.data;
+        motion.dragX += s.dragX;
+        motion.dragY += s.dragY;
+        motion.zoom += s.zoom;
+        if (motion.samples++ == 0)
+        {
+            oldest = s.time;
+        }
+        c.sequence.store(dequeuePos + capacity, std::memory_order_release);
+        ++dequeuePos;
+    }
+    if (motion.samples != 0)
+    {
+        motion.latency = (float)((double)(SDL_GetPerformanceCounter() - oldest) * 1000.0 / SDL_GetPerformanceFrequency());
+    }
+}
+
+unsigned InputLatch::dropped()
+{
+    return droppedSamples.load(std::memory_order_relaxed);
+}
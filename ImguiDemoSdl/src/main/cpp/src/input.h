@@ -0,0 +1,113 @@
+//
+// Input handling in two parts. InputPump is the per-frame stage: it pulls the event queue in
+// batches and folds runs of high-rate events (mouse motion, multi-finger gestures) into a single
+// event before the UI looks at them. InputLatch collects camera motion as events are produced,
+// on whatever thread produces them, so that it can be picked up right before the scene is drawn.
+//
+
+#ifndef IMGUI_DEMO_INPUT_H
+#define IMGUI_DEMO_INPUT_H
+
+#include <SDL.h>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * What InputPump::pump() went through
+ */
+struct InputFrame {
+    bool quit;
+    // Events taken off the queue, and events left after coalescing
+    int received;
+    int dispatched;
+};
+
+class InputPump {
+public:
+    typedef bool (eventHandler_t)(SDL_Event*);
+
+    /**
+     * @param handler Gets every event after coalescing (the ImGui backend's ProcessEvent)
+     */
+    explicit InputPump(eventHandler_t* handler);
+
+    /**
+     * Drain the event queue. Button, key, text and all other events keep their order; a run of
+     * consecutive motion or gesture events is delivered as its last event, with relative motion
+     * (xrel/yrel, dDist/dTheta) summed over the run.
+     */
+    void pump(InputFrame& frame);
+
+private:
+    void dispatch(const SDL_Event& event, InputFrame& frame);
+    void flushPending(InputFrame& frame);
+
+    eventHandler_t* handler;
+    // Events are read in batches of this many
+    static const int batchSize = 64;
+    SDL_Event batch[batchSize];
+    // Run of motion/gesture events that hasn't been delivered yet
+    SDL_Event pending;
+    bool hasPending;
+};
+
+/**
+ * Camera motion since the previous InputLatch::latch() call
+ */
+struct CameraMotion {
+    // Pointer movement with the left button held, previous minus current position
+    float dragX;
+    float dragY;
+    float zoom;
+    int samples;
+    // Time from the oldest sample to the latch, in milliseconds
+    float latency;
+};
+
+class InputLatch {
+public:
+    InputLatch();
+    ~InputLatch();
+
+    /**
+     * Take everything collected so far. Call it as late as possible, right before the camera is used.
+     * Pumps the event loop first, so on platforms where events are only produced by pumping
+     * (desktop) whatever arrived during the frame is included too.
+     * @param pumpEvents Pass false when not on the main thread; SDL only pumps events there
+     */
+    void latch(CameraMotion& motion, bool pumpEvents = true);
+
+    /**
+     * @return Samples lost because the queue was full (nobody latched for a long time)
+     */
+    unsigned dropped();
+
+private:
+    InputLatch(const InputLatch&);
+    InputLatch& operator=(const InputLatch&);
+
+    struct sample {
+        Uint64 time;
+        float dragX;
+        float dragY;
+        float zoom;
+    };
+
+    // Bounded multi-producer, single-consumer queue: each cell's sequence number says whether
+    // it's free for the producer at that position or holds data for the consumer
+    struct cell {
+        std::atomic<size_t> sequence;
+        sample data;
+    };
+    static const size_t capacity = 1024;
+
+    static int SDLCALL watch(void* userdata, SDL_Event* event);
+    void push(const sample& s);
+
+    cell cells[capacity];
+    std::atomic<size_t> enqueuePos;
+    size_t dequeuePos;
+    std::atomic<unsigned> droppedSamples;
+};
+
+#endif //IMGUI_DEMO_INPUT_H
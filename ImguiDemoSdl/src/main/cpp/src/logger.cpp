@@ -0,0 +1,322 @@
+//
+// Log records are queued on per-thread rings and formatted and written out by a background
+// thread, so that logging from the render thread never waits for stdout or logcat.
+//
+
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOG_TAG "NativeApp"
+#endif
+
+namespace _Logger {
+    namespace {
+        // Records per thread; a power of two so that the indices can just wrap around
+        const uint32_t ringCapacity = 256;
+
+        /**
+         * Single producer (the owning thread), single consumer (the writer thread).
+         * head is only written by the producer, tail only by the consumer.
+         */
+        struct Ring {
+            Record records[ringCapacity];
+            std::atomic<uint32_t> head;
+            std::atomic<uint32_t> tail;
+            std::atomic<uint32_t> dropped;
+            // Rings are never removed, so the list can be walked without locking
+            Ring* next;
+        };
+
+        std::atomic<Ring*> g_rings(nullptr);
+        // Set once the writer is gone (static destruction); records are written directly after that
+        std::atomic<bool> g_writerStopped(false);
+        thread_local Ring* t_ring = nullptr;
+
+        const char* sevStr(Severity severity)
+        {
+            switch(severity){
+                case LOG_DEBUG:
+                    return "[DEBUG] ";
+                case LOG_INFO:
+                    return "[INFO] ";
+                case LOG_WARN:
+                    return "[WARN] ";
+                case LOG_ERROR:
+                    return "[ERROR] ";
+                case LOG_FATAL:
+                    return "[FATAL] ";
+            }
+            return "";
+        }
+
+#ifdef __ANDROID__
+        int getPrio(Severity severity)
+        {
+            switch(severity)
+            {
+                case LOG_DEBUG:
+                    return ANDROID_LOG_DEBUG;
+                case LOG_INFO:
+                    return ANDROID_LOG_INFO;
+                case LOG_WARN:
+                    return ANDROID_LOG_WARN;
+                case LOG_ERROR:
+                    return ANDROID_LOG_ERROR;
+                case LOG_FATAL:
+                    return ANDROID_LOG_FATAL;
+                default:
+                    return ANDROID_LOG_DEFAULT;
+            }
+        }
+#endif
+
+        void write(Severity severity, const char* text, uint32_t length)
+        {
+#ifdef __ANDROID__
+            __android_log_print(getPrio(severity), LOG_TAG, "%.*s", (int)length, text);
+#else
+            FILE* stream = (severity < LOG_ERROR) ? stdout : stderr;
+            fputs(sevStr(severity), stream);
+            fwrite(text, 1, length, stream);
+            fputc('\n', stream);
+#endif
+        }
+
+        /**
+         * Turn a record's arguments into text
+         * @return Length of the text, not counting the terminating zero
+         */
+        size_t format(const Record& record, char* text, size_t capacity)
+        {
+            size_t length = 0;
+            const uint8_t* data = record.data;
+            const uint8_t* end = record.data + record.size;
+            while (data < end && length + 1 < capacity)
+            {
+                const ArgType type = (ArgType)*data++;
+                int written = 0;
+                switch (type)
+                {
+                    case ARG_STRING:
+                    {
+                        uint16_t stringLength;
+                        memcpy(&stringLength, data, sizeof(stringLength));
+                        data += sizeof(stringLength);
+                        written = snprintf(text + length, capacity - length, "%.*s", (int)stringLength, (const char*)data);
+                        data += stringLength;
+                        break;
+                    }
+                    case ARG_CHAR:
+                        written = snprintf(text + length, capacity - length, "%c", (char)*data);
+                        data += sizeof(char);
+                        break;
+                    case ARG_INT:
+                    {
+                        int64_t value;
+                        memcpy(&value, data, sizeof(value));
+                        data += sizeof(value);
+                        written = snprintf(text + length, capacity - length, "%lld", (long long)value);
+                        break;
+                    }
+                    case ARG_UINT:
+                    {
+                        uint64_t value;
+                        memcpy(&value, data, sizeof(value));
+                        data += sizeof(value);
+                        written = snprintf(text + length, capacity - length, "%llu", (unsigned long long)value);
+                        break;
+                    }
+                    case ARG_DOUBLE:
+                    {
+                        double value;
+                        memcpy(&value, data, sizeof(value));
+                        data += sizeof(value);
+                        written = snprintf(text + length, capacity - length, "%g", value);
+                        break;
+                    }
+                    case ARG_POINTER:
+                    {
+                        const void* value;
+                        memcpy(&value, data, sizeof(value));
+                        data += sizeof(value);
+                        written = snprintf(text + length, capacity - length, "%p", value);
+                        break;
+                    }
+                    default:
+                        // Can't tell how long an unknown argument is, so nothing after it can be read
+                        data = end;
+                        break;
+                }
+                if (written > 0)
+                {
+                    length = std::min(length + (size_t)written, capacity - 1);
+                }
+            }
+            if (record.truncated && length + 4 < capacity)
+            {
+                memcpy(text + length, "...", 4);
+                length += 3;
+            }
+            return length;
+        }
+
+        void writeRecord(const Record& record)
+        {
+            char text[1024];
+            size_t length = format(record, text, sizeof(text));
+            write(record.severity, text, (uint32_t)length);
+        }
+
+        /**
+         * Write out everything that's queued right now
+         * @return Number of records written
+         */
+        size_t drain()
+        {
+            size_t written = 0;
+            for (Ring* ring = g_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+            {
+                uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+                const uint32_t head = ring->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail)
+                {
+                    writeRecord(ring->records[tail & (ringCapacity - 1)]);
+                    ++written;
+                }
+                // Hand the slots back only after they've been read
+                ring->tail.store(tail, std::memory_order_release);
+
+                uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+                if (dropped != 0)
+                {
+                    char note[64];
+                    int length = snprintf(note, sizeof(note), "%u log messages dropped", dropped);
+                    write(LOG_WARN, note, (uint32_t)length);
+                }
+            }
+            if (written != 0)
+            {
+                fflush(stdout);
+                fflush(stderr);
+            }
+            return written;
+        }
+
+        class Writer {
+        public:
+            Writer() : running(true), thread(&Writer::run, this) { }
+
+            ~Writer()
+            {
+                running.store(false);
+                thread.join();
+                g_writerStopped.store(true);
+                drain();
+            }
+
+        private:
+            void run()
+            {
+                while (running.load(std::memory_order_relaxed))
+                {
+                    if (drain() == 0)
+                    {
+                        // Nothing to do; polling is cheaper for the producers than waking us up
+                        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    }
+                }
+            }
+
+            std::atomic<bool> running;
+            std::thread thread;
+        };
+
+        Ring* threadRing()
+        {
+            if (t_ring == nullptr)
+            {
+                // The one allocation per thread; the ring outlives the thread, so the writer can
+                // still pick up whatever it left behind
+                Ring* ring = new Ring();
+                ring->head.store(0);
+                ring->tail.store(0);
+                ring->dropped.store(0);
+                ring->next = g_rings.load(std::memory_order_relaxed);
+                while (!g_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release,
+                                                      std::memory_order_relaxed))
+                {
+                }
+                t_ring = ring;
+
+                // Started with the first ring, stopped (and drained) during static destruction
+                static Writer writer;
+            }
+            return t_ring;
+        }
+    }
+
+    void submit(const Record& record)
+    {
+        if (g_writerStopped.load(std::memory_order_relaxed))
+        {
+            writeRecord(record);
+            return;
+        }
+
+        Ring* ring = threadRing();
+        const uint32_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) == ringCapacity)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record& slot = ring->records[head & (ringCapacity - 1)];
+        slot.severity = record.severity;
+        slot.size = record.size;
+        slot.truncated = record.truncated;
+        memcpy(slot.data, record.data, record.size);
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    void flush()
+    {
+        for (Ring* ring = g_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+        {
+            while (!g_writerStopped.load(std::memory_order_relaxed) &&
+                   ring->tail.load(std::memory_order_acquire) != ring->head.load(std::memory_order_relaxed))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void Logger::putString(const char* text, size_t length)
+    {
+        // Strings are the one thing that has to be copied: the caller's buffer may be gone by
+        // the time the record is written. Long ones are cut to whatever space is left.
+        const size_t header = 1 + sizeof(uint16_t);
+        if (record.size + header > maxRecordSize)
+        {
+            record.truncated = true;
+            return;
+        }
+        size_t space = maxRecordSize - record.size - header;
+        if (length > space)
+        {
+            length = space;
+            record.truncated = true;
+        }
+        uint16_t storedLength = (uint16_t)length;
+        record.data[record.size] = (uint8_t)ARG_STRING;
+        memcpy(record.data + record.size + 1, &storedLength, sizeof(storedLength));
+        memcpy(record.data + record.size + header, text, length);
+        record.size += (uint32_t)(header + length);
+    }
+};
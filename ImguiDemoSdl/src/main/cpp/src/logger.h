@@ -5,13 +5,15 @@
 #ifndef XPLATDEV_LOGGER_H
 #define XPLATDEV_LOGGER_H
 
-#ifdef __ANDROID__
-#include <android/log.h>
-#define LOG_TAG "NativeApp"
-#else
-#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Messages below this severity are compiled out; pass e.g. -DLOG_MIN_SEVERITY=LOG_WARN to override
+#ifndef LOG_MIN_SEVERITY
+#define LOG_MIN_SEVERITY LOG_DEBUG
 #endif
-#include <sstream>
 
 namespace _Logger {
     enum Severity {
@@ -22,59 +24,68 @@ namespace _Logger {
         LOG_FATAL
     };
 
-    class Logger {
-    private:
-        std::stringstream logbuf;
+    // Room for arguments in a record; whatever doesn't fit is cut off
+    const size_t maxRecordSize = 240;
+
+    /**
+     * Arguments are stored in their binary form, each one a tag byte followed by the value;
+     * turning them into text is left to the writer thread
+     */
+    enum ArgType {
+        ARG_STRING = 0,     // uint16_t length, then the characters
+        ARG_CHAR,
+        ARG_INT,            // int64_t
+        ARG_UINT,           // uint64_t
+        ARG_DOUBLE,
+        ARG_POINTER
+    };
+
+    /**
+     * A message as it's handed over to the writer thread: fixed size, no pointers to the caller's data
+     */
+    struct Record {
         Severity severity;
+        uint32_t size;
+        // Set if some of the arguments didn't fit
+        bool truncated;
+        uint8_t data[maxRecordSize];
+    };
 
-        std::string sevStr()
-        {
-            switch(severity){
-                case LOG_DEBUG:
-                    return "[DEBUG] ";
-                case LOG_INFO:
-                    return "[INFO] ";
-                case LOG_WARN:
-                    return "[WARN] ";
-                case LOG_ERROR:
-                    return "[ERROR] ";
-                case LOG_FATAL:
-                    return "[FATAL] ";
-            }
-        }
+    /**
+     * Queue a record for the writer thread. Each thread has a ring of its own, so this takes no locks
+     * and, past the first call on a thread, doesn't allocate. If the ring is full, the record is
+     * dropped (and the number of dropped records reported later) rather than waiting for space.
+     */
+    void submit(const Record& record);
+
+    /**
+     * Wait until everything submitted so far has been written out
+     */
+    void flush();
+
+    class Logger {
+    private:
+        Record record;
 
-#ifdef __ANDROID__
-        int getPrio()
+        void put(ArgType type, const void* value, size_t size)
         {
-            switch(severity)
+            if (record.size + 1 + size > maxRecordSize)
             {
-                case LOG_DEBUG:
-                    return ANDROID_LOG_DEBUG;
-                case LOG_INFO:
-                    return ANDROID_LOG_INFO;
-                case LOG_WARN:
-                    return ANDROID_LOG_WARN;
-                case LOG_ERROR:
-                    return ANDROID_LOG_ERROR;
-                case LOG_FATAL:
-                    return ANDROID_LOG_FATAL;
-                default:
-                    return ANDROID_LOG_DEFAULT;
+                record.truncated = true;
+                return;
             }
+            record.data[record.size] = (uint8_t)type;
+            memcpy(record.data + record.size + 1, value, size);
+            record.size += (uint32_t)(1 + size);
         }
-#else
-        static std::ostream& getStream(Severity s)
+
+        void putString(const char* text, size_t length);
+
+        template <typename T>
+        void putValue(ArgType type, T value)
         {
-            if (s < LOG_ERROR)
-            {
-                return std::cout;
-            }
-            else
-            {
-                return std::cerr;
-            }
+            put(type, &value, sizeof(value));
         }
-#endif
 
     public:
         static Severity& minSeverity()
@@ -83,26 +94,54 @@ namespace _Logger {
             return minSeverity;
         }
 
-        Logger(Severity s) : severity(s)
+        /**
+         * The compile-time part folds away, so with a constant severity below LOG_MIN_SEVERITY
+         * the whole statement is dead code
+         */
+        static bool enabled(Severity s)
         {
+            return s >= LOG_MIN_SEVERITY && s >= minSeverity();
+        }
 
+        Logger(Severity s)
+        {
+            record.severity = s;
+            record.size = 0;
+            record.truncated = false;
         }
         ~Logger()
         {
-#ifdef __ANDROID__
-            __android_log_print(getPrio(), LOG_TAG, "%s", logbuf.str().c_str());
-#else
-            getStream(severity) << sevStr() << logbuf.str() << std::endl;
-#endif
+            submit(record);
+            if (record.severity == LOG_FATAL)
+            {
+                // Whoever logs this is probably about to go down; make sure it gets out
+                flush();
+            }
         }
-        std::stringstream& log()
+        Logger& log()
         {
-            return logbuf;
+            return *this;
         }
 
+        // Only copies the values; formatting happens on the writer thread
+        Logger& operator<<(const char* text) {putString(text, text ? std::strlen(text) : 0); return *this;}
+        Logger& operator<<(const unsigned char* text) {return *this << reinterpret_cast<const char*>(text);}
+        Logger& operator<<(const std::string& text) {putString(text.data(), text.size()); return *this;}
+        Logger& operator<<(char c) {putValue(ARG_CHAR, c); return *this;}
+        Logger& operator<<(int v) {putValue(ARG_INT, (int64_t)v); return *this;}
+        Logger& operator<<(unsigned int v) {putValue(ARG_UINT, (uint64_t)v); return *this;}
+        Logger& operator<<(long v) {putValue(ARG_INT, (int64_t)v); return *this;}
+        Logger& operator<<(unsigned long v) {putValue(ARG_UINT, (uint64_t)v); return *this;}
+        Logger& operator<<(long long v) {putValue(ARG_INT, (int64_t)v); return *this;}
+        Logger& operator<<(unsigned long long v) {putValue(ARG_UINT, (uint64_t)v); return *this;}
+        Logger& operator<<(double v) {putValue(ARG_DOUBLE, v); return *this;}
+        Logger& operator<<(const void* p) {putValue(ARG_POINTER, p); return *this;}
     };
 };
 
-#define Log(LOGLEVEL) _Logger::Logger(_Logger::LOGLEVEL).log()
+// The check comes first, so a filtered out message doesn't even evaluate its arguments.
+// The empty if branch keeps a following else attached to the caller's if.
+#define Log(LOGLEVEL) \
+    if (!_Logger::Logger::enabled(_Logger::LOGLEVEL)) {} else _Logger::Logger(_Logger::LOGLEVEL).log()
 
 #endif //XPLATDEV_LOGGER_H
@@ -11,10 +11,100 @@
 #include "gl_glcore_3_3.h"
 #include "imgui_impl_sdl_gl3.h"
 #endif
+#include "gl_ext.h"
 #include "teapot.h"
+#include "ui_occluders.h"
+#include "program_cache.h"
+#include "environment_prefilter.h"
+#include "trace.h"
+#include "input.h"
+#include "frame_renderer.h"
+#include "frame_scheduler.h"
 
 #include <unistd.h>
 #include <dirent.h>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+
+/**
+ * Lay out teapot copies on a square grid for the stress test
+ * @param count Number of teapots
+ * @return Per-instance transforms
+ */
+static std::vector<glm::mat4> stressGrid(int count)
+{
+    const float spacing = 12.0f;
+    const float scale = 0.15f;
+    int side = (int) std::ceil(std::sqrt((float) count));
+    float origin = -0.5f * spacing * (side - 1);
+    std::vector<glm::mat4> transforms;
+    transforms.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        glm::mat4 t = glm::translate(glm::mat4(1.0f), glm::vec3(origin + spacing * (i % side), 0.0f, origin + spacing * (i / side)));
+        transforms.push_back(glm::scale(t, glm::vec3(scale)));
+    }
+    return transforms;
+}
+
+/**
+ * A 3D view in a window of its own
+ */
+struct viewportSettings {
+    float resolutionScale;
+    float maxUpdateHz;
+    // Camera orbit in radians per second, added on top of yaw; 0 keeps the view still
+    float orbitSpeed;
+    Teapot::View camera;
+};
+
+/**
+ * Show a viewport window and ask the renderer for the view it shows; the image fills whatever
+ * room the controls leave
+ * @param time Seconds, drives the orbit
+ * @param requests Gets the view if there's room for it
+ */
+static void viewportWindow(int id, viewportSettings& settings, const ViewportStatus& status, float time,
+                           const ImVec2& framebufferScale, std::vector<ViewportRequest>& requests)
+{
+    char title[32];
+    snprintf(title, sizeof(title), "Viewport %d", id + 1);
+    ImGui::SetNextWindowSize(ImVec2(360, 420), ImGuiSetCond_FirstUseEver);
+    if (ImGui::Begin(title))
+    {
+        ImGui::SliderFloat("Scale", &settings.resolutionScale, 0.25f, 1.0f, "%.2f");
+        ImGui::SliderFloat("Max rate", &settings.maxUpdateHz, 0.0f, 60.0f,
+                           settings.maxUpdateHz > 0.0f ? "%.0f Hz" : "on change");
+        ImGui::SliderFloat("Orbit", &settings.orbitSpeed, -2.0f, 2.0f, "%.2f rad/s");
+        ImGui::SliderFloat("Yaw", &settings.camera.camRX, 0.0f, 2 * M_PI);
+        ImGui::SliderFloat("Pitch", &settings.camera.camRY, -1.5f, 1.5f);
+        ImGui::SliderFloat("Zoom", &settings.camera.zoom, 0.5f, 3.0f);
+        ImGui::Text("%dx%d, redrawn %u, reused %u", status.width, status.height, status.redraws, status.reusedFrames);
+
+        // Child windows have no padding, so the image covers the child exactly
+        ImGui::BeginChild("view", ImVec2(0, 0), false, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+        ImVec2 size = ImGui::GetContentRegionAvail();
+        if (size.x >= 1.0f && size.y >= 1.0f)
+        {
+            ViewportRequest request;
+            request.id = id;
+            request.width = (int) (size.x * framebufferScale.x);
+            request.height = (int) (size.y * framebufferScale.y);
+            request.resolutionScale = settings.resolutionScale;
+            request.maxUpdateHz = settings.maxUpdateHz;
+            request.camera = settings.camera;
+            request.camera.camRX = std::fmod(settings.camera.camRX + settings.orbitSpeed * time, (float) (2 * M_PI));
+            requests.push_back(request);
+            // GL textures start at the bottom row
+            ImGui::Image(viewportTextureId(id), size, ImVec2(0, 1), ImVec2(1, 0));
+        }
+        ImGui::EndChild();
+    }
+    ImGui::End();
+}
 
 /**
  * A convenience function to create a context for the specified window
@@ -26,11 +116,13 @@ typedef bool(initImgui_t)(SDL_Window*);
 typedef bool(processEvent_t)(SDL_Event*);
 typedef void(newFrame_t)(SDL_Window*);
 typedef void(shutdown_t)();
+typedef FrameRenderer::renderDrawData_t renderDrawData_t;
 
 static initImgui_t *initImgui;
 static processEvent_t *processEvent;
 static newFrame_t *newFrame;
 static shutdown_t *shutdown;
+static renderDrawData_t *renderDrawData;
 
 static SDL_GLContext createCtx(SDL_Window *w)
 {
@@ -98,6 +190,7 @@ static SDL_GLContext createCtx(SDL_Window *w)
         processEvent = ImGui_ImplSdlGLES3_ProcessEvent;
         newFrame = ImGui_ImplSdlGLES3_NewFrame;
         shutdown = ImGui_ImplSdlGLES3_Shutdown;
+        renderDrawData = ImGui_ImplSdlGLES3_RenderDrawData;
     }
     else
     {
@@ -107,12 +200,14 @@ static SDL_GLContext createCtx(SDL_Window *w)
         processEvent = ImGui_ImplSdlGLES2_ProcessEvent;
         newFrame = ImGui_ImplSdlGLES2_NewFrame;
         shutdown = ImGui_ImplSdlGLES2_Shutdown;
+        renderDrawData = ImGui_ImplSdlGLES2_RenderDrawData;
     }
 #else
     initImgui = ImGui_ImplSdlGL3_Init;
     processEvent = ImGui_ImplSdlGL3_ProcessEvent;
     newFrame = ImGui_ImplSdlGL3_NewFrame;
     shutdown = ImGui_ImplSdlGL3_Shutdown;
+    renderDrawData = ImGui_ImplSdlGL3_RenderDrawData;
 #endif
     Log(LOG_INFO) << "Finished initialization";
     return ctx;
@@ -121,6 +216,7 @@ static SDL_GLContext createCtx(SDL_Window *w)
 
 int main(int argc, char** argv)
 {
+    traceThreadName("main");
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 
     if (argc < 2)
@@ -148,11 +244,28 @@ int main(int argc, char** argv)
     Log(LOG_INFO) << "Creating SDL_Window";
     SDL_Window *window = SDL_CreateWindow("Demo App", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 800, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
     SDL_GLContext ctx = createCtx(window);
+    glExtInit();
+    // Compiled programs and traces are kept here; SDL picks a writable per-app location
+    std::string prefPath;
+    {
+        char* path = SDL_GetPrefPath("sfalexrog", "imguidemo");
+        if (path != NULL)
+        {
+            prefPath = path;
+            SDL_free(path);
+        }
+        programCacheInit(path != NULL ? prefPath.c_str() : NULL);
+        prefilterCacheInit(path != NULL ? prefPath.c_str() : NULL);
+    }
     initImgui(window);
 
+    // The UI is laid out before the scene is drawn (so opaque windows can hide parts of it),
+    // but drawn after it; ImGui::Render() only builds the draw data, renderDrawData() draws it
+    ImGuiIO& io = ImGui::GetIO();
+    io.RenderDrawListsFn = NULL;
+
     // Load Fonts
     // (there is a default font, this is only if you want to change it. see extra_fonts/README.txt for more details)
-    ImGuiIO& io = ImGui::GetIO();
     //io.Fonts->AddFontDefault();
     //io.Fonts->AddFontFromFileTTF("../../extra_fonts/Cousine-Regular.ttf", 15.0f);
     //io.Fonts->AddFontFromFileTTF("../../extra_fonts/DroidSans.ttf", 16.0f);
@@ -168,59 +281,96 @@ int main(int argc, char** argv)
         bool done = false;
         float teapotRotation = 0;
         bool rotateSync = false;
+        bool stressTest = false;
+        int stressCount = 1000;
+        int stressCountApplied = 0;
+        bool frustumCulling = true;
+        bool occlusionCulling = false;
+        bool meshLod = true;
+        float lodErrorPixels = 2.0f;
+        bool depthPrepass = false;
+        const int prepassBenchmarkFrames = 120;
+        bool opaqueWindows = false;
+        const float windowBgAlpha = ImGui::GetStyle().Colors[ImGuiCol_WindowBg].w;
+        bool uiOcclusion = true;
+
+        bool saveTrace = false;
 
         Teapot teapot;
-        teapot.init();
-
-        int deltaX = 0, deltaY = 0;
-        int prevX , prevY;
-        SDL_GetMouseState(&prevX, &prevY);
+        {
+            TRACE_SCOPE("Teapot::init");
+            teapot.init();
+        }
+        unsigned shaderFeatures = teapot.shaderFeatures();
+        float roughness = 0.3f;
+        bool dynamicReflections = false;
+        // One face a frame refreshes the whole cubemap every six frames
+        int reflectionFacesPerFrame = 1;
+
+        InputPump input(processEvent);
+        InputFrame frameInput;
+        // Camera motion is collected as it comes in, and applied right before the scene is drawn
+        InputLatch cameraInput;
+
+        // From here on the teapot belongs to the renderer; the UI talks to it through submissions
+        FrameRenderer renderer(window, ctx, teapot, cameraInput, renderDrawData);
+        bool renderThread = false;
+        // Fewer frames in flight means less input lag but more time where the CPU and GPU wait for each other
+        int framesInFlight = 2;
+        FrameScheduler scheduler;
+        float targetFps = 0.0f;
+        // Index into swapModes, which is swap interval + 1
+        const char* swapModes[] = {"Adaptive vsync", "Off", "Vsync"};
+        bool dynamicResolution = false;
+        float resolutionScale = 1.0f;
+        float minResolutionScale = 0.5f;
+        // A bit under a 60 Hz frame, to leave some room for the rest of the system
+        float gpuBudgetMs = 14.0f;
+        int upscaleFilter = Upscaler::FILTER_SHARPEN;
+        const char* upscaleFilters[] = {"Bilinear", "Sharpen"};
+        float sharpness = 0.5f;
+        bool cacheScene = false;
+        bool showViewports = false;
+        bool sceneBehindUi = true;
+        int viewportCount = 4;
+        viewportSettings viewports[maxViewports];
+        for (int i = 0; i < maxViewports; ++i)
+        {
+            // Spread around the teapot; the first one orbits at a limited rate, the rest stay put
+            viewports[i].resolutionScale = 1.0f;
+            viewports[i].maxUpdateHz = i == 0 ? 15.0f : 0.0f;
+            viewports[i].orbitSpeed = i == 0 ? 0.5f : 0.0f;
+            viewports[i].camera.camRX = std::fmod(i * (float) M_PI_2, (float) (2 * M_PI));
+            viewports[i].camera.camRY = i % 2 ? 0.8f : 0.3f;
+            viewports[i].camera.zoom = 1.0f;
+        }
+        bool firstFrame = true;
+        SceneStatus scene = renderer.status();
+        int swapMode = scene.swapInterval < 0 ? 0 : scene.swapInterval > 0 ? 2 : 1;
 
         while (!done) {
-            SDL_Event e;
-
-            deltaX = 0;
-            deltaY = 0;
-
-            float deltaZoom = 0.0f;
-
-            while (SDL_PollEvent(&e)) {
-                bool handledByImGui = processEvent(&e);
-                {
-                    switch (e.type) {
-                        case SDL_QUIT:
-                            done = true;
-                            break;
-                        case SDL_MOUSEBUTTONDOWN:
-                            prevX = e.button.x;
-                            prevY = e.button.y;
-                            break;
-                        case SDL_MOUSEMOTION:
-                            if (e.motion.state & SDL_BUTTON_LMASK) {
-                                deltaX += prevX - e.motion.x;
-                                deltaY += prevY - e.motion.y;
-                                prevX = e.motion.x;
-                                prevY = e.motion.y;
-                            }
-                            break;
-                        case SDL_MULTIGESTURE:
-                            if (e.mgesture.numFingers > 1) {
-                                deltaZoom += e.mgesture.dDist * 10.0f;
-                            }
-                            break;
-                        case SDL_MOUSEWHEEL:
-                            deltaZoom += e.wheel.y / 100.0f;
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            }
+            // Input is read right after this, so the later the wakeup, the fresher the input
+            scheduler.setTargetFps(targetFps);
+            scheduler.waitForFrame();
+            traceBegin("frame");
+            traceBegin("events");
+            input.pump(frameInput);
+            done = frameInput.quit;
+            traceCounter("input events", frameInput.received);
+            traceCounter("input events dispatched", frameInput.dispatched);
             if (io.WantTextInput) {
                 SDL_StartTextInput();
             } else {
                 SDL_StopTextInput();
             }
+            traceEnd("events");
+            traceBegin("ui");
+            // Switched between frames; the first one has to be drawn here, since the backend
+            // creates its device objects in newFrame() and needs the context for that
+            if (!firstFrame)
+                renderer.setThreaded(renderThread);
+            scene = renderer.status();
+            FrameSubmission& frame = renderer.beginFrame();
             newFrame(window);
             // 1. Show a simple window
             // Tip: if we don't call ImGui::Begin()/ImGui::End() the widgets appears in a window automatically called "Debug"
@@ -254,30 +404,267 @@ int main(int argc, char** argv)
                 ImGui::Begin("Teapot controls");
                 ImGui::SliderFloat("Teapot rotation", &teapotRotation, 0, 2 * M_PI);
                 ImGui::Checkbox("Rotate synchronously", &rotateSync);
-                ImGui::Text("Zoom value: %f", teapot.zoomValue());
+                ImGui::Text("Zoom value: %f", scene.zoom);
+                ImGui::Checkbox("Stress test", &stressTest);
+                ImGui::SliderInt("Teapot count", &stressCount, 1, 10000);
+                ImGui::Text("Instancing: %s, teapots: %d", glCaps().instancing ? "yes" : "no", scene.instanceCount);
+                ImGui::CheckboxFlags("Bump mapping", &shaderFeatures, Teapot::SHADER_BUMP);
+                ImGui::CheckboxFlags("Reflections", &shaderFeatures, Teapot::SHADER_REFLECTION);
+                ImGui::CheckboxFlags("Fog", &shaderFeatures, Teapot::SHADER_FOG);
+                if (scene.roughReflectionsSupported)
+                {
+                    ImGui::CheckboxFlags("Rough reflections", &shaderFeatures, Teapot::SHADER_ROUGH);
+                    if (shaderFeatures & Teapot::SHADER_ROUGH)
+                    {
+                        ImGui::SliderFloat("Roughness", &roughness, 0.0f, 1.0f);
+                    }
+                }
+                ImGui::Checkbox("Depth pre-pass", &depthPrepass);
+                // The same scene and camera, a fixed number of frames with the pre-pass off, then on
+                frame.prepassBenchmarkFrames = 0;
+                frame.cancelPrepassBenchmark = false;
+                if (scene.prepassBenchmarkRunning)
+                {
+                    ImGui::Text("Benchmarking: %d of %d frames", scene.prepassBenchmarkProgress,
+                                scene.prepassBenchmarkTotal);
+                    ImGui::SameLine();
+                    frame.cancelPrepassBenchmark = ImGui::Button("Cancel");
+                }
+                else if (scene.frameTiming.gpuTimes && sceneBehindUi)
+                {
+                    if (ImGui::Button("Benchmark pre-pass"))
+                        frame.prepassBenchmarkFrames = prepassBenchmarkFrames;
+                }
+                else
+                {
+                    ImGui::TextDisabled("Pre-pass benchmark: needs GPU times and the scene behind the UI");
+                }
+                const ToggleBenchmarkResult& prepassResult = scene.prepassBenchmark;
+                if (prepassResult.abortReason != NULL && !scene.prepassBenchmarkRunning)
+                {
+                    ImGui::TextDisabled("Benchmark stopped: %s", prepassResult.abortReason);
+                }
+                else if (prepassResult.valid && !scene.prepassBenchmarkRunning)
+                {
+                    const float difference = prepassResult.onMs - prepassResult.offMs;
+                    ImGui::Text("GPU frame time off: %.2f ms, on: %.2f ms", prepassResult.offMs, prepassResult.onMs);
+                    ImGui::Text("Difference: %+.2f ms (%+.0f%%)", difference,
+                                prepassResult.offMs > 0.0f ? 100.0f * difference / prepassResult.offMs : 0.0f);
+                }
+                ImGui::Checkbox("Reflect the scene", &dynamicReflections);
+                if (dynamicReflections)
+                {
+                    ImGui::SliderInt("Cubemap faces per frame", &reflectionFacesPerFrame, 1, EnvironmentProbe::faceCount);
+                    ImGui::Text("Faces redrawn last frame: %d", scene.reflectionFacesUpdated);
+                }
                 ImGui::End();
             }
 
+            // 5. Culling settings and what they did last frame
+            {
+                ImGui::Begin("Culling");
+                ImGui::Checkbox("Frustum culling", &frustumCulling);
+                if (scene.occlusionCullingSupported)
+                {
+                    ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+                }
+                else
+                {
+                    ImGui::TextDisabled("Occlusion culling: not supported");
+                }
+                const Teapot::CullingStats& cullStats = scene.culling;
+                ImGui::Text("Objects: %d", cullStats.objects);
+                ImGui::Text("Frustum culled: %d", cullStats.frustumCulled);
+                ImGui::Text("Drawn: %d", cullStats.drawn);
+                if (occlusionCulling)
+                {
+                    ImGui::Text("Occluded clusters: %d of %d", cullStats.occludedClusters, cullStats.queriedClusters);
+                }
+                if (scene.lodLevels > 1)
+                {
+                    ImGui::Checkbox("Mesh LOD", &meshLod);
+                    if (meshLod)
+                    {
+                        ImGui::SliderFloat("LOD error (pixels)", &lodErrorPixels, 0.25f, 8.0f);
+                    }
+                }
+                else
+                {
+                    ImGui::TextDisabled("Mesh LOD: no levels in the mesh");
+                }
+                const int fullTriangles = cullStats.triangles + cullStats.trianglesSaved;
+                ImGui::Text("Triangles: %d, saved by LOD: %d (%.0f%%)", cullStats.triangles, cullStats.trianglesSaved,
+                            fullTriangles > 0 ? 100.0f * cullStats.trianglesSaved / fullTriangles : 0.0f);
+                if (ImGui::Checkbox("Opaque windows", &opaqueWindows))
+                    ImGui::GetStyle().Colors[ImGuiCol_WindowBg].w = opaqueWindows ? 1.0f : windowBgAlpha;
+                ImGui::Checkbox("Skip scene under opaque windows", &uiOcclusion);
+                ImGui::Text("Opaque window rects: %d", (int) frame.uiOccluders.size());
+                ImGui::End();
+            }
 
-            // Rendering
-            glViewport(0, 0, (int) ImGui::GetIO().DisplaySize.x, (int) ImGui::GetIO().DisplaySize.y);
-            glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            // 6. Tracing
+            {
+                ImGui::Begin("Tracing");
+                bool tracing = traceEnabled();
+                if (ImGui::Checkbox("Record trace", &tracing))
+                    traceSetEnabled(tracing);
+                if (ImGui::Button("Save trace"))
+                    saveTrace = true;
+                ImGui::Text("Dropped events: %llu", (unsigned long long) traceDropped());
+                ImGui::End();
+            }
 
-            teapot.rotateTo(teapotRotation);
-            if (rotateSync)
-                teapot.rotateCameraTo(teapotRotation);
+            // 7. Frame pipelining
+            {
+                ImGui::Begin("Rendering");
+                ImGui::Checkbox("Render on a separate thread", &renderThread);
+                ImGui::TextDisabled("Frame N is drawn while frame N+1 is being built");
+                if (scene.frameLimiterSupported)
+                {
+                    ImGui::SliderInt("Frames in flight", &framesInFlight, 1, FrameLimiter::maxFramesInFlight);
+                    ImGui::Text("CPU waiting for GPU: %.2f ms", scene.frameTiming.cpuWaitMs);
+                    if (scene.frameTiming.gpuTimes)
+                    {
+                        ImGui::Text("GPU waiting for CPU: %.2f ms", scene.frameTiming.gpuWaitMs);
+                        ImGui::Text("GPU frame time: %.2f ms", scene.frameTiming.gpuFrameMs);
+                    }
+                    else
+                    {
+                        ImGui::TextDisabled("GPU times: no timer queries");
+                    }
+                }
+                else
+                {
+                    ImGui::TextDisabled("Frames in flight: no fences, left to the driver");
+                }
 
-            if (!ImGui::IsMouseHoveringAnyWindow())
+                ImGui::Separator();
+                ImGui::SliderFloat("Target FPS", &targetFps, 0.0f, 240.0f, targetFps > 0.0f ? "%.0f" : "off");
+                ImGui::Combo("Swap interval", &swapMode, swapModes, IM_ARRAYSIZE(swapModes));
+                // The status lags a frame or two behind the combo; only a fallback for this very mode counts
+                if (scene.swapIntervalRequested == swapMode - 1 && scene.swapInterval != scene.swapIntervalRequested &&
+                    scene.swapInterval >= -1 && scene.swapInterval <= 1)
+                {
+                    ImGui::TextDisabled("Not supported, using: %s", swapModes[scene.swapInterval + 1]);
+                }
+                const FrameTimeStats& frameTimes = scheduler.stats();
+                ImGui::Text("Frame time: %.2f ms (%.2f - %.2f)", frameTimes.meanMs, frameTimes.minMs, frameTimes.maxMs);
+                ImGui::Text("Variance: %.3f ms^2", frameTimes.varianceMs2);
+                ImGui::PlotLines("##frame times", scheduler.history(), scheduler.historyLength(),
+                                 scheduler.historyOffset(), NULL, 0.0f, 2.0f * frameTimes.meanMs, ImVec2(0, 60));
+
+                ImGui::Separator();
+                // The scale follows GPU frame times, so it needs timer queries
+                if (scene.frameLimiterSupported && scene.frameTiming.gpuTimes)
+                {
+                    ImGui::Checkbox("Dynamic resolution", &dynamicResolution);
+                }
+                else
+                {
+                    ImGui::TextDisabled("Dynamic resolution: no GPU times");
+                    dynamicResolution = false;
+                }
+                if (dynamicResolution)
+                {
+                    ImGui::SliderFloat("GPU budget (ms)", &gpuBudgetMs, 4.0f, 33.0f, "%.1f");
+                    ImGui::SliderFloat("Minimum scale", &minResolutionScale, 0.25f, 1.0f, "%.2f");
+                }
+                else
+                {
+                    ImGui::SliderFloat("Resolution scale", &resolutionScale, 0.25f, 1.0f, "%.2f");
+                }
+                ImGui::Combo("Upscale filter", &upscaleFilter, upscaleFilters, IM_ARRAYSIZE(upscaleFilters));
+                if (upscaleFilter == Upscaler::FILTER_SHARPEN)
+                    ImGui::SliderFloat("Sharpness", &sharpness, 0.0f, 1.0f, "%.2f");
+                ImGui::Text("Scene: %dx%d (%.0f%%)", scene.sceneWidth, scene.sceneHeight, scene.resolutionScale * 100.0f);
+                ImGui::Checkbox("Redraw scene only when it changes", &cacheScene);
+                ImGui::Text("Frames that reused the scene: %u", scene.cachedFrames);
+                ImGui::End();
+            }
+
+            // 8. Scene views inside the UI, each with a render target of its own
+            {
+                ImGui::Begin("Viewports");
+                ImGui::Checkbox("Show viewports", &showViewports);
+                ImGui::SliderInt("Viewport count", &viewportCount, 1, maxViewports);
+                ImGui::Checkbox("Scene behind the UI", &sceneBehindUi);
+                ImGui::End();
+            }
+            frame.viewports.clear();
+            if (showViewports)
             {
-                if (std::abs(deltaZoom) > 0.001f)
-                    teapot.zoomBy(deltaZoom);
-                if ((deltaX != 0) || (deltaY != 0))
-                    teapot.rotateCameraBy(deltaX * 0.005f, deltaY * 0.005f);
+                const float time = SDL_GetTicks() * 0.001f;
+                for (int i = 0; i < viewportCount; ++i)
+                {
+                    viewportWindow(i, viewports[i], scene.viewports[i], time, io.DisplayFramebufferScale,
+                                   frame.viewports);
+                }
             }
-            teapot.draw();
+
+            frame.instancesChanged = false;
+            if (stressTest && stressCount != stressCountApplied)
+            {
+                frame.instances = stressGrid(stressCount);
+                frame.instancesChanged = true;
+                stressCountApplied = stressCount;
+            }
+            else if (!stressTest && stressCountApplied != 0)
+            {
+                frame.instances.clear();
+                frame.instancesChanged = true;
+                stressCountApplied = 0;
+            }
+
+
             ImGui::Render();
-            SDL_GL_SwapWindow(window);
+            frame.drawData = ImGui::GetDrawData();
+            frame.displaySize = io.DisplaySize;
+            frame.framebufferScale = io.DisplayFramebufferScale;
+            frame.uiOccluders.clear();
+            if (uiOcclusion)
+            {
+                collectUiOccluders(frame.drawData, frame.uiOccluders);
+            }
+
+            frame.clearColor = clear_color;
+            frame.viewportWidth = (int) (io.DisplaySize.x * io.DisplayFramebufferScale.x);
+            frame.viewportHeight = (int) (io.DisplaySize.y * io.DisplayFramebufferScale.y);
+            frame.dynamicResolution = dynamicResolution;
+            frame.resolutionScale = resolutionScale;
+            frame.minResolutionScale = minResolutionScale;
+            frame.gpuBudgetMs = gpuBudgetMs;
+            frame.upscaleFilter = upscaleFilter;
+            frame.sharpness = sharpness;
+            frame.cacheScene = cacheScene;
+            frame.sceneBehindUi = sceneBehindUi;
+            frame.teapotRotation = teapotRotation;
+            frame.rotateSync = rotateSync;
+            frame.cameraInput = !ImGui::IsMouseHoveringAnyWindow();
+            frame.frustumCulling = frustumCulling;
+            frame.occlusionCulling = occlusionCulling;
+            frame.meshLod = meshLod;
+            frame.lodErrorPixels = lodErrorPixels;
+            frame.depthPrepass = depthPrepass;
+            frame.shaderFeatures = shaderFeatures;
+            frame.roughness = roughness;
+            frame.dynamicReflections = dynamicReflections;
+            frame.reflectionFacesPerFrame = reflectionFacesPerFrame;
+            frame.framesInFlight = framesInFlight;
+            frame.swapInterval = swapMode - 1;
+            traceEnd("ui");
+
+            renderer.submitFrame();
+            firstFrame = false;
+            traceEnd("frame");
+
+            if (saveTrace)
+            {
+                // Outside of the frame event, so that it isn't split between two files
+                char name[48];
+                snprintf(name, sizeof(name), "trace-%u.json", (unsigned) SDL_GetTicks());
+                traceWrite((prefPath + name).c_str());
+                saveTrace = false;
+            }
         }
     }
     shutdown();
@@ -0,0 +1,258 @@
+//
+// Binary mesh files with vertex and index data stored exactly as they are uploaded to GL.
+//
+
+#include "mesh_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logger.h"
+
+/**
+ * @return Size of one element of a block of the given type, 0 for types this version doesn't know
+ */
+static uint64_t blockElementSize(uint32_t type)
+{
+    switch (type)
+    {
+        case MESH_BLOCK_VERTICES_PACKED: return sizeof(PackedVertex);
+        case MESH_BLOCK_VERTICES_FLOAT: return sizeof(FloatVertex);
+        case MESH_BLOCK_INDICES_U16: return sizeof(uint16_t);
+        case MESH_BLOCK_INDICES_U32: return sizeof(uint32_t);
+        case MESH_BLOCK_LODS: return sizeof(MeshFileLod);
+        case MESH_BLOCK_POSITIONS_PACKED: return sizeof(PackedVertex::pos);
+        case MESH_BLOCK_POSITIONS_FLOAT: return sizeof(FloatVertex::pos);
+        default: return 0;
+    }
+}
+
+MeshFile::MeshFile() : data(NULL), size(0) { }
+
+MeshFile::~MeshFile()
+{
+    close();
+}
+
+bool MeshFile::open(const char* path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        Log(LOG_ERROR) << "Could not open mesh file " << path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MeshFileHeader))
+    {
+        Log(LOG_ERROR) << "Mesh file " << path << " is too small";
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        Log(LOG_ERROR) << "Could not map mesh file " << path;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    size = (size_t)st.st_size;
+
+    const MeshFileHeader& hdr = header();
+    if (memcmp(hdr.magic, meshFileMagic, sizeof(meshFileMagic)) != 0 || hdr.version != meshFileVersion)
+    {
+        Log(LOG_ERROR) << "Mesh file " << path << " has wrong magic or version";
+        close();
+        return false;
+    }
+    if (sizeof(MeshFileHeader) + (uint64_t)hdr.blockCount * sizeof(MeshFileBlock) > size)
+    {
+        Log(LOG_ERROR) << "Mesh file " << path << " is truncated";
+        close();
+        return false;
+    }
+    const MeshFileBlock* blocks = reinterpret_cast<const MeshFileBlock*>(data + sizeof(MeshFileHeader));
+    for (uint32_t i = 0; i < hdr.blockCount; ++i)
+    {
+        const MeshFileBlock& block = blocks[i];
+        const uint64_t elementSize = blockElementSize(block.type);
+        // Blocks have to lie within the file (checked so a huge offset can't wrap around), and those
+        // of known types have to hold exactly count elements, since readers take the count as is
+        if (block.offset % meshFileAlignment != 0 || block.offset > size || block.size > size - block.offset ||
+            (elementSize != 0 && (uint64_t)block.count * elementSize != block.size))
+        {
+            Log(LOG_ERROR) << "Mesh file " << path << " has an invalid block " << i;
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshFile::close()
+{
+    if (data)
+    {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+    data = NULL;
+    size = 0;
+}
+
+const MeshFileHeader& MeshFile::header() const
+{
+    return *reinterpret_cast<const MeshFileHeader*>(data);
+}
+
+const MeshFileBlock* MeshFile::findBlock(uint32_t type) const
+{
+    if (!data)
+    {
+        return NULL;
+    }
+    const MeshFileBlock* blocks = reinterpret_cast<const MeshFileBlock*>(data + sizeof(MeshFileHeader));
+    for (uint32_t i = 0; i < header().blockCount; ++i)
+    {
+        if (blocks[i].type == type)
+        {
+            return &blocks[i];
+        }
+    }
+    return NULL;
+}
+
+const void* MeshFile::blockData(const MeshFileBlock& block) const
+{
+    return data + block.offset;
+}
+
+namespace {
+    struct PackedPosition {
+        uint16_t pos[4];
+    };
+
+    struct FloatPosition {
+        float pos[3];
+    };
+
+    struct PendingBlock {
+        MeshFileBlock desc;
+        const void* data;
+    };
+
+    template<typename T>
+    PendingBlock makeBlock(uint32_t type, const std::vector<T>& elements)
+    {
+        PendingBlock block;
+        block.desc.type = type;
+        block.desc.count = (uint32_t)elements.size();
+        block.desc.offset = 0;
+        block.desc.size = elements.size() * sizeof(T);
+        block.data = elements.data();
+        return block;
+    }
+}
+
+bool writeMeshFile(const char* path, const std::vector<SourceVertex>& vertices, const std::vector<uint32_t>& indices,
+                   const std::vector<MeshFileLod>& lods)
+{
+    MeshFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, meshFileMagic, sizeof(meshFileMagic));
+    hdr.version = meshFileVersion;
+    for (int c = 0; c < 3; ++c)
+    {
+        hdr.boundsMin[c] = vertices.empty() ? 0.0f : vertices[0].pos[c];
+        hdr.boundsMax[c] = hdr.boundsMin[c];
+    }
+    for (const auto& v : vertices)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            hdr.boundsMin[c] = std::min(hdr.boundsMin[c], v.pos[c]);
+            hdr.boundsMax[c] = std::max(hdr.boundsMax[c], v.pos[c]);
+        }
+    }
+
+    std::vector<PackedVertex> packed(vertices.size());
+    std::vector<FloatVertex> floats(vertices.size());
+    // Copied from the full vertices, so depth-only passes get exactly the same positions
+    std::vector<PackedPosition> packedPositions(vertices.size());
+    std::vector<FloatPosition> floatPositions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        packVertex(vertices[i], packed[i]);
+        packVertex(vertices[i], floats[i]);
+        memcpy(packedPositions[i].pos, packed[i].pos, sizeof(packed[i].pos));
+        memcpy(floatPositions[i].pos, floats[i].pos, sizeof(floats[i].pos));
+    }
+
+    std::vector<PendingBlock> blocks;
+    blocks.push_back(makeBlock(MESH_BLOCK_VERTICES_PACKED, packed));
+    blocks.push_back(makeBlock(MESH_BLOCK_VERTICES_FLOAT, floats));
+    blocks.push_back(makeBlock(MESH_BLOCK_POSITIONS_PACKED, packedPositions));
+    blocks.push_back(makeBlock(MESH_BLOCK_POSITIONS_FLOAT, floatPositions));
+
+    std::vector<uint16_t> shortIndices;
+    if (vertices.size() <= 0x10000)
+    {
+        shortIndices.assign(indices.begin(), indices.end());
+        blocks.push_back(makeBlock(MESH_BLOCK_INDICES_U16, shortIndices));
+    }
+    else
+    {
+        blocks.push_back(makeBlock(MESH_BLOCK_INDICES_U32, indices));
+    }
+    if (!lods.empty())
+    {
+        blocks.push_back(makeBlock(MESH_BLOCK_LODS, lods));
+    }
+    hdr.blockCount = (uint32_t)blocks.size();
+
+    uint64_t offset = sizeof(MeshFileHeader) + blocks.size() * sizeof(MeshFileBlock);
+    for (auto& block : blocks)
+    {
+        offset = (offset + meshFileAlignment - 1) / meshFileAlignment * meshFileAlignment;
+        block.desc.offset = offset;
+        offset += block.desc.size;
+    }
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        Log(LOG_ERROR) << "Could not open " << path << " for writing";
+        return false;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (const auto& block : blocks)
+    {
+        ok = ok && fwrite(&block.desc, sizeof(block.desc), 1, f) == 1;
+    }
+    const char padding[meshFileAlignment] = {0};
+    for (const auto& block : blocks)
+    {
+        long position = ftell(f);
+        if (position < 0 || (uint64_t)position > block.desc.offset)
+        {
+            ok = false;
+            break;
+        }
+        size_t padSize = (size_t)(block.desc.offset - (uint64_t)position);
+        ok = ok && (padSize == 0 || fwrite(padding, padSize, 1, f) == 1);
+        ok = ok && (block.desc.size == 0 || fwrite(block.data, (size_t)block.desc.size, 1, f) == 1);
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        Log(LOG_ERROR) << "Could not write mesh file " << path;
+    }
+    return ok;
+}
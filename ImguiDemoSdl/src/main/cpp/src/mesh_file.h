@@ -0,0 +1,115 @@
+//
+// Binary mesh files with vertex and index data stored exactly as they are uploaded to GL.
+//
+// Layout (little-endian):
+//  - MeshFileHeader
+//  - MeshFileBlock[header.blockCount]
+//  - block data, each block starting at a multiple of meshFileAlignment
+//
+// A file may carry the same vertices in several layouts (see vertex_format.h), so that
+// every context can pick the one it can fetch and hand it to glBufferData without repacking.
+// Levels of detail share the vertices; their triangle lists follow each other in the index block,
+// the full mesh first, and the LOD block says where each one starts. Position blocks repeat the
+// positions of a vertex layout bit for bit, tightly packed, for passes that only need depth.
+//
+
+#ifndef IMGUI_DEMO_MESH_FILE_H
+#define IMGUI_DEMO_MESH_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "vertex_format.h"
+
+static const char meshFileMagic[4] = {'I', 'M', 'S', 'H'};
+static const uint32_t meshFileVersion = 2;
+static const uint32_t meshFileAlignment = 16;
+
+enum MeshBlockType : uint32_t {
+    MESH_BLOCK_VERTICES_PACKED = 1, // PackedVertex[]
+    MESH_BLOCK_VERTICES_FLOAT = 2,  // FloatVertex[]
+    MESH_BLOCK_INDICES_U16 = 3,     // uint16_t[] triangle list
+    MESH_BLOCK_INDICES_U32 = 4,     // uint32_t[] triangle list
+    MESH_BLOCK_LODS = 5,            // MeshFileLod[]; without it, the index block is a single level
+    MESH_BLOCK_POSITIONS_PACKED = 6, // uint16_t[4][], PackedVertex::pos of each vertex
+    MESH_BLOCK_POSITIONS_FLOAT = 7, // float[3][], FloatVertex::pos of each vertex
+};
+
+struct MeshFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t blockCount;
+    uint32_t reserved;
+    // Object-space bounding box of all vertices
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshFileBlock {
+    uint32_t type;
+    // Number of elements (vertices or indices) in the block
+    uint32_t count;
+    // Offset from the start of the file, a multiple of meshFileAlignment
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct MeshFileLod {
+    // Range in the index block
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // How far the level strays from the full mesh, in object space units
+    float error;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(MeshFileHeader) == 40, "MeshFileHeader must not have padding");
+static_assert(sizeof(MeshFileBlock) == 24, "MeshFileBlock must not have padding");
+static_assert(sizeof(MeshFileLod) == 16, "MeshFileLod must not have padding");
+
+/**
+ * Read-only view of a mesh file. The file is memory-mapped, so block data can be
+ * passed to GL directly and is only paged in when it's actually read.
+ */
+class MeshFile {
+public:
+    MeshFile();
+    ~MeshFile();
+
+    /**
+     * Map and validate a mesh file. Every block has to lie within the file, and blocks of the types
+     * above have to be exactly count elements large.
+     * @param path Path to the file
+     * @return false if the file could not be mapped or is not a valid mesh file
+     */
+    bool open(const char* path);
+    void close();
+
+    const MeshFileHeader& header() const;
+
+    /**
+     * @return Block descriptor for the given type, or NULL if the file does not have one
+     */
+    const MeshFileBlock* findBlock(uint32_t type) const;
+    const void* blockData(const MeshFileBlock& block) const;
+
+private:
+    MeshFile(const MeshFile&);
+    MeshFile& operator=(const MeshFile&);
+
+    const uint8_t* data;
+    size_t size;
+};
+
+/**
+ * Write a mesh file with both vertex layouts, the positions of each on their own, and the
+ * narrowest index type that fits.
+ * Vertices and indices are written as they are; run optimizeMesh() first if needed.
+ * @param lods Levels of detail in indices, the full mesh first; empty if indices is a single level
+ * @return false if the file could not be written
+ */
+bool writeMeshFile(const char* path, const std::vector<SourceVertex>& vertices, const std::vector<uint32_t>& indices,
+                   const std::vector<MeshFileLod>& lods);
+
+#endif //IMGUI_DEMO_MESH_FILE_H
@@ -0,0 +1,337 @@
+//
+// Index/vertex reordering for static indexed triangle meshes.
+//
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize)
+{
+    VertexCacheStats stats = {0.0f, 0.0f};
+    if (indexCount == 0 || vertexCount == 0)
+    {
+        return stats;
+    }
+
+    // A vertex is in the cache if it was added less than cacheSize misses ago
+    std::vector<size_t> timestamps(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t v = indices[i];
+        if (time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            ++misses;
+        }
+    }
+
+    size_t usedVertices = 0;
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        usedVertices += (timestamps[v] != 0) ? 1 : 0;
+    }
+
+    stats.acmr = (float)misses / (float)(indexCount / 3);
+    stats.atvr = usedVertices ? (float)misses / (float)usedVertices : 0.0f;
+    return stats;
+}
+
+namespace {
+    // Triangle adjacency in CSR form: triangles using vertex v are
+    // triangles[offsets[v]] .. triangles[offsets[v] + counts[v] - 1]
+    struct Adjacency {
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        Adjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+                : counts(vertexCount, 0), offsets(vertexCount, 0), triangles(indexCount)
+        {
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                counts[indices[i]]++;
+            }
+            uint32_t offset = 0;
+            for (size_t v = 0; v < vertexCount; ++v)
+            {
+                offsets[v] = offset;
+                offset += counts[v];
+            }
+            std::vector<uint32_t> fill(offsets);
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+            }
+        }
+    };
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize,
+                         std::vector<uint32_t>* clusters)
+{
+    if (clusters)
+    {
+        clusters->clear();
+    }
+    if (indexCount == 0 || vertexCount == 0)
+    {
+        return;
+    }
+
+    const size_t triangleCount = indexCount / 3;
+    Adjacency adjacency(indices, indexCount, vertexCount);
+
+    // Live triangles per vertex
+    std::vector<uint32_t> live(adjacency.counts);
+    std::vector<size_t> timestamps(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;
+    int64_t fanning = 0;
+    bool newCluster = true;
+
+    while (fanning >= 0)
+    {
+        if (newCluster && clusters)
+        {
+            clusters->push_back((uint32_t)(output.size() / 3));
+        }
+        newCluster = false;
+
+        // Emit all remaining triangles around the fanning vertex
+        candidates.clear();
+        uint32_t f = (uint32_t)fanning;
+        for (uint32_t a = 0; a < adjacency.counts[f]; ++a)
+        {
+            uint32_t t = adjacency.triangles[adjacency.offsets[f] + a];
+            if (emitted[t])
+            {
+                continue;
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                uint32_t v = indices[3 * t + c];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - timestamps[v] > cacheSize)
+                {
+                    timestamps[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // Pick the next fanning vertex: the oldest candidate that will still be in the
+        // cache after its remaining triangles are emitted
+        int64_t best = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if ((int64_t)(time - timestamps[v]) + 2 * (int64_t)live[v] <= (int64_t)cacheSize)
+            {
+                priority = (int64_t)(time - timestamps[v]);
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = v;
+            }
+        }
+
+        if (best < 0)
+        {
+            // Dead end: try recently used vertices first, then just scan for anything left
+            while (!deadEnds.empty())
+            {
+                uint32_t v = deadEnds.back();
+                deadEnds.pop_back();
+                if (live[v] > 0)
+                {
+                    best = v;
+                    break;
+                }
+            }
+            while (best < 0 && cursor < vertexCount)
+            {
+                if (live[cursor] > 0)
+                {
+                    best = (int64_t)cursor;
+                }
+                ++cursor;
+            }
+            newCluster = true;
+        }
+        fanning = best;
+    }
+
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+bool optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+                      size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.size() < 2)
+    {
+        return false;
+    }
+
+    const char* base = reinterpret_cast<const char*>(positions);
+    auto position = [&](uint32_t v) {
+        return reinterpret_cast<const float*>(base + v * positionStride);
+    };
+
+    struct ClusterInfo {
+        uint32_t begin;
+        uint32_t end;
+        float centroid[3];
+        float normal[3];
+        float area;
+        float sortKey;
+    };
+    std::vector<ClusterInfo> infos(clusters.size());
+
+    // Area-weighted centroid and normal for every cluster, and for the whole mesh
+    float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        ClusterInfo& info = infos[c];
+        info.begin = clusters[c];
+        info.end = (c + 1 < clusters.size()) ? clusters[c + 1] : (uint32_t)triangleCount;
+        memset(info.centroid, 0, sizeof(info.centroid));
+        memset(info.normal, 0, sizeof(info.normal));
+        info.area = 0.0f;
+
+        for (uint32_t t = info.begin; t < info.end; ++t)
+        {
+            const float* p0 = position(indices[3 * t]);
+            const float* p1 = position(indices[3 * t + 1]);
+            const float* p2 = position(indices[3 * t + 2]);
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            // Cross product length is twice the triangle area, which is fine as a weight
+            float n[3] = {
+                    e1[1] * e2[2] - e1[2] * e2[1],
+                    e1[2] * e2[0] - e1[0] * e2[2],
+                    e1[0] * e2[1] - e1[1] * e2[0]
+            };
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; ++k)
+            {
+                info.centroid[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * area;
+                info.normal[k] += n[k];
+            }
+            info.area += area;
+        }
+
+        if (info.area > 0.0f)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                meshCentroid[k] += info.centroid[k];
+                info.centroid[k] /= info.area;
+            }
+            meshArea += info.area;
+        }
+    }
+    if (meshArea > 0.0f)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            meshCentroid[k] /= meshArea;
+        }
+    }
+
+    for (auto& info : infos)
+    {
+        float length = std::sqrt(info.normal[0] * info.normal[0] + info.normal[1] * info.normal[1] + info.normal[2] * info.normal[2]);
+        info.sortKey = 0.0f;
+        if (length > 0.0f)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                info.sortKey += (info.centroid[k] - meshCentroid[k]) * info.normal[k] / length;
+            }
+        }
+    }
+
+    std::stable_sort(infos.begin(), infos.end(), [](const ClusterInfo& a, const ClusterInfo& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+    for (const auto& info : infos)
+    {
+        output.insert(output.end(), indices + 3 * info.begin, indices + 3 * info.end);
+    }
+
+    float acmrBefore = analyzeVertexCache(indices, indexCount, vertexCount).acmr;
+    float acmrAfter = analyzeVertexCache(output.data(), output.size(), vertexCount).acmr;
+    if (acmrAfter > acmrBefore * threshold)
+    {
+        return false;
+    }
+    memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+    return true;
+}
+
+size_t optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& remap)
+{
+    remap.assign(vertexCount, ~0u);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t& index = indices[i];
+        if (remap[index] == ~0u)
+        {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    return next;
+}
+
+MeshOptimizationReport optimizeMesh(std::vector<uint32_t>& indices, std::vector<SourceVertex>& vertices)
+{
+    const unsigned cacheSize = 16;
+    const float overdrawThreshold = 1.05f;
+    MeshOptimizationReport report;
+    report.overdrawOptimized = false;
+    report.before = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), cacheSize);
+    if (vertices.empty())
+    {
+        report.after = report.before;
+        return report;
+    }
+
+    std::vector<uint32_t> clusters;
+    optimizeVertexCache(indices.data(), indices.size(), vertices.size(), cacheSize, &clusters);
+    report.overdrawOptimized = optimizeOverdraw(indices.data(), indices.size(), vertices[0].pos, sizeof(SourceVertex),
+                                                vertices.size(), clusters, overdrawThreshold);
+
+    std::vector<uint32_t> remap;
+    size_t newVertexCount = optimizeVertexFetch(indices.data(), indices.size(), vertices.size(), remap);
+    vertices = remapVertices(vertices, remap, newVertexCount);
+
+    report.after = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), cacheSize);
+    return report;
+}
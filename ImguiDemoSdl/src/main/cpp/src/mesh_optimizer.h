@@ -0,0 +1,106 @@
+//
+// Index/vertex reordering for static indexed triangle meshes.
+// No GL dependencies here, so this can run at load time or in offline tools.
+//
+
+#ifndef IMGUI_DEMO_MESH_OPTIMIZER_H
+#define IMGUI_DEMO_MESH_OPTIMIZER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "vertex_format.h"
+
+/**
+ * Post-transform cache efficiency of an index buffer, measured on a simulated FIFO cache.
+ */
+struct VertexCacheStats {
+    // Average cache miss ratio: transformed vertices per triangle (0.5 is ideal, 3.0 is worst)
+    float acmr;
+    // Average transform to vertex ratio: transformed vertices per unique vertex (1.0 is ideal)
+    float atvr;
+};
+
+/**
+ * Simulate a FIFO post-transform cache over a triangle list
+ * @param indices Triangle list indices
+ * @param indexCount Number of indices (a multiple of 3)
+ * @param vertexCount Number of vertices referenced by the indices
+ * @param cacheSize Number of cache entries to simulate
+ * @return Cache statistics
+ */
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize = 16);
+
+/**
+ * Reorder triangles for post-transform cache locality (Tipsify; Sander, Nehab, Barczak 2007).
+ * @param indices Triangle list indices, reordered in place
+ * @param indexCount Number of indices (a multiple of 3)
+ * @param vertexCount Number of vertices referenced by the indices
+ * @param cacheSize Cache size to optimize for
+ * @param clusters If not NULL, receives the index of the first triangle of every cluster
+ *                 (a run of triangles that ended in a dead end); used by optimizeOverdraw
+ */
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize,
+                         std::vector<uint32_t>* clusters);
+
+/**
+ * Reorder clusters produced by optimizeVertexCache so that outward-facing clusters far from
+ * the mesh center come first; those tend to occlude the rest of the mesh. Triangle order within
+ * a cluster is kept, but cluster boundaries still cost some cache efficiency, so the new order
+ * is only kept if ACMR does not grow by more than the given factor.
+ * @param indices Triangle list indices, reordered in place
+ * @param indexCount Number of indices (a multiple of 3)
+ * @param positions Pointer to the first vertex position (three floats)
+ * @param positionStride Distance between consecutive positions, in bytes
+ * @param vertexCount Number of vertices referenced by the indices
+ * @param clusters Cluster starts as returned by optimizeVertexCache
+ * @param threshold Allowed ACMR growth, e.g. 1.05 for 5%
+ * @return true if the triangles were reordered
+ */
+bool optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+                      size_t vertexCount, const std::vector<uint32_t>& clusters, float threshold);
+
+/**
+ * Renumber vertices in the order they are first referenced, so vertex fetches walk memory linearly.
+ * Vertices that are not referenced at all are dropped.
+ * @param indices Triangle list indices, rewritten in place
+ * @param indexCount Number of indices
+ * @param vertexCount Number of vertices
+ * @param remap Receives the new index for every old vertex (~0u for dropped vertices)
+ * @return Number of vertices after remapping
+ */
+size_t optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& remap);
+
+/**
+ * Apply a remap table produced by optimizeVertexFetch to a vertex array
+ */
+template<typename T>
+std::vector<T> remapVertices(const std::vector<T>& vertices, const std::vector<uint32_t>& remap, size_t newVertexCount)
+{
+    std::vector<T> result(newVertexCount);
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        if (remap[i] != ~0u)
+        {
+            result[remap[i]] = vertices[i];
+        }
+    }
+    return result;
+}
+
+struct MeshOptimizationReport {
+    VertexCacheStats before;
+    VertexCacheStats after;
+    bool overdrawOptimized;
+};
+
+/**
+ * Run all of the above on a mesh: vertex cache, overdraw, then vertex fetch optimization.
+ * @param indices Triangle list indices, rewritten in place
+ * @param vertices Vertices, reordered (and possibly shrunk) in place
+ * @return Vertex cache statistics before and after optimization
+ */
+MeshOptimizationReport optimizeMesh(std::vector<uint32_t>& indices, std::vector<SourceVertex>& vertices);
+
+#endif //IMGUI_DEMO_MESH_OPTIMIZER_H
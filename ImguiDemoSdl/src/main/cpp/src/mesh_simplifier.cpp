@@ -0,0 +1,548 @@
+//
+// Quadric error metric edge collapse simplification.
+//
+// Works in passes: every edge that may be collapsed is costed, and the cheapest ones are collapsed,
+// as long as they don't touch each other; then costs are worked out again on the smaller mesh.
+// Collapses only ever move a vertex onto a neighbour, so the result uses the input's vertices.
+//
+
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    const uint32_t noVertex = ~0u;
+    // Border and seam edges get a plane of their own through the edge, weighted this much higher than
+    // the faces, so that collapses keep them in place
+    const double edgeWeight = 10.0;
+    // Same as optimizeMesh()
+    const unsigned cacheSize = 16;
+
+    enum VertexKind {
+        // Inside the surface, no twins: collapses onto any neighbour
+        KIND_MANIFOLD,
+        // On an open border: collapses along it
+        KIND_BORDER,
+        // Shares its position with exactly one twin that has other attributes: collapses along the
+        // seam, and the twin goes along
+        KIND_SEAM,
+        // Anything more complicated; stays where it is
+        KIND_LOCKED,
+        KIND_COUNT
+    };
+
+    // By kind of the vertex that moves, then kind of the one it moves onto
+    const bool canCollapse[KIND_COUNT][KIND_COUNT] = {
+            {true,  true,  true,  true},
+            {false, true,  false, false},
+            {false, false, true,  false},
+            {false, false, false, false}
+    };
+
+    /**
+     * Sum of squared distances to a set of planes: error(p) = p.A.p + 2 b.p + c, A symmetric.
+     * Planes are weighted by the area they stand for; dividing by the total weight gives
+     * something like the squared distance moved.
+     */
+    struct Quadric {
+        double a00, a11, a22, a10, a20, a21;
+        double b0, b1, b2;
+        double c;
+        double w;
+    };
+
+    void addPlane(Quadric& q, const double* n, double d, double weight)
+    {
+        q.a00 += weight * n[0] * n[0];
+        q.a11 += weight * n[1] * n[1];
+        q.a22 += weight * n[2] * n[2];
+        q.a10 += weight * n[1] * n[0];
+        q.a20 += weight * n[2] * n[0];
+        q.a21 += weight * n[2] * n[1];
+        q.b0 += weight * n[0] * d;
+        q.b1 += weight * n[1] * d;
+        q.b2 += weight * n[2] * d;
+        q.c += weight * d * d;
+        q.w += weight;
+    }
+
+    void addQuadric(Quadric& q, const Quadric& r)
+    {
+        q.a00 += r.a00;
+        q.a11 += r.a11;
+        q.a22 += r.a22;
+        q.a10 += r.a10;
+        q.a20 += r.a20;
+        q.a21 += r.a21;
+        q.b0 += r.b0;
+        q.b1 += r.b1;
+        q.b2 += r.b2;
+        q.c += r.c;
+        q.w += r.w;
+    }
+
+    double quadricError(const Quadric& q, const float* p)
+    {
+        const double x = p[0], y = p[1], z = p[2];
+        const double rx = q.a00 * x + q.a10 * y + q.a20 * z;
+        const double ry = q.a10 * x + q.a11 * y + q.a21 * z;
+        const double rz = q.a20 * x + q.a21 * y + q.a22 * z;
+        const double error = rx * x + ry * y + rz * z + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+        return q.w > 0.0 ? std::fabs(error) / q.w : 0.0;
+    }
+
+    void cross(const double* a, const double* b, double* result)
+    {
+        result[0] = a[1] * b[2] - a[2] * b[1];
+        result[1] = a[2] * b[0] - a[0] * b[2];
+        result[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    double normalize(double* v)
+    {
+        const double length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0.0)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+        return length;
+    }
+
+    /**
+     * Half-edges of a triangle list in CSR form: edges leaving vertex v end at
+     * targets[offsets[v]] .. targets[offsets[v + 1] - 1]
+     */
+    struct EdgeAdjacency {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> targets;
+
+        void build(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+        {
+            offsets.assign(vertexCount + 1, 0);
+            targets.resize(indexCount);
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                offsets[indices[i] + 1]++;
+            }
+            for (size_t v = 0; v < vertexCount; ++v)
+            {
+                offsets[v + 1] += offsets[v];
+            }
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t = 0; t < indexCount; t += 3)
+            {
+                for (int e = 0; e < 3; ++e)
+                {
+                    uint32_t from = indices[t + e];
+                    targets[fill[from]++] = indices[t + (e + 1) % 3];
+                }
+            }
+        }
+
+        bool has(uint32_t from, uint32_t to) const
+        {
+            for (uint32_t i = offsets[from]; i < offsets[from + 1]; ++i)
+            {
+                if (targets[i] == to)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    /**
+     * Triangles around each position in CSR form, where positions are the remap[] targets
+     */
+    struct PositionTriangles {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        void build(const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap)
+        {
+            offsets.assign(remap.size() + 1, 0);
+            triangles.resize(indexCount);
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                offsets[remap[indices[i]] + 1]++;
+            }
+            for (size_t v = 0; v < remap.size(); ++v)
+            {
+                offsets[v + 1] += offsets[v];
+            }
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                triangles[fill[remap[indices[i]]]++] = (uint32_t) (i / 3);
+            }
+        }
+    };
+
+    struct EdgeCollapse {
+        uint32_t from;
+        uint32_t to;
+        double cost;
+    };
+}
+
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions,
+                    size_t positionStride, size_t vertexCount, size_t targetIndexCount, float* error)
+{
+    const char* base = reinterpret_cast<const char*>(positions);
+    auto position = [&](uint32_t v) {
+        return reinterpret_cast<const float*>(base + v * positionStride);
+    };
+
+    // Vertices at the same position: remap points at the first one of them, wedge goes round all of them
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint32_t> wedge(vertexCount);
+    {
+        std::vector<uint32_t> order(vertexCount);
+        std::iota(order.begin(), order.end(), 0u);
+        auto less = [&](uint32_t a, uint32_t b) {
+            const float* pa = position(a);
+            const float* pb = position(b);
+            return std::lexicographical_compare(pa, pa + 3, pb, pb + 3);
+        };
+        std::sort(order.begin(), order.end(), less);
+        for (size_t i = 0; i < vertexCount;)
+        {
+            size_t end = i + 1;
+            while (end < vertexCount && !less(order[i], order[end]))
+            {
+                ++end;
+            }
+            for (size_t j = i; j < end; ++j)
+            {
+                remap[order[j]] = order[i];
+                wedge[order[j]] = order[j + 1 < end ? j + 1 : i];
+            }
+            i = end;
+        }
+    }
+
+    // Open edges have no opposite half-edge; loop and loopback follow them out of and into each vertex
+    EdgeAdjacency adjacency;
+    adjacency.build(indices, indexCount, vertexCount);
+    std::vector<uint32_t> loop(vertexCount, noVertex);
+    std::vector<uint32_t> loopback(vertexCount, noVertex);
+    std::vector<uint8_t> openOut(vertexCount, 0);
+    std::vector<uint8_t> openIn(vertexCount, 0);
+    for (size_t t = 0; t < indexCount; t += 3)
+    {
+        for (int e = 0; e < 3; ++e)
+        {
+            uint32_t a = indices[t + e];
+            uint32_t b = indices[t + (e + 1) % 3];
+            if (!adjacency.has(b, a))
+            {
+                loop[a] = b;
+                loopback[b] = a;
+                openOut[a] = (uint8_t) std::min(openOut[a] + 1, 2);
+                openIn[b] = (uint8_t) std::min(openIn[b] + 1, 2);
+            }
+        }
+    }
+
+    std::vector<uint8_t> kind(vertexCount, KIND_LOCKED);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        const bool oneOpenEdge = openOut[v] == 1 && openIn[v] == 1;
+        if (wedge[v] == v)
+        {
+            if (openOut[v] == 0 && openIn[v] == 0)
+            {
+                kind[v] = KIND_MANIFOLD;
+            }
+            else if (oneOpenEdge)
+            {
+                kind[v] = KIND_BORDER;
+            }
+        }
+        else if (wedge[wedge[v]] == v)
+        {
+            // The two sides of a seam see the same edges, going the other way round
+            const uint32_t w = wedge[v];
+            if (oneOpenEdge && openOut[w] == 1 && openIn[w] == 1 &&
+                remap[loop[v]] == remap[loopback[w]] && remap[loopback[v]] == remap[loop[w]])
+            {
+                kind[v] = KIND_SEAM;
+            }
+        }
+    }
+
+    // One quadric per position, with the planes of the faces around it and of its border and seam edges
+    std::vector<Quadric> quadrics(vertexCount);
+    for (Quadric& q : quadrics)
+    {
+        q = Quadric();
+    }
+    for (size_t t = 0; t < indexCount; t += 3)
+    {
+        const float* p[3] = {position(indices[t]), position(indices[t + 1]), position(indices[t + 2])};
+        double e1[3], e2[3], normal[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            e1[c] = p[1][c] - p[0][c];
+            e2[c] = p[2][c] - p[0][c];
+        }
+        cross(e1, e2, normal);
+        const double area = 0.5 * normalize(normal);
+        if (area == 0.0)
+        {
+            continue;
+        }
+        const double d = -(normal[0] * p[0][0] + normal[1] * p[0][1] + normal[2] * p[0][2]);
+        for (int k = 0; k < 3; ++k)
+        {
+            addPlane(quadrics[remap[indices[t + k]]], normal, d, area);
+        }
+
+        for (int e = 0; e < 3; ++e)
+        {
+            uint32_t a = indices[t + e];
+            uint32_t b = indices[t + (e + 1) % 3];
+            if (remap[a] == remap[b] || adjacency.has(b, a))
+            {
+                continue;
+            }
+            const float* pa = position(a);
+            const float* pb = position(b);
+            double edge[3] = {(double) pb[0] - pa[0], (double) pb[1] - pa[1], (double) pb[2] - pa[2]};
+            const double length = normalize(edge);
+            double edgeNormal[3];
+            cross(edge, normal, edgeNormal);
+            normalize(edgeNormal);
+            const double edgeD = -(edgeNormal[0] * pa[0] + edgeNormal[1] * pa[1] + edgeNormal[2] * pa[2]);
+            addPlane(quadrics[remap[a]], edgeNormal, edgeD, length * length * edgeWeight);
+            addPlane(quadrics[remap[b]], edgeNormal, edgeD, length * length * edgeWeight);
+        }
+    }
+
+    auto collapseAllowed = [&](uint32_t from, uint32_t to) {
+        if (!canCollapse[kind[from]][kind[to]])
+        {
+            return false;
+        }
+        // Borders and seams only shorten along themselves
+        return kind[from] == KIND_MANIFOLD || loop[from] == to || loopback[from] == to;
+    };
+
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    size_t resultCount = indexCount;
+    std::vector<uint32_t> collapseRemap(vertexCount);
+    std::vector<bool> collapseLocked(vertexCount);
+    std::vector<EdgeCollapse> collapses;
+    PositionTriangles around;
+    double maxError = 0.0;
+
+    while (resultCount > targetIndexCount)
+    {
+        adjacency.build(result.data(), resultCount, vertexCount);
+        around.build(result.data(), resultCount, remap);
+
+        collapses.clear();
+        for (size_t t = 0; t < resultCount; t += 3)
+        {
+            for (int e = 0; e < 3; ++e)
+            {
+                uint32_t i0 = result[t + e];
+                uint32_t i1 = result[t + (e + 1) % 3];
+                // Inner edges come up once from each side
+                if (remap[i0] == remap[i1] || (i1 < i0 && adjacency.has(i1, i0)))
+                {
+                    continue;
+                }
+                const bool forward = collapseAllowed(i0, i1);
+                const bool backward = collapseAllowed(i1, i0);
+                const double forwardCost = forward ? quadricError(quadrics[remap[i0]], position(i1)) : 0.0;
+                const double backwardCost = backward ? quadricError(quadrics[remap[i1]], position(i0)) : 0.0;
+                if (forward && (!backward || forwardCost <= backwardCost))
+                {
+                    EdgeCollapse collapse = {i0, i1, forwardCost};
+                    collapses.push_back(collapse);
+                }
+                else if (backward)
+                {
+                    EdgeCollapse collapse = {i1, i0, backwardCost};
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& a, const EdgeCollapse& b) {
+            return a.cost < b.cost;
+        });
+
+        std::iota(collapseRemap.begin(), collapseRemap.end(), 0u);
+        std::fill(collapseLocked.begin(), collapseLocked.end(), false);
+        const size_t triangleGoal = (resultCount - targetIndexCount + 2) / 3;
+        size_t trianglesRemoved = 0;
+        for (const EdgeCollapse& collapse : collapses)
+        {
+            if (trianglesRemoved >= triangleGoal)
+            {
+                break;
+            }
+            const uint32_t r0 = remap[collapse.from];
+            const uint32_t r1 = remap[collapse.to];
+            if (collapseLocked[r0] || collapseLocked[r1])
+            {
+                continue;
+            }
+
+            uint32_t twinFrom = noVertex;
+            uint32_t twinTo = noVertex;
+            if (kind[collapse.from] == KIND_SEAM)
+            {
+                // The other side of the seam runs the other way
+                twinFrom = wedge[collapse.from];
+                twinTo = loop[collapse.from] == collapse.to ? loopback[twinFrom] : loop[twinFrom];
+                if (twinTo == noVertex || twinTo != wedge[collapse.to])
+                {
+                    continue;
+                }
+            }
+
+            // Triangles that stay around the moved vertex must keep facing the same way
+            bool flips = false;
+            const float* target = position(collapse.to);
+            for (uint32_t a = around.offsets[r0]; a < around.offsets[r0 + 1] && !flips; ++a)
+            {
+                const uint32_t* tri = &result[3 * around.triangles[a]];
+                if (remap[tri[0]] == r1 || remap[tri[1]] == r1 || remap[tri[2]] == r1)
+                {
+                    continue;
+                }
+                double before[3][3];
+                double after[3][3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    const float* p = position(tri[k]);
+                    const float* moved = remap[tri[k]] == r0 ? target : p;
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        before[k][c] = p[c];
+                        after[k][c] = moved[c];
+                    }
+                }
+                double e1[3], e2[3], n0[3], n1[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    e1[c] = before[1][c] - before[0][c];
+                    e2[c] = before[2][c] - before[0][c];
+                }
+                cross(e1, e2, n0);
+                for (int c = 0; c < 3; ++c)
+                {
+                    e1[c] = after[1][c] - after[0][c];
+                    e2[c] = after[2][c] - after[0][c];
+                }
+                cross(e1, e2, n1);
+                flips = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0;
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            collapseRemap[collapse.from] = collapse.to;
+            if (twinFrom != noVertex)
+            {
+                collapseRemap[twinFrom] = twinTo;
+            }
+            // Everything around the moved vertex is left alone for the rest of the pass, so that the
+            // flip checks above always see the current positions
+            collapseLocked[r0] = true;
+            collapseLocked[r1] = true;
+            for (uint32_t a = around.offsets[r0]; a < around.offsets[r0 + 1]; ++a)
+            {
+                const uint32_t* tri = &result[3 * around.triangles[a]];
+                for (int k = 0; k < 3; ++k)
+                {
+                    collapseLocked[remap[tri[k]]] = true;
+                }
+            }
+            addQuadric(quadrics[r1], quadrics[r0]);
+            maxError = std::max(maxError, collapse.cost);
+            trianglesRemoved += kind[collapse.from] == KIND_BORDER ? 1 : 2;
+        }
+        if (trianglesRemoved == 0)
+        {
+            break;
+        }
+
+        // Open edges that ended at a collapsed vertex now go where it went; if that was back to
+        // where they start, they continue along the collapsed vertex's edge instead
+        for (std::vector<uint32_t>* edges : {&loop, &loopback})
+        {
+            std::vector<uint32_t>& next = *edges;
+            for (uint32_t v = 0; v < vertexCount; ++v)
+            {
+                if (next[v] != noVertex)
+                {
+                    const uint32_t moved = collapseRemap[next[v]];
+                    next[v] = moved == v ? next[next[v]] : moved;
+                }
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t t = 0; t < resultCount; t += 3)
+        {
+            const uint32_t a = collapseRemap[result[t]];
+            const uint32_t b = collapseRemap[result[t + 1]];
+            const uint32_t c = collapseRemap[result[t + 2]];
+            if (a != b && b != c && a != c)
+            {
+                result[kept++] = a;
+                result[kept++] = b;
+                result[kept++] = c;
+            }
+        }
+        resultCount = kept;
+    }
+
+    std::copy(result.begin(), result.begin() + resultCount, destination);
+    if (error)
+    {
+        *error = (float) std::sqrt(maxError);
+    }
+    return resultCount;
+}
+
+std::vector<MeshLodRange> buildMeshLods(std::vector<uint32_t>& indices, const float* positions, size_t positionStride,
+                                        size_t vertexCount, int maxLevels, float ratio)
+{
+    const size_t fullCount = indices.size();
+    std::vector<MeshLodRange> lods;
+    MeshLodRange full = {0, (uint32_t) fullCount, 0.0f};
+    lods.push_back(full);
+
+    std::vector<uint32_t> level(fullCount);
+    size_t previousCount = fullCount;
+    while ((int) lods.size() < maxLevels)
+    {
+        // Each level starts over from the full mesh, so its error is measured against that
+        const size_t target = (size_t) (previousCount / 3 * ratio) * 3;
+        float error = 0.0f;
+        const size_t count = simplifyMesh(level.data(), indices.data(), fullCount, positions, positionStride,
+                                          vertexCount, target, &error);
+        // A level that only gets halfway to its target costs memory for little gain
+        if (count == 0 || (float) count > previousCount * 0.5f * (1.0f + ratio))
+        {
+            break;
+        }
+        optimizeVertexCache(level.data(), count, vertexCount, cacheSize, NULL);
+        MeshLodRange range = {(uint32_t) indices.size(), (uint32_t) count, error};
+        indices.insert(indices.end(), level.begin(), level.begin() + count);
+        lods.push_back(range);
+        previousCount = count;
+    }
+    return lods;
+}
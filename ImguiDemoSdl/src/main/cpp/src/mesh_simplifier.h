@@ -0,0 +1,55 @@
+//
+// Triangle count reduction for static indexed triangle meshes, for building levels of detail.
+// No GL dependencies here, so this can run at load time or in offline tools.
+//
+
+#ifndef IMGUI_DEMO_MESH_SIMPLIFIER_H
+#define IMGUI_DEMO_MESH_SIMPLIFIER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Simplify a triangle list with quadric error metric edge collapses (Garland, Heckbert 1997).
+ * Each collapse moves a vertex onto one of its neighbours, so the result indexes the same vertex
+ * buffer as the input and levels of detail can share it. Vertices that share a position but not
+ * the other attributes (texture or normal seams) only collapse along the seam, together with their
+ * twin on the other side; vertices on open borders only collapse along the border. Collapses that
+ * would flip a triangle are skipped.
+ * @param destination Receives the simplified triangle list; room for indexCount indices
+ * @param indices Triangle list indices
+ * @param indexCount Number of indices (a multiple of 3)
+ * @param positions Pointer to the first vertex position (three floats)
+ * @param positionStride Distance between consecutive positions, in bytes
+ * @param vertexCount Number of vertices referenced by the indices
+ * @param targetIndexCount Stop once the triangle list is down to this many indices
+ * @param error If not NULL, receives how far the simplified surface strays from the original,
+ * roughly, in position units
+ * @return Number of indices written; more than targetIndexCount if there was nothing left to collapse
+ */
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions,
+                    size_t positionStride, size_t vertexCount, size_t targetIndexCount, float* error);
+
+/**
+ * A level of detail in an index buffer holding several of them back to back
+ */
+struct MeshLodRange {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // See simplifyMesh(); 0 for the full mesh
+    float error;
+};
+
+/**
+ * Append successively coarser levels of detail to a triangle list, each simplified from the full
+ * mesh and reordered for the vertex cache. Stops at maxLevels, or once a level would save
+ * too little over the previous one.
+ * @param indices Full detail triangle list; the other levels are appended
+ * @param ratio Triangle count of each level relative to the one before it, e.g. 0.5
+ * @return Ranges of all levels in indices, the full mesh first
+ */
+std::vector<MeshLodRange> buildMeshLods(std::vector<uint32_t>& indices, const float* positions, size_t positionStride,
+                                        size_t vertexCount, int maxLevels, float ratio);
+
+#endif //IMGUI_DEMO_MESH_SIMPLIFIER_H
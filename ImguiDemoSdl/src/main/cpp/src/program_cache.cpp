@@ -0,0 +1,203 @@
+//
+// On-disk cache of linked program binaries.
+//
+// One file per program, named after the source hash. The header records which driver wrote it;
+// a file from another driver is a miss and gets overwritten by the next store, so updating
+// the driver (or moving the cache to another device) invalidates everything by itself.
+//
+
+#include "program_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gl_ext.h"
+#include "logger.h"
+
+namespace {
+    const char programCacheMagic[4] = {'P', 'B', 'I', 'N'};
+    const uint32_t programCacheVersion = 1;
+
+    struct ProgramCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceKey;
+        uint64_t driverKey;
+        uint32_t binaryFormat;
+        uint32_t binarySize;
+    };
+
+    static_assert(sizeof(ProgramCacheHeader) == 32, "ProgramCacheHeader must not have padding");
+
+    bool g_enabled = false;
+    std::string g_directory;
+    uint64_t g_driverKey = 0;
+
+    // 64-bit FNV-1a
+    const uint64_t hashSeed = 14695981039346656037ull;
+
+    uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashString(uint64_t hash, const char* str)
+    {
+        // Hash the length too, so that moving text from one string to the next changes the key
+        uint64_t length = str ? strlen(str) : 0;
+        hash = hashBytes(hash, &length, sizeof(length));
+        return hashBytes(hash, str, (size_t)length);
+    }
+
+    std::string cachePath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "program-%016llx.bin", (unsigned long long)key);
+        return g_directory + name;
+    }
+}
+
+void programCacheInit(const char* directory)
+{
+    g_enabled = false;
+    if (!glCaps().programBinary)
+    {
+        Log(LOG_INFO) << "Program binaries are not supported, shaders will be compiled on every start";
+        return;
+    }
+    if (directory == NULL)
+    {
+        Log(LOG_WARN) << "No directory for the program cache, shaders will be compiled on every start";
+        return;
+    }
+    g_directory = directory;
+
+    const GLenum driverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+    g_driverKey = hashSeed;
+    for (GLenum name : driverStrings)
+    {
+        g_driverKey = hashString(g_driverKey, reinterpret_cast<const char*>(glGetString(name)));
+    }
+    g_enabled = true;
+    Log(LOG_INFO) << "Program cache in " << g_directory;
+}
+
+uint64_t programCacheKey(const char* const* sources, size_t count)
+{
+    uint64_t hash = hashSeed;
+    for (size_t i = 0; i < count; ++i)
+    {
+        hash = hashString(hash, sources[i]);
+    }
+    return hash;
+}
+
+unsigned int programCacheLoad(uint64_t key)
+{
+    if (!g_enabled)
+    {
+        return 0;
+    }
+    const std::string path = cachePath(key);
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        return 0;
+    }
+    ProgramCacheHeader header;
+    std::vector<uint8_t> binary;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, programCacheMagic, sizeof(programCacheMagic)) == 0 &&
+              header.version == programCacheVersion &&
+              header.sourceKey == key &&
+              header.driverKey == g_driverKey;
+    if (ok)
+    {
+        binary.resize(header.binarySize);
+        ok = header.binarySize > 0 && fread(binary.data(), binary.size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok)
+    {
+        Log(LOG_INFO) << "Cached program " << path << " is stale, recompiling";
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, (GLenum)header.binaryFormat, binary.data(), (GLsizei)binary.size());
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE)
+    {
+        // Drivers may reject binaries for reasons of their own, even if the strings match
+        Log(LOG_WARN) << "Driver rejected cached program " << path << ", recompiling";
+        glDeleteProgram(program);
+        remove(path.c_str());
+        return 0;
+    }
+    return program;
+}
+
+void programCacheBeforeLink(unsigned int program)
+{
+    if (g_enabled && glProgramParameteri != NULL)
+    {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+void programCacheStore(uint64_t key, unsigned int program)
+{
+    if (!g_enabled)
+    {
+        return;
+    }
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (status != GL_TRUE || length <= 0)
+    {
+        return;
+    }
+
+    ProgramCacheHeader header;
+    memcpy(header.magic, programCacheMagic, sizeof(programCacheMagic));
+    header.version = programCacheVersion;
+    header.sourceKey = key;
+    header.driverKey = g_driverKey;
+    std::vector<uint8_t> binary((size_t)length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+    {
+        return;
+    }
+    header.binaryFormat = (uint32_t)format;
+    header.binarySize = (uint32_t)written;
+
+    // Write to a temporary file first, so a crash halfway through never leaves a truncated entry
+    const std::string path = cachePath(key);
+    const std::string tempPath = path + ".tmp";
+    FILE* f = fopen(tempPath.c_str(), "wb");
+    if (!f)
+    {
+        Log(LOG_WARN) << "Could not write program cache file " << tempPath;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(binary.data(), (size_t)written, 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        Log(LOG_WARN) << "Could not write program cache file " << path;
+        remove(tempPath.c_str());
+    }
+}
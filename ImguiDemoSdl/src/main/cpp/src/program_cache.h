@@ -0,0 +1,45 @@
+//
+// On-disk cache of linked program binaries, so that shaders are only compiled from source
+// the first time a program is used with a given driver.
+// No GL includes here: the ImGui backends bring their own GL declarations and use this too.
+//
+
+#ifndef IMGUI_DEMO_PROGRAM_CACHE_H
+#define IMGUI_DEMO_PROGRAM_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Set up the cache. Requires a current context and glExtInit(); if the context can't
+ * save program binaries, every lookup misses and nothing is written.
+ * @param directory Directory for cache files, with a trailing separator (as returned by SDL_GetPrefPath)
+ */
+void programCacheInit(const char* directory);
+
+/**
+ * Hash the complete source of a program
+ * @param sources Every string passed to glShaderSource, for every stage, in order
+ * @param count Number of strings
+ * @return Key for programCacheLoad() and programCacheStore()
+ */
+uint64_t programCacheKey(const char* const* sources, size_t count);
+
+/**
+ * Create a program from a cached binary
+ * @return Linked program, or 0 if nothing usable is cached (never stored, stored by a different
+ *         driver, or rejected by this one); compile from source and programCacheStore() it then
+ */
+unsigned int programCacheLoad(uint64_t key);
+
+/**
+ * Call on a new program before glLinkProgram, so the driver keeps its binary around
+ */
+void programCacheBeforeLink(unsigned int program);
+
+/**
+ * Save the binary of a program; does nothing if the program did not link
+ */
+void programCacheStore(uint64_t key, unsigned int program);
+
+#endif //IMGUI_DEMO_PROGRAM_CACHE_H
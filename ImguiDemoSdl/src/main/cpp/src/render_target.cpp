@@ -0,0 +1,113 @@
+//
+// Offscreen framebuffer with a sampleable color attachment.
+//
+
+#include "render_target.h"
+#include "logger.h"
+
+RenderTarget::RenderTarget() : framebuffer(0), color(0), depth(0), targetWidth(0), targetHeight(0), complete(false)
+{
+}
+
+RenderTarget::~RenderTarget()
+{
+    release();
+}
+
+bool RenderTarget::resize(int width, int height)
+{
+    if (width == targetWidth && height == targetHeight && framebuffer != 0)
+    {
+        return false;
+    }
+    if (framebuffer == 0)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &color);
+        glGenRenderbuffers(1, &depth);
+    }
+    targetWidth = width;
+    targetHeight = height;
+
+    // Not mipmapped and clamped, so non-power-of-two sizes work on ES2 as well
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+#ifdef GL_PROFILE_GL3
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+#else
+    glTexImage2D(GL_TEXTURE_2D, 0, glCaps().major >= 3 ? GL_RGBA8 : GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, NULL);
+#endif
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+#ifdef GL_PROFILE_GL3
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+#else
+    // ES2 only guarantees 16 bit depth renderbuffers
+    glRenderbufferStorage(GL_RENDERBUFFER, glCaps().major >= 3 ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT16,
+                          width, height);
+#endif
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    complete = (status == GL_FRAMEBUFFER_COMPLETE);
+    if (!complete)
+    {
+        Log(LOG_ERROR) << "Render target " << width << "x" << height << " is incomplete: " << (unsigned) status;
+    }
+    bindDefault();
+    return true;
+}
+
+void RenderTarget::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void RenderTarget::bindDefault()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool RenderTarget::valid() const
+{
+    return complete;
+}
+
+GLuint RenderTarget::texture() const
+{
+    return color;
+}
+
+int RenderTarget::width() const
+{
+    return targetWidth;
+}
+
+int RenderTarget::height() const
+{
+    return targetHeight;
+}
+
+void RenderTarget::release()
+{
+    if (framebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &color);
+        glDeleteRenderbuffers(1, &depth);
+    }
+    framebuffer = 0;
+    color = 0;
+    depth = 0;
+    targetWidth = 0;
+    targetHeight = 0;
+    complete = false;
+}
@@ -0,0 +1,54 @@
+//
+// Offscreen framebuffer with a color texture that can be sampled afterwards, and a depth buffer.
+//
+
+#ifndef IMGUI_DEMO_RENDER_TARGET_H
+#define IMGUI_DEMO_RENDER_TARGET_H
+
+#include "gl_ext.h"
+
+class RenderTarget {
+public:
+    RenderTarget();
+    ~RenderTarget();
+
+    /**
+     * (Re)allocate the attachments if the size differs from the current one. Contents are undefined
+     * after a reallocation. Leaves the default framebuffer bound.
+     * @return true if the attachments were reallocated
+     */
+    bool resize(int width, int height);
+
+    /**
+     * Bind for drawing; the viewport is left to the caller
+     */
+    void bind();
+
+    /**
+     * Go back to drawing into the window
+     */
+    static void bindDefault();
+
+    /**
+     * @return false until resize() succeeded
+     */
+    bool valid() const;
+    GLuint texture() const;
+    int width() const;
+    int height() const;
+
+    void release();
+
+private:
+    RenderTarget(const RenderTarget&);
+    RenderTarget& operator=(const RenderTarget&);
+
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    int targetWidth;
+    int targetHeight;
+    bool complete;
+};
+
+#endif //IMGUI_DEMO_RENDER_TARGET_H
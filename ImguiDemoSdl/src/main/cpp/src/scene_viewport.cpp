@@ -0,0 +1,96 @@
+//
+// Scene views rendered into textures for the UI.
+//
+
+#include "scene_viewport.h"
+#include "trace.h"
+
+#include <algorithm>
+
+// Only the addresses are used: they can't be mistaken for the GL texture names ImGui ids usually hold
+static char viewportTags[maxViewports];
+
+ImTextureID viewportTextureId(int id)
+{
+    return (ImTextureID) &viewportTags[id];
+}
+
+int viewportFromTextureId(ImTextureID textureId)
+{
+    const char* tag = (const char*) textureId;
+    if (tag < viewportTags || tag >= viewportTags + maxViewports)
+    {
+        return -1;
+    }
+    return (int) (tag - viewportTags);
+}
+
+static bool sameView(const Teapot::View& a, const Teapot::View& b)
+{
+    return a.camRX == b.camRX && a.camRY == b.camRY && a.zoom == b.zoom;
+}
+
+SceneViewport::SceneViewport() : drawn(false), complete(false), drawnContent(0), lastDraw(0.0)
+{
+    drawnCamera.camRX = 0.0f;
+    drawnCamera.camRY = 0.0f;
+    drawnCamera.zoom = 1.0f;
+    drawnClearColor = ImVec4(0.0f, 0.0f, 0.0f, 0.0f);
+    viewStatus.width = 0;
+    viewStatus.height = 0;
+    viewStatus.redraws = 0;
+    viewStatus.reusedFrames = 0;
+}
+
+bool SceneViewport::update(Teapot& teapot, const ViewportRequest& request, const ImVec4& clearColor, double now)
+{
+    const int width = std::max(1, (int) (request.width * request.resolutionScale + 0.5f));
+    const int height = std::max(1, (int) (request.height * request.resolutionScale + 0.5f));
+    // Sized to the scaled view exactly, so the image can always show the whole texture
+    const bool reallocated = target.resize(width, height);
+    if (!target.valid())
+    {
+        return false;
+    }
+
+    const bool stale = reallocated || !drawn || !complete || teapot.contentChanges() != drawnContent ||
+                       !sameView(request.camera, drawnCamera) || clearColor.x != drawnClearColor.x ||
+                       clearColor.y != drawnClearColor.y || clearColor.z != drawnClearColor.z ||
+                       clearColor.w != drawnClearColor.w;
+    // There's nothing worth showing in a new or resized target, so that one isn't held back
+    const bool throttled = drawn && !reallocated && request.maxUpdateHz > 0.0f &&
+                           now - lastDraw < 1.0 / request.maxUpdateHz;
+    if (!stale || throttled)
+    {
+        ++viewStatus.reusedFrames;
+        return false;
+    }
+
+    TRACE_SCOPE("viewport");
+    target.bind();
+    glViewport(0, 0, width, height);
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    complete = teapot.drawView(request.camera);
+    RenderTarget::bindDefault();
+
+    drawn = true;
+    drawnCamera = request.camera;
+    drawnContent = teapot.contentChanges();
+    drawnClearColor = clearColor;
+    lastDraw = now;
+    viewStatus.width = width;
+    viewStatus.height = height;
+    ++viewStatus.redraws;
+    return true;
+}
+
+GLuint SceneViewport::texture() const
+{
+    return drawn ? target.texture() : 0;
+}
+
+const ViewportStatus& SceneViewport::status() const
+{
+    return viewStatus;
+}
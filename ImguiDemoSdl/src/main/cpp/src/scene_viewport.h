@@ -0,0 +1,90 @@
+//
+// 3D views inside the UI: the scene is drawn from a camera of its own into a texture sized to the
+// widget showing it, and ImGui draws that texture as an image. A view is only redrawn when its
+// picture is out of date, and no more often than its update rate allows.
+//
+
+#ifndef IMGUI_DEMO_SCENE_VIEWPORT_H
+#define IMGUI_DEMO_SCENE_VIEWPORT_H
+
+#include "imgui.h"
+#include "gl_ext.h"
+#include "teapot.h"
+#include "render_target.h"
+
+// Viewport ids are 0 .. maxViewports - 1
+const int maxViewports = 8;
+
+/**
+ * A view as the UI wants it this frame; views that aren't asked for are released
+ */
+struct ViewportRequest {
+    int id;
+    // Pixels the image covers in the window
+    int width;
+    int height;
+    // Fraction of that size the scene is drawn at; ImGui stretches it when showing the image
+    float resolutionScale;
+    // Redraws per second at most; 0 redraws whenever something changed
+    float maxUpdateHz;
+    Teapot::View camera;
+};
+
+/**
+ * What a view did, as of the last rendered frame
+ */
+struct ViewportStatus {
+    // Size the scene was drawn at, 0 if the view isn't in use
+    int width;
+    int height;
+    unsigned redraws;
+    // Frames that showed an older picture, because nothing changed or the update rate held it back
+    unsigned reusedFrames;
+};
+
+/**
+ * @return Texture id to pass to ImGui::Image() for the viewport. It's a stand-in: the renderer puts
+ * the viewport's texture in its place right before the UI is drawn, so it can be used from the
+ * frame a viewport is first asked for, and stays valid when the texture changes.
+ */
+ImTextureID viewportTextureId(int id);
+
+/**
+ * @return Viewport the texture id stands for, -1 if it's a real texture
+ */
+int viewportFromTextureId(ImTextureID textureId);
+
+class SceneViewport {
+public:
+    SceneViewport();
+
+    /**
+     * Redraw the view into its texture if it's out of date and its update rate allows. Leaves
+     * the default framebuffer bound.
+     * @param now Seconds, on any clock that doesn't go backwards
+     * @return true if the view was redrawn
+     */
+    bool update(Teapot& teapot, const ViewportRequest& request, const ImVec4& clearColor, double now);
+
+    /**
+     * @return Color texture with the view, 0 until it was first drawn
+     */
+    GLuint texture() const;
+    const ViewportStatus& status() const;
+
+private:
+    SceneViewport(const SceneViewport&);
+    SceneViewport& operator=(const SceneViewport&);
+
+    RenderTarget target;
+    // What the picture in the target was drawn with
+    bool drawn;
+    bool complete;
+    Teapot::View drawnCamera;
+    unsigned drawnContent;
+    ImVec4 drawnClearColor;
+    double lastDraw;
+    ViewportStatus viewStatus;
+};
+
+#endif //IMGUI_DEMO_SCENE_VIEWPORT_H
@@ -0,0 +1,201 @@
+//
+// Program objects that compile in the background.
+//
+
+#include "shader_program.h"
+
+#include <vector>
+#include "program_cache.h"
+#include "logger.h"
+#include "trace.h"
+
+std::string shaderPrologue(GLenum shaderType)
+{
+    const bool glsl3 = glCaps().glsl3;
+    std::string prologue;
+#ifdef GL_PROFILE_GL3
+    prologue = glsl3 ? "#version 330\n" : "#version 120\n";
+#else
+    prologue = glsl3 ? "#version 300 es\n" : "#version 100\n";
+    if (shaderType == GL_FRAGMENT_SHADER)
+    {
+        if (!glsl3 && glCaps().textureLod)
+        {
+            // Extension directives have to come before any non-preprocessor tokens
+            prologue += "#extension GL_EXT_shader_texture_lod : enable\n";
+        }
+        prologue += "precision mediump float;\n";
+    }
+#endif
+    if (shaderType == GL_VERTEX_SHADER)
+    {
+        if (glsl3)
+        {
+            prologue += "#define attribute in\n"
+                        "#define varying out\n";
+        }
+    }
+    else
+    {
+        if (glsl3)
+        {
+            prologue += "#define varying in\n"
+                        "#define texture2D texture\n"
+                        "#define textureCube texture\n"
+                        "#define textureCubeLod textureLod\n"
+                        "out vec4 fragColor;\n"
+                        "#define FRAG_COLOR fragColor\n";
+        }
+        else
+        {
+            prologue += "#define FRAG_COLOR gl_FragColor\n";
+#ifndef GL_PROFILE_GL3
+            if (glCaps().textureLod)
+            {
+                prologue += "#define textureCubeLod textureCubeLodEXT\n";
+            }
+#endif
+        }
+    }
+    if (glCaps().uniformBuffers)
+    {
+        prologue += "#define UNIFORM_BUFFERS\n";
+    }
+    return prologue;
+}
+
+ShaderProgram::ShaderProgram() : program(0), vertexShader(0), fragmentShader(0), cacheKey(0), status(PROGRAM_EMPTY) { }
+
+ShaderProgram::~ShaderProgram()
+{
+    release();
+}
+
+void ShaderProgram::release()
+{
+    if (vertexShader)
+    {
+        glDeleteShader(vertexShader);
+    }
+    if (fragmentShader)
+    {
+        glDeleteShader(fragmentShader);
+    }
+    if (program)
+    {
+        glDeleteProgram(program);
+    }
+    program = 0;
+    vertexShader = 0;
+    fragmentShader = 0;
+    status = PROGRAM_EMPTY;
+}
+
+void ShaderProgram::start(const char* defines, const char* vtxSrc, const char* fragSrc)
+{
+    TRACE_SCOPE("compile program");
+    release();
+
+    const std::string vtxPrologue = shaderPrologue(GL_VERTEX_SHADER);
+    const std::string fragPrologue = shaderPrologue(GL_FRAGMENT_SHADER);
+    const char* sources[] = {vtxPrologue.c_str(), defines, vtxSrc, fragPrologue.c_str(), defines, fragSrc};
+    cacheKey = programCacheKey(sources, sizeof(sources) / sizeof(sources[0]));
+    program = programCacheLoad(cacheKey);
+    if (program != 0)
+    {
+        status = PROGRAM_READY;
+        return;
+    }
+
+    // No status queries in here: any of them would make the driver finish the job right away
+    vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 3, sources, NULL);
+    glCompileShader(vertexShader);
+    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 3, sources + 3, NULL);
+    glCompileShader(fragmentShader);
+
+    // Linking doesn't have to wait for the compiles either; it just fails if one of them did
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    programCacheBeforeLink(program);
+    glLinkProgram(program);
+    status = PROGRAM_PENDING;
+}
+
+ShaderProgram::Status ShaderProgram::poll()
+{
+    if (status != PROGRAM_PENDING)
+    {
+        return status;
+    }
+    if (glCaps().parallelShaderCompile)
+    {
+        GLint done = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+        if (done != GL_TRUE)
+        {
+            return status;
+        }
+    }
+
+    // Without parallel compilation, this is where the driver actually does the work
+    TRACE_SCOPE("link program");
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        logFailure();
+        release();
+        status = PROGRAM_FAILED;
+        return status;
+    }
+    programCacheStore(cacheKey, program);
+    // Still attached, so these only go away together with the program
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    vertexShader = 0;
+    fragmentShader = 0;
+    status = PROGRAM_READY;
+    return status;
+}
+
+GLuint ShaderProgram::id() const
+{
+    return program;
+}
+
+void ShaderProgram::logFailure()
+{
+    const GLuint shaders[] = {vertexShader, fragmentShader};
+    for (GLuint shader : shaders)
+    {
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (compiled == GL_TRUE)
+        {
+            continue;
+        }
+        // Assume we only care about vertex and fragment shaders
+        Log(LOG_ERROR) << "Could not compile shader! Shader type: " << ((shader == vertexShader) ? "vertex" : "fragment");
+        GLint logLength;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+        std::vector<char> infoLog(logLength + 1);
+        glGetShaderInfoLog(shader, infoLog.size(), &logLength, infoLog.data());
+        Log(LOG_ERROR) << "Error log: " << infoLog.data();
+        GLint sourceLength;
+        glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &sourceLength);
+        std::vector<char> source(sourceLength + 1);
+        glGetShaderSource(shader, source.size(), &sourceLength, source.data());
+        Log(LOG_ERROR) << "Shader source: " << source.data();
+        return;
+    }
+
+    Log(LOG_ERROR) << "Could not link shaders; interface mismatch?";
+    GLint logLength;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+    std::vector<char> infoLog(logLength + 1);
+    glGetProgramInfoLog(program, infoLog.size(), &logLength, infoLog.data());
+    Log(LOG_ERROR) << "Error log: " << infoLog.data();
+}
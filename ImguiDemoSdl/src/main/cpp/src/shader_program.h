@@ -0,0 +1,72 @@
+//
+// Program objects that compile in the background: compile and link are issued up front and
+// their status is only looked at once the driver says it's done, so several programs can
+// be compiling in parallel while the app keeps rendering with whatever is ready.
+//
+
+#ifndef IMGUI_DEMO_SHADER_PROGRAM_H
+#define IMGUI_DEMO_SHADER_PROGRAM_H
+
+#include "gl_ext.h"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Build the part of the shader that has to come before everything else: the #version line,
+ * plus a handful of macros that let the same shader body compile as GLSL 1.x and GLSL 3.x.
+ * @param shaderType GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+ * @return Shader prologue
+ */
+std::string shaderPrologue(GLenum shaderType);
+
+class ShaderProgram {
+public:
+    enum Status {
+        PROGRAM_EMPTY,
+        PROGRAM_PENDING,
+        PROGRAM_READY,
+        PROGRAM_FAILED
+    };
+
+    ShaderProgram();
+    ~ShaderProgram();
+
+    /**
+     * Issue compilation and linking, or restore the program from the program cache.
+     * Never waits for the driver.
+     * @param defines Lines inserted between the prologue and the shader sources
+     * @param vtxSrc Vertex shader body
+     * @param fragSrc Fragment shader body
+     */
+    void start(const char* defines, const char* vtxSrc, const char* fragSrc);
+
+    /**
+     * Check whether the program has finished linking. Doesn't block where parallel shader
+     * compilation is supported; elsewhere the first call after start() waits for the driver.
+     * Compile and link errors are logged when they are found.
+     * @return PROGRAM_READY once the program can be used
+     */
+    Status poll();
+
+    /**
+     * @return Program name; only usable once poll() returned PROGRAM_READY
+     */
+    GLuint id() const;
+
+    void release();
+
+private:
+    ShaderProgram(const ShaderProgram&);
+    ShaderProgram& operator=(const ShaderProgram&);
+
+    void logFailure();
+
+    GLuint program;
+    GLuint vertexShader;
+    GLuint fragmentShader;
+    uint64_t cacheKey;
+    Status status;
+};
+
+#endif //IMGUI_DEMO_SHADER_PROGRAM_H
@@ -3,20 +3,41 @@
 //
 
 #include "teapot.h"
+#include "vertex_format.h"
+#include "mesh_file.h"
+#include "trace.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#include "teapot.inl"
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <glm/gtc/matrix_transform.hpp>
-//#include <string>
+#include <glm/vector_relational.hpp>
 #include "logger.h"
 
 #ifdef GL_PROFILE_GL3
 GLuint Teapot::g_vao = 0;
 #endif
 
+static const char* meshFileName = "teapot.mesh";
+
+// The teapot rotates around this point; instance transforms are applied on top of it
+static const glm::vec3 teapotPivot(0.0f, -20.0f, 0.0f);
+
+// Instances sharing one occlusion query; small enough for the bounding boxes to stay tight,
+// big enough to keep the number of queries (and draw calls) per frame low
+static const size_t instancesPerCluster = 64;
+
+// A teapot only moves to another level of detail once its projected error is this much past the switch point
+static const float lodHysteresis = 0.2f;
+
+// Face size of the dynamic environment cubemap
+static const int environmentSize = 256;
+
 static const std::vector<std::pair<const char*, GLuint>> faces {
         {"skybox-negx.jpg", GL_TEXTURE_CUBE_MAP_NEGATIVE_X},
         {"skybox-negy.jpg", GL_TEXTURE_CUBE_MAP_NEGATIVE_Y},
@@ -26,80 +47,232 @@ static const std::vector<std::pair<const char*, GLuint>> faces {
         {"skybox-posz.jpg", GL_TEXTURE_CUBE_MAP_POSITIVE_Z}
 };
 
+// Binding point for the TeapotUniforms block; all teapot programs share the same buffer
+static const GLuint teapotUniformBinding = 0;
+
+static_assert(sizeof(glm::mat4) == 64, "uniformData is expected to match the std140 layout");
+
+// Feature bits select which of the blocks below get compiled in, see Teapot::ShaderFeature
 const char* vtxShader =
-#ifdef GL_PROFILE_GL3
-"#version 120\n"
-#else
-"#version 100\n"
-#endif
+"// The depth pre-pass and the shading pass after it have to agree on depth to the last bit\n"
+"invariant gl_Position;\n"
 "attribute vec3 g_Position;\n"
-"attribute vec3 g_TexCoord0;\n"
-"attribute vec3 g_Tangent;\n"
-"attribute vec3 g_Binormal;\n"
 "attribute vec3 g_Normal;\n"
+"#ifdef BUMP\n"
+"attribute vec2 g_TexCoord0;\n"
+"attribute vec4 g_Tangent;\n"
+"#endif\n"
+"#ifdef INSTANCED\n"
+"attribute mat4 g_InstanceWorld;\n"
+"#endif\n"
 "\n"
+"#ifdef UNIFORM_BUFFERS\n"
+"layout(std140) uniform TeapotUniforms {\n"
+"  mat4 world;\n"
+"  mat4 worldInverseTranspose;\n"
+"  mat4 worldViewProj;\n"
+"  mat4 viewInverse;\n"
+"  mat4 viewProj;\n"
+"};\n"
+"#else\n"
 "uniform mat4 world;\n"
 "uniform mat4 worldInverseTranspose;\n"
 "uniform mat4 worldViewProj;\n"
 "uniform mat4 viewInverse;\n"
+"uniform mat4 viewProj;\n"
+"#endif\n"
 "\n"
-"varying vec2 texCoord;\n"
+"#ifndef DEPTH_ONLY\n"
 "varying vec3 worldEyeVec;\n"
 "varying vec3 worldNormal;\n"
+"#endif\n"
+"#ifdef BUMP\n"
+"varying vec2 texCoord;\n"
 "varying vec3 worldTangent;\n"
 "varying vec3 worldBinorm;\n"
+"#endif\n"
+"#ifdef FOG\n"
+"varying float eyeDistance;\n"
+"#endif\n"
 "\n"
 "void main() {\n"
+"#ifdef INSTANCED\n"
+"  vec4 worldPos = g_InstanceWorld * (world * vec4(g_Position, 1.0));\n"
+"  gl_Position = viewProj * worldPos;\n"
+"#else\n"
+"  vec4 worldPos = world * vec4(g_Position, 1.0);\n"
 "  gl_Position = worldViewProj * vec4(g_Position, 1.0);\n"
+"#endif\n"
+"#ifndef DEPTH_ONLY\n"
+"  worldNormal = (worldInverseTranspose * vec4(g_Normal, 1.0)).xyz;\n"
+"#ifdef BUMP\n"
 "  texCoord.x = g_TexCoord0.x;\n"
 "  texCoord.y = 1.0-g_TexCoord0.y;\n"
-"  worldNormal = (worldInverseTranspose * vec4(g_Normal, 1.0)).xyz;\n"
-"  worldTangent = (worldInverseTranspose * vec4(g_Tangent, 1.0)).xyz;\n"
-"  worldBinorm = (worldInverseTranspose * vec4(g_Binormal, 1.0)).xyz;\n"
-"  vec3 worldPos = (world * vec4(g_Position, 1.0)).xyz;\n"
-"  worldEyeVec = normalize(worldPos - viewInverse[3].xyz);\n"
+"  // Binormal is not stored, tangent.w holds its direction instead\n"
+"  vec3 binormal = cross(g_Normal, g_Tangent.xyz) * (g_Tangent.w < 0.0 ? -1.0 : 1.0);\n"
+"  worldTangent = (worldInverseTranspose * vec4(g_Tangent.xyz, 1.0)).xyz;\n"
+"  worldBinorm = (worldInverseTranspose * vec4(binormal, 1.0)).xyz;\n"
+"#endif\n"
+"#ifdef INSTANCED\n"
+"  worldNormal = (g_InstanceWorld * vec4(worldNormal, 0.0)).xyz;\n"
+"#ifdef BUMP\n"
+"  worldTangent = (g_InstanceWorld * vec4(worldTangent, 0.0)).xyz;\n"
+"  worldBinorm = (g_InstanceWorld * vec4(worldBinorm, 0.0)).xyz;\n"
+"#endif\n"
+"#endif\n"
+"  vec3 eyeToPos = worldPos.xyz - viewInverse[3].xyz;\n"
+"  worldEyeVec = normalize(eyeToPos);\n"
+"#ifdef FOG\n"
+"  eyeDistance = length(eyeToPos);\n"
+"#endif\n"
+"#endif\n"
 "}";
 
 const char* fragShader =
-#ifdef GL_PROFILE_GL3
-"#version 120\n"
-#else
-"#version 100\n"
-"precision mediump float;\n"
-#endif
+"#ifdef BUMP\n"
 "const float bumpHeight = 0.5;\n"
 "uniform sampler2D normalSampler;\n"
+"varying vec2 texCoord;\n"
+"varying vec3 worldTangent;\n"
+"varying vec3 worldBinorm;\n"
+"#endif\n"
+"#ifdef REFLECTION\n"
 "uniform samplerCube envSampler;\n"
+"#ifdef ROUGH\n"
+"uniform samplerCube irradianceSampler;\n"
+"// Mip level of the prefiltered sky in x, share of the diffuse light in y\n"
+"uniform vec2 roughParams;\n"
+"#endif\n"
+"#else\n"
+"const vec3 baseColor = vec3(0.8, 0.8, 0.85);\n"
+"const vec3 lightDirection = vec3(0.259, 0.864, 0.432);\n"
+"#endif\n"
+"#ifdef FOG\n"
+"// Fog color in rgb, density in a\n"
+"uniform vec4 fogParams;\n"
+"varying float eyeDistance;\n"
+"#endif\n"
 "\n"
-"varying vec2 texCoord;\n"
 "varying vec3 worldEyeVec;\n"
 "varying vec3 worldNormal;\n"
-"varying vec3 worldTangent;\n"
-"varying vec3 worldBinorm;\n"
 "\n"
 "void main() {\n"
+"  vec3 nb = normalize(worldNormal);\n"
+"#ifdef BUMP\n"
 "  vec2 bump = (texture2D(normalSampler, texCoord.xy).xy * 2.0 - 1.0) * bumpHeight;\n"
-"  vec3 normal = normalize(worldNormal);\n"
 "  vec3 tangent = normalize(worldTangent);\n"
 "  vec3 binormal = normalize(worldBinorm);\n"
-"  vec3 nb = normal + bump.x * tangent + bump.y * binormal;\n"
-"  nb = normalize(nb);\n"
+"  nb = normalize(nb + bump.x * tangent + bump.y * binormal);\n"
+"#endif\n"
+"#ifdef REFLECTION\n"
 "  vec3 worldEye = normalize(worldEyeVec);\n"
 "  vec3 lookup = reflect(worldEye, nb);\n"
+"#ifdef ROUGH\n"
+"  // The blurring was done at load time; the level for the roughness is a single lookup\n"
+"  vec4 specular = textureCubeLod(envSampler, lookup, roughParams.x);\n"
+"  vec4 color = mix(specular, textureCube(irradianceSampler, nb), roughParams.y);\n"
+"#else\n"
 "  vec4 color = textureCube(envSampler, lookup);\n"
-"  gl_FragColor = color;\n"
+"#endif\n"
+"#else\n"
+"  float diffuse = max(dot(nb, lightDirection), 0.0);\n"
+"  vec4 color = vec4(baseColor * (0.3 + 0.7 * diffuse), 1.0);\n"
+"#endif\n"
+"#ifdef FOG\n"
+"  float visibility = clamp(exp(-fogParams.a * eyeDistance), 0.0, 1.0);\n"
+"  color.rgb = mix(fogParams.rgb, color.rgb, visibility);\n"
+"#endif\n"
+"  FRAG_COLOR = color;\n"
 "}";
 
-Teapot::Teapot() : num_vertices(0), num_indices(0), ibo(0), vbo(0), tex_skybox(0),
-                   tex_bump(0), program(0), rotX(0.0f), rotY(0.0f), zoom(1.0f),
+/**
+ * @return #define lines for the features in the mask, in the same order every time so that
+ * the program cache sees the same source for the same permutation
+ */
+static std::string featureDefines(unsigned features)
+{
+    static const char* const names[] = {"BUMP", "REFLECTION", "FOG", "INSTANCED", "QUANTIZED_VERTICES", "ROUGH",
+                                         "DEPTH_ONLY"};
+    std::string defines;
+    for (size_t bit = 0; bit < sizeof(names) / sizeof(names[0]); ++bit)
+    {
+        if (features & (1u << bit))
+        {
+            defines += "#define ";
+            defines += names[bit];
+            defines += "\n";
+        }
+    }
+    return defines;
+}
+
+// Bounding boxes for occlusion queries; color writes are off while these are drawn, as they are
+// for the depth pre-pass, which uses boxFragShader too
+const char* boxVtxShader =
+"attribute vec3 g_Position;\n"
+"uniform mat4 boxTransform;\n"
+"\n"
+"void main() {\n"
+"  gl_Position = boxTransform * vec4(g_Position, 1.0);\n"
+"}";
+
+const char* boxFragShader =
+"void main() {\n"
+"  FRAG_COLOR = vec4(1.0);\n"
+"}";
+
+static const GLfloat boxVertices[] = {
+        -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   -1.0f, 1.0f, -1.0f,   1.0f, 1.0f, -1.0f,
+        -1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,   -1.0f, 1.0f,  1.0f,   1.0f, 1.0f,  1.0f
+};
+
+static const GLushort boxIndices[] = {
+        0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+        0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+        0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5
+};
+
+Teapot::Teapot() : packedVertices(false), num_vertices(0), num_indices(0), indexType(GL_UNSIGNED_SHORT),
+                   ibo(0), vbo(0), positionVbo(0), tex_skybox(0), tex_prefiltered(0), tex_irradiance(0), prefilteredLevels(0),
+                   roughLevels(0), tex_bump(0), ubo(0), instanceVbo(0), instancesDirty(false),
+                   boundingRadius(0.0f), frustumCulling(true), occlusionCulling(false), lodSelection(false),
+                   lodErrorPixels(2.0f), teapotLod(0), depthPrepass(false), prepassState(PREPASS_OFF),
+                   boxProgram(0), boxPositionLocation(-1), boxTransformLocation(-1), boxVao(0), boxVbo(0), boxIbo(0),
+                   features(SHADER_BUMP | SHADER_REFLECTION), lastPermutation(SHADER_PERMUTATIONS),
+                   fogColor(0.0f), fogDensity(0.005f), roughness(0.3f), contentVersion(1), drawnContent(0), cameraDirty(true),
+                   programPending(false), probeInitialized(false), dynamicEnvironment(false), environmentFaces(1),
+                   environmentUpdates(0), probeCenter(teapotPivot), probeNear(1.0f),
+                   rotX(0.0f), rotY(0.0f), zoom(1.0f),
                    camRX(0.0f), camRY(0.0f),
-                   addRotX(0.0f), addRotY(0.0f), addZoom(0.0f), addCamRX(0.0f), addCamRY(0.0f){ }
+                   addRotX(0.0f), addRotY(0.0f), addZoom(0.0f), addCamRX(0.0f), addCamRY(0.0f)
+{
+    memset(&stats, 0, sizeof(stats));
+}
 
 Teapot::~Teapot()
 {
-    if (program)
+    if (instanceVbo)
     {
-        glDeleteProgram(program);
+        glDeleteBuffers(1, &instanceVbo);
+    }
+    deleteClusters();
+    if (boxVbo)
+    {
+        glDeleteBuffers(1, &boxVbo);
+    }
+    if (boxIbo)
+    {
+        glDeleteBuffers(1, &boxIbo);
+    }
+#ifdef GL_PROFILE_GL3
+    if (boxVao)
+    {
+        glDeleteVertexArrays(1, &boxVao);
+    }
+#endif
+    if (ubo)
+    {
+        glDeleteBuffers(1, &ubo);
     }
     if (ibo)
     {
@@ -109,10 +282,22 @@ Teapot::~Teapot()
     {
         glDeleteBuffers(1, &vbo);
     }
+    if (positionVbo)
+    {
+        glDeleteBuffers(1, &positionVbo);
+    }
     if (tex_skybox)
     {
         glDeleteTextures(1, &tex_skybox);
     }
+    if (tex_prefiltered)
+    {
+        glDeleteTextures(1, &tex_prefiltered);
+    }
+    if (tex_irradiance)
+    {
+        glDeleteTextures(1, &tex_irradiance);
+    }
     if (tex_bump)
     {
         glDeleteTextures(1, &tex_bump);
@@ -149,37 +334,106 @@ bool Teapot::init()
         glBindVertexArray(g_vao);
     }
 #endif
-    num_indices = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
-    num_vertices = (sizeof(teapotPositions) / sizeof(teapotPositions[0])) / 3;
+    // Vertex and index blocks are stored in the same layout we upload them in, so loading is
+    // just a matter of mapping the file and pointing glBufferData at the right block
+    traceBegin("load mesh");
+    MeshFile mesh;
+    if (!mesh.open(meshFileName))
+    {
+        Log(LOG_ERROR) << "Could not load teapot mesh";
+        traceEnd("load mesh");
+        return false;
+    }
 
-    std::vector<vtxData> bufferData(num_vertices);
-    for (int i = 0; i < num_vertices; ++i)
+    // Use the compact format where the context can fetch it, plain floats otherwise
+    packedVertices = glCaps().packedVertices;
+    const MeshFileBlock* vertexBlock = mesh.findBlock(packedVertices ? MESH_BLOCK_VERTICES_PACKED : MESH_BLOCK_VERTICES_FLOAT);
+    const MeshFileBlock* indexBlock = mesh.findBlock(MESH_BLOCK_INDICES_U16);
+    indexType = GL_UNSIGNED_SHORT;
+    if (indexBlock == NULL && (!glCaps().es || glCaps().major >= 3))
     {
-        bufferData[i].pos = glm::vec3{teapotPositions[3*i], teapotPositions[3*i+1], teapotPositions[3*i+2]};
-        bufferData[i].norm = glm::vec3{teapotNormals[3*i], teapotNormals[3*i+1], teapotNormals[3*i+2]};
-        bufferData[i].tangent = glm::vec3{teapotTangents[3*i], teapotTangents[3*i+1], teapotTangents[3*i+2]};
-        bufferData[i].binorm = glm::vec3{teapotBinormals[3*i], teapotBinormals[3*i+1], teapotBinormals[3*i+2]};
-        bufferData[i].texcoord = glm::vec3{teapotTexCoords[3*i], teapotTexCoords[3*i+1], teapotTexCoords[3*i+2]};
+        indexBlock = mesh.findBlock(MESH_BLOCK_INDICES_U32);
+        indexType = GL_UNSIGNED_INT;
     }
+    if (vertexBlock == NULL || indexBlock == NULL)
+    {
+        Log(LOG_ERROR) << "Teapot mesh has no vertex or index data usable with this context";
+        traceEnd("load mesh");
+        return false;
+    }
+    num_vertices = (int)vertexBlock->count;
+    num_indices = (int)indexBlock->count;
+
+    // The model matrix only rotates the mesh around its origin, so a sphere around the origin
+    // that contains the bounding box stays valid whatever the rotation is
+    const MeshFileHeader& header = mesh.header();
+    glm::vec3 farCorner;
+    for (int c = 0; c < 3; ++c)
+    {
+        farCorner[c] = std::max(std::fabs(header.boundsMin[c]), std::fabs(header.boundsMax[c]));
+    }
+    boundingRadius = glm::length(farCorner);
+    probeNear = boundingRadius;
+
+    // Levels of detail share the vertices; a file without them is drawn at full detail only
+    const size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(uint16_t) : sizeof(uint32_t);
+    const MeshFileBlock* lodBlock = mesh.findBlock(MESH_BLOCK_LODS);
+    if (lodBlock != NULL && lodBlock->size == lodBlock->count * sizeof(MeshFileLod))
+    {
+        const MeshFileLod* fileLods = static_cast<const MeshFileLod*>(mesh.blockData(*lodBlock));
+        for (uint32_t i = 0; i < lodBlock->count; ++i)
+        {
+            if ((uint64_t)fileLods[i].firstIndex + fileLods[i].indexCount > indexBlock->count)
+            {
+                Log(LOG_ERROR) << "Teapot mesh level of detail " << i << " is out of range";
+                break;
+            }
+            meshLod lod = {(GLsizei)fileLods[i].indexCount, fileLods[i].firstIndex * indexSize,
+                           fileLods[i].error / boundingRadius};
+            lods.push_back(lod);
+        }
+    }
+    if (lods.empty())
+    {
+        meshLod full = {(GLsizei)indexBlock->count, 0, 0.0f};
+        lods.push_back(full);
+    }
+    num_indices = lods[0].indexCount;
 
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(vtxData), bufferData.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexBlock->size, mesh.blockData(*vertexBlock), GL_STATIC_DRAW);
 
     glCheckError();
 
+    // The depth pre-pass fetches only these instead of whole vertices; they're the same values as in
+    // the vertices, so both passes end up with the same depth
+    const MeshFileBlock* positionBlock = mesh.findBlock(packedVertices ? MESH_BLOCK_POSITIONS_PACKED : MESH_BLOCK_POSITIONS_FLOAT);
+    if (positionBlock != NULL && positionBlock->count == vertexBlock->count)
+    {
+        glGenBuffers(1, &positionVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)positionBlock->size, mesh.blockData(*positionBlock), GL_STATIC_DRAW);
+        glCheckError();
+    }
+
     glGenBuffers(1, &ibo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(teapotIndices), teapotIndices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexBlock->size, mesh.blockData(*indexBlock), GL_STATIC_DRAW);
+    traceEnd("load mesh");
 
     glCheckError();
 
+    traceBegin("load skybox");
     glGenTextures(1, &tex_skybox);
     glBindTexture(GL_TEXTURE_CUBE_MAP, tex_skybox);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Pixels are kept around for prefiltering
+    CubeImage sky;
+    sky.size = 0;
     for(const auto& face: faces)
     {
         int x, y, channels;
@@ -189,11 +443,29 @@ bool Teapot::init()
             Log(LOG_ERROR) << "Could not load " << face.first;
         }
         glTexImage2D(face.second, 0, GL_RGB, x, y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        if (data != NULL && channels == 3 && x == y)
+        {
+            sky.size = x;
+            sky.faces[face.second - GL_TEXTURE_CUBE_MAP_POSITIVE_X].assign(data, data + (size_t) x * y * 3);
+        }
         stbi_image_free(data);
     }
+    traceEnd("load skybox");
+
+    glCheckError();
+
+    if (glCaps().textureLod)
+    {
+        loadPrefiltered(sky);
+    }
+#ifdef GL_PROFILE_GL3
+    // Blurry levels show the face edges otherwise; ES3 always filters across them
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+#endif
 
     glCheckError();
 
+    traceBegin("load bump map");
     glGenTextures(1, &tex_bump);
     glBindTexture(GL_TEXTURE_2D, tex_bump);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -206,12 +478,29 @@ bool Teapot::init()
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, x, y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
         stbi_image_free(data);
     }
+    traceEnd("load bump map");
     glCheckError();
 
-    if (!compileShaders())
+    // All programs are only kicked off here; draw() picks them up as the driver finishes them.
+    // Other permutations are compiled when they're first asked for.
+    features = defaultShaderFeatures();
+    permutation(features | (packedVertices ? SHADER_QUANTIZED_VERTICES : 0));
+    if (glCaps().instancing)
     {
-        Log(LOG_ERROR) << "Initialization failed";
-        return false;
+        permutation(features | SHADER_INSTANCED | (packedVertices ? SHADER_QUANTIZED_VERTICES : 0));
+    }
+    if (glCaps().conditionalRender)
+    {
+        initOcclusionCulling();
+    }
+    glCheckError();
+
+    if (glCaps().uniformBuffers)
+    {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(uniformData), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
     glCheckError();
 
@@ -237,10 +526,57 @@ bool Teapot::init()
     return true;
 }
 
+void Teapot::loadPrefiltered(const CubeImage& sky)
+{
+    PrefilteredEnvironment prefiltered;
+    if (!prefilterEnvironment(sky, prefiltered))
+    {
+        return;
+    }
+
+    TRACE_SCOPE("upload prefiltered sky");
+    // The smallest levels have rows that aren't a multiple of four bytes long
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &tex_prefiltered);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, tex_prefiltered);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    for (size_t level = 0; level < prefiltered.specular.size(); ++level)
+    {
+        const CubeImage& image = prefiltered.specular[level];
+        for (int f = 0; f < 6; ++f)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, (GLint) level, GL_RGB, image.size, image.size, 0,
+                         GL_RGB, GL_UNSIGNED_BYTE, image.faces[f].data());
+        }
+    }
+
+    glGenTextures(1, &tex_irradiance);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, tex_irradiance);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    for (int f = 0; f < 6; ++f)
+    {
+        const CubeImage& image = prefiltered.irradiance;
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB, image.size, image.size, 0,
+                     GL_RGB, GL_UNSIGNED_BYTE, image.faces[f].data());
+    }
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    prefilteredLevels = (int) prefiltered.specular.size();
+    roughLevels = prefiltered.roughLevels;
+}
+
 float Teapot::zoomValue() {return zoom;}
 
 void Teapot::draw()
 {
+    TRACE_SCOPE("Teapot::draw");
     // Apply rotations and zoom, recalculate matrices
     rotX += addRotX;
     rotY += addRotY;
@@ -283,24 +619,48 @@ void Teapot::draw()
 
     addCamRX = 0;
     addCamRY = 0;
+    cameraDirty = false;
+    // Includes the cubemap faces redrawn so far; once it's complete, a still scene needs no redraw
+    drawnContent = contentChanges();
+
+    View camera = {camRX, camRY, zoom};
+    prepassState = PREPASS_NOTHING_DRAWN;
+    programPending = !drawFrom(camera, true, occlusionCulling);
+}
 
+bool Teapot::drawView(const View& camera)
+{
+    TRACE_SCOPE("Teapot::drawView");
+    // The occlusion queries hold what the main camera saw last frame, they'd hide the wrong clusters here
+    return drawFrom(camera, false, false);
+}
+
+bool Teapot::drawFrom(const View& camera, bool mainCamera, bool occlusion)
+{
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
     GLfloat aspect = (GLfloat) viewport[2] / (GLfloat) viewport[3];
 
     const GLfloat camDistance = 100.0f;
 
-    glm::vec3 cameraPos = glm::vec3(camDistance * cos(camRX) * cos(camRY), camDistance * sin(camRY), camDistance * sin(camRX) * cos(camRY));
+    glm::vec3 cameraPos = glm::vec3(camDistance * cos(camera.camRX) * cos(camera.camRY), camDistance * sin(camera.camRY),
+                                    camDistance * sin(camera.camRX) * cos(camera.camRY));
 
     //cameraPos = (glm::rotate(glm::mat4(1.0f), rotX, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f), rotY, glm::vec3(0.0f, 0.0f, 1.0f)) * glm::vec4(cameraPos, 1.0f));
 
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f / zoom), aspect, 10.0f, 500.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f / camera.zoom), aspect, 10.0f, 500.0f);
     glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    return drawScene(view, projection, mainCamera, occlusion, environmentTexture());
+}
+
+bool Teapot::drawScene(const glm::mat4& view, const glm::mat4& projection, bool mainCamera, bool occlusion,
+                       GLuint environment)
+{
     /*glm::mat4 model = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -10.0f, 0.0f)),
                                   -(GLfloat)M_PI_2,
                                   glm::vec3(1.0f, 0.0f, 0.0f)); */
     glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, -20.0f, 0.0f));
+    model = glm::translate(model, teapotPivot);
     model = glm::rotate(model, rotY, glm::vec3(0.0f, 0.0f, 1.0f));
     model = glm::rotate(model, -rotX, glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::rotate(model, -(GLfloat)M_PI_2, glm::vec3(1.0f, 0.0f, 0.0f));
@@ -313,82 +673,630 @@ void Teapot::draw()
     unfData.worldInverseTranspose = worldInverseTranspose;
     unfData.viewInverse = viewInverse;
     unfData.worldViewProj = mvp;
+    unfData.viewProj = projection * view;
+
+    // Work out what's visible before touching any GL state
+    Frustum frustum;
+    frustumFromMatrix(&unfData.viewProj[0][0], frustum);
+    cullInstances(frustum);
+    if (stats.drawn == 0)
+    {
+        return true;
+    }
+
+    const bool instanced = !instances.empty() && glCaps().instancing;
+    const shaderProgram* selected = selectProgram(instanced);
+    // Drawn with a stand-in while the right program compiles; the frame has to be redone once it's there
+    const bool complete = (selected != NULL) && (selected->features == wantedPermutation(instanced));
+    if (selected == NULL)
+    {
+        // Nothing compiled yet
+        return false;
+    }
+    const shaderProgram& prog = *selected;
+    const bool useInstancing = (prog.features & SHADER_INSTANCED) != 0;
+    const auto& uniforms = prog.uniforms;
+    const bool clustered = useInstancing && occlusion && boxProgram != 0;
+    selectLods(projection, mainCamera, clustered);
 
-    glUseProgram(program);
 #ifdef GL_PROFILE_GL3
     glBindVertexArray(g_vao);
 #endif
 
     glEnable(GL_DEPTH_TEST);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 
-    glCheckError();
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glCheckError();
-    glVertexAttribPointer(attribs.g_Position, 3, GL_FLOAT, GL_FALSE, sizeof(vtxData), (void*)offsetof(vtxData, pos));
-    glEnableVertexAttribArray(attribs.g_Position);
-    glCheckError();
-
-    glVertexAttribPointer(attribs.g_Normal, 3, GL_FLOAT, GL_FALSE, sizeof(vtxData), (void*)offsetof(vtxData, norm));
-    glEnableVertexAttribArray(attribs.g_Normal);
-    glCheckError();
+    if (useInstancing && !instances.empty())
+    {
+        if (instanceVbo == 0)
+        {
+            glGenBuffers(1, &instanceVbo);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        if (frustumCulling || (lodSelection && lods.size() > 1))
+        {
+            // The visible set and its order change with the camera, so this is re-uploaded every frame
+            glBufferData(GL_ARRAY_BUFFER, visibleTransforms.size() * sizeof(glm::mat4), visibleTransforms.data(), GL_STREAM_DRAW);
+            instancesDirty = true;
+        }
+        else if (instancesDirty)
+        {
+            glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_STATIC_DRAW);
+            instancesDirty = false;
+        }
+        glCheckError();
+    }
 
-    glVertexAttribPointer(attribs.g_TexCoord0, 3, GL_FLOAT, GL_FALSE, sizeof(vtxData), (void*)offsetof(vtxData, texcoord));
-    glEnableVertexAttribArray(attribs.g_TexCoord0);
-    glCheckError();
+    PrepassState prepass = PREPASS_OFF;
+    const shaderProgram* depthOnly = depthPrepass ? depthProgram(prog, prepass) : NULL;
+    if (mainCamera)
+    {
+        prepassState = prepass;
+    }
+    if (depthOnly != NULL)
+    {
+        // Same instances, levels of detail and clusters as the shading pass; the occlusion
+        // queries are issued here, where they do the most good
+        glUseProgram(depthOnly->program);
+        setupVertexAttribs(*depthOnly);
+        uploadUniforms(*depthOnly, unfData);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        drawTeapots(*depthOnly, model, clustered, true);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        // Only the nearest surface matches the depth buffer now, and there's nothing left to write
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        glCheckError();
+    }
 
-    glVertexAttribPointer(attribs.g_Tangent, 3, GL_FLOAT, GL_FALSE, sizeof(vtxData), (void*)offsetof(vtxData, tangent));
-    glEnableVertexAttribArray(attribs.g_Tangent);
-    glCheckError();
+    glUseProgram(prog.program);
 
-    glVertexAttribPointer(attribs.g_Binormal, 3, GL_FLOAT, GL_FALSE, sizeof(vtxData), (void*)offsetof(vtxData, binorm));
-    glEnableVertexAttribArray(attribs.g_Binormal);
     glCheckError();
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-
+    setupVertexAttribs(prog);
     glCheckError();
 
-    glUniformMatrix4fv(uniforms.world, 1, GL_FALSE, &unfData.world[0][0]);
-    glUniformMatrix4fv(uniforms.worldViewProj, 1, GL_FALSE, &unfData.worldViewProj[0][0]);
-    glUniformMatrix4fv(uniforms.worldInverseTranspose, 1, GL_FALSE, &unfData.worldInverseTranspose[0][0]);
-    glUniformMatrix4fv(uniforms.viewInverse, 1, GL_FALSE, &unfData.viewInverse[0][0]);
+    uploadUniforms(prog, unfData);
 
     glCheckError();
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, tex_bump);
     glUniform1i(uniforms.normalSampler, 0);
+    // Only the static sky has blurred levels; the cubemap rendered from the scene stays a mirror
+    const bool rough = (prog.features & SHADER_ROUGH) != 0;
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, tex_skybox);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, rough && environment == tex_skybox ? tex_prefiltered : environment);
     glUniform1i(uniforms.envSampler, 1);
+    if (rough)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, tex_irradiance);
+        glUniform1i(uniforms.irradianceSampler, 2);
+        // Rougher surfaces scatter more of the light around them, which is what the irradiance map holds
+        glUniform2f(uniforms.roughParams, roughness * (roughLevels - 1), 0.5f * roughness);
+    }
+    glUniform4f(uniforms.fogParams, fogColor.r, fogColor.g, fogColor.b, fogDensity);
+
+    drawTeapots(prog, model, clustered, depthOnly == NULL);
 
-    glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, 0);
+    if (depthOnly != NULL)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+    return complete;
+}
+
+void Teapot::drawTeapots(const shaderProgram& prog, const glm::mat4& model, bool clustered, bool issueQueries)
+{
+    if (instances.empty())
+    {
+        drawLod(visibleLods[0]);
+    }
+    else if (prog.features & SHADER_INSTANCED)
+    {
+        setInstanceAttribs(prog, true);
+        if (clustered)
+        {
+            drawClustersOccluded(prog, issueQueries);
+        }
+        else
+        {
+            drawInstanceRuns(prog, 0, (size_t)stats.drawn);
+        }
+        setInstanceAttribs(prog, false);
+    }
+    else
+    {
+        // No instancing support: fall back to a uniform update and a draw call per instance
+        uniformData instData = unfData;
+        for (size_t i = 0; i < visibleInstances.size(); ++i)
+        {
+            instData.world = instances[visibleInstances[i]] * model;
+            instData.worldInverseTranspose = glm::transpose(glm::inverse(instData.world));
+            instData.worldViewProj = unfData.viewProj * instData.world;
+            uploadUniforms(prog, instData);
+            drawLod(visibleLods[i]);
+        }
+    }
+}
+
+void Teapot::setupVertexAttribs(const shaderProgram& prog)
+{
+    // Permutations without bump mapping don't read texture coordinates and tangents
+    const auto& attribs = prog.attribs;
+    const GLint locations[] = {attribs.g_Position, attribs.g_Normal, attribs.g_Tangent, attribs.g_TexCoord0};
+    if ((prog.features & SHADER_DEPTH_ONLY) && positionVbo != 0)
+    {
+        // Same component type and count as in the vertices below, just without the other attributes
+        const bool packed = (prog.features & SHADER_QUANTIZED_VERTICES) != 0;
+        glBindBuffer(GL_ARRAY_BUFFER, positionVbo);
+        glVertexAttribPointer(attribs.g_Position, 3, packed ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE,
+                              packed ? sizeof(PackedVertex::pos) : sizeof(FloatVertex::pos), 0);
+        glEnableVertexAttribArray(attribs.g_Position);
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (prog.features & SHADER_QUANTIZED_VERTICES)
+    {
+        const GLsizei stride = sizeof(PackedVertex);
+        const GLint sizes[] = {3, 4, 4, 2};
+        const GLenum types[] = {GL_HALF_FLOAT, GL_INT_2_10_10_10_REV, GL_INT_2_10_10_10_REV, GL_HALF_FLOAT};
+        const GLboolean normalized[] = {GL_FALSE, GL_TRUE, GL_TRUE, GL_FALSE};
+        const size_t offsets[] = {offsetof(PackedVertex, pos), offsetof(PackedVertex, normal),
+                                  offsetof(PackedVertex, tangent), offsetof(PackedVertex, texcoord)};
+        for (int i = 0; i < 4; ++i)
+        {
+            if (locations[i] >= 0)
+            {
+                glVertexAttribPointer(locations[i], sizes[i], types[i], normalized[i], stride, (void*)offsets[i]);
+            }
+        }
+    }
+    else
+    {
+        const GLsizei stride = sizeof(FloatVertex);
+        const GLint sizes[] = {3, 3, 4, 2};
+        const size_t offsets[] = {offsetof(FloatVertex, pos), offsetof(FloatVertex, normal),
+                                  offsetof(FloatVertex, tangent), offsetof(FloatVertex, texcoord)};
+        for (int i = 0; i < 4; ++i)
+        {
+            if (locations[i] >= 0)
+            {
+                glVertexAttribPointer(locations[i], sizes[i], GL_FLOAT, GL_FALSE, stride, (void*)offsets[i]);
+            }
+        }
+    }
+    for (GLint location : locations)
+    {
+        if (location >= 0)
+        {
+            glEnableVertexAttribArray(location);
+        }
+    }
+}
+
+void Teapot::uploadUniforms(const shaderProgram& prog, const uniformData& data)
+{
+    if (ubo)
+    {
+        // One upload for the whole block; programs pick it up from the shared binding point
+        glBindBufferBase(GL_UNIFORM_BUFFER, teapotUniformBinding, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(uniformData), &data, GL_DYNAMIC_DRAW);
+    }
+    else
+    {
+        const auto& uniforms = prog.uniforms;
+        glUniformMatrix4fv(uniforms.world, 1, GL_FALSE, &data.world[0][0]);
+        glUniformMatrix4fv(uniforms.worldViewProj, 1, GL_FALSE, &data.worldViewProj[0][0]);
+        glUniformMatrix4fv(uniforms.worldInverseTranspose, 1, GL_FALSE, &data.worldInverseTranspose[0][0]);
+        glUniformMatrix4fv(uniforms.viewInverse, 1, GL_FALSE, &data.viewInverse[0][0]);
+        glUniformMatrix4fv(uniforms.viewProj, 1, GL_FALSE, &data.viewProj[0][0]);
+    }
+}
+
+void Teapot::cullInstances(const Frustum& frustum)
+{
+    memset(&stats, 0, sizeof(stats));
+    if (instances.empty())
+    {
+        stats.objects = 1;
+        bool visible = !frustumCulling ||
+                       sphereInFrustum(frustum, teapotPivot.x, teapotPivot.y, teapotPivot.z, boundingRadius);
+        stats.drawn = visible ? 1 : 0;
+        stats.frustumCulled = 1 - stats.drawn;
+        return;
+    }
+
+    const size_t count = instances.size();
+    stats.objects = (int)count;
+    visibleInstances.resize(count);
+    size_t visibleCount = count;
+    if (frustumCulling)
+    {
+        visibleCount = cullSpheres(frustum, instanceBounds, visibleInstances.data());
+        visibleTransforms.resize(visibleCount);
+        for (size_t i = 0; i < visibleCount; ++i)
+        {
+            visibleTransforms[i] = instances[visibleInstances[i]];
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            visibleInstances[i] = (uint32_t)i;
+        }
+    }
+    visibleInstances.resize(visibleCount);
+    stats.drawn = (int)visibleCount;
+    stats.frustumCulled = (int)(count - visibleCount);
+}
+
+void Teapot::setInstanceAttribs(const shaderProgram& prog, bool enabled)
+{
+    // mat4 attributes take up four consecutive locations, one for each column
+    for (GLuint col = 0; col < 4; ++col)
+    {
+        GLuint location = prog.attribs.g_InstanceWorld + col;
+        if (enabled)
+        {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        else
+        {
+            // Leave attribute state the way other users expect it to be
+            glVertexAttribDivisor(location, 0);
+            glDisableVertexAttribArray(location);
+        }
+    }
+}
+
+void Teapot::drawInstanced(const shaderProgram& prog, size_t first, size_t count, int lod)
+{
+    // There's no base instance in GL 3.3 / ES 3.0, so point the attributes at the first one instead
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+    for (GLuint col = 0; col < 4; ++col)
+    {
+        GLuint location = prog.attribs.g_InstanceWorld + col;
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (void*)(first * sizeof(glm::mat4) + col * sizeof(glm::vec4)));
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, lods[lod].indexCount, indexType, (void*)lods[lod].offset, (GLsizei)count);
+    glCheckError();
+}
+
+void Teapot::drawInstanceRuns(const shaderProgram& prog, size_t first, size_t count)
+{
+    // selectLods() put instances with the same level next to each other: one draw per run
+    const size_t end = first + count;
+    for (size_t i = first; i < end;)
+    {
+        size_t runEnd = i + 1;
+        while (runEnd < end && visibleLods[runEnd] == visibleLods[i])
+        {
+            ++runEnd;
+        }
+        drawInstanced(prog, i, runEnd - i, visibleLods[i]);
+        i = runEnd;
+    }
+}
+
+void Teapot::drawLod(int lod)
+{
+    glDrawElements(GL_TRIANGLES, lods[lod].indexCount, indexType, (void*)lods[lod].offset);
+}
+
+int Teapot::pickLod(float radiusPixels, int current)
+{
+    // Coarsest level whose error stays within budget on screen
+    auto coarsestWithin = [this, radiusPixels](float budget) {
+        int lod = 0;
+        while (lod + 1 < (int)lods.size() && lods[lod + 1].relativeError * radiusPixels <= budget)
+        {
+            ++lod;
+        }
+        return lod;
+    };
+    if (current < 0)
+    {
+        return coarsestWithin(lodErrorPixels);
+    }
+    // Anything between what a stricter and a looser budget allow will do; stay put if possible
+    const int finest = coarsestWithin(lodErrorPixels / (1.0f + lodHysteresis));
+    const int coarsest = coarsestWithin(lodErrorPixels * (1.0f + lodHysteresis));
+    return std::max(finest, std::min(current, coarsest));
+}
+
+void Teapot::selectLods(const glm::mat4& projection, bool mainCamera, bool clustered)
+{
+    const bool active = lodSelection && lods.size() > 1;
+    const size_t visibleCount = instances.empty() ? 1 : visibleInstances.size();
+    visibleLods.assign(visibleCount, 0);
+
+    if (active)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        // On-screen pixels per world unit, one unit away from the eye
+        const float pixelScale = projection[1][1] * 0.5f * (float)viewport[3];
+        const glm::vec3 eye(unfData.viewInverse[3]);
+        if (instances.empty())
+        {
+            const float radiusPixels = boundingRadius * pixelScale / std::max(glm::length(teapotPivot - eye), 1e-3f);
+            visibleLods[0] = (uint8_t)pickLod(radiusPixels, mainCamera ? teapotLod : -1);
+            if (mainCamera)
+            {
+                teapotLod = visibleLods[0];
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < visibleCount; ++i)
+            {
+                const uint32_t index = visibleInstances[i];
+                glm::vec3 center(instanceBounds.x[index], instanceBounds.y[index], instanceBounds.z[index]);
+                const float radius = instanceBounds.radius[index];
+                const float radiusPixels = radius * pixelScale / std::max(glm::length(center - eye), 1e-3f);
+                visibleLods[i] = (uint8_t)pickLod(radiusPixels, mainCamera ? instanceLods[index] : -1);
+                if (mainCamera)
+                {
+                    instanceLods[index] = visibleLods[i];
+                }
+            }
+
+            // Group instances by level, so each level is one instanced draw; within each cluster
+            // when clusters are drawn one by one, since they have to stay contiguous
+            std::vector<uint32_t> order(visibleCount);
+            for (size_t i = 0; i < visibleCount; ++i)
+            {
+                order[i] = (uint32_t)i;
+            }
+            const size_t levels = lods.size();
+            auto key = [&](uint32_t i) {
+                return (clustered ? visibleInstances[i] / instancesPerCluster * levels : 0) + visibleLods[i];
+            };
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return key(a) < key(b);
+            });
+            std::vector<uint32_t> sortedInstances(visibleCount);
+            std::vector<uint8_t> sortedLods(visibleCount);
+            visibleTransforms.resize(visibleCount);
+            for (size_t i = 0; i < visibleCount; ++i)
+            {
+                sortedInstances[i] = visibleInstances[order[i]];
+                sortedLods[i] = visibleLods[order[i]];
+                visibleTransforms[i] = instances[sortedInstances[i]];
+            }
+            visibleInstances.swap(sortedInstances);
+            visibleLods.swap(sortedLods);
+        }
+    }
+
+    const int fullTriangles = lods[0].indexCount / 3;
+    for (uint8_t lod : visibleLods)
+    {
+        stats.triangles += lods[lod].indexCount / 3;
+    }
+    stats.trianglesSaved = fullTriangles * (int)visibleCount - stats.triangles;
+}
+
+void Teapot::setInstances(const std::vector<glm::mat4>& transforms)
+{
+    BoundingSpheres bounds;
+    bounds.resize(transforms.size());
+    for (size_t i = 0; i < transforms.size(); ++i)
+    {
+        const glm::mat4& t = transforms[i];
+        glm::vec4 center = t * glm::vec4(teapotPivot, 1.0f);
+        bounds.x[i] = center.x;
+        bounds.y[i] = center.y;
+        bounds.z[i] = center.z;
+        // Uniform scale, so any column will do
+        bounds.radius[i] = boundingRadius * glm::length(glm::vec3(t[0]));
+    }
+
+    // Keep nearby instances next to each other: frustum culling then leaves long runs of
+    // visible instances, and consecutive instances can share an occlusion query
+    std::vector<uint32_t> order = spatialOrder(bounds);
+    instances.resize(transforms.size());
+    instanceBounds.resize(transforms.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        uint32_t from = order[i];
+        instances[i] = transforms[from];
+        instanceBounds.x[i] = bounds.x[from];
+        instanceBounds.y[i] = bounds.y[from];
+        instanceBounds.z[i] = bounds.z[from];
+        instanceBounds.radius[i] = bounds.radius[from];
+    }
+    instancesDirty = true;
+    ++contentVersion;
+    buildClusters();
+    instanceLods.assign(instances.size(), 0);
+
+    // The probe goes in the middle of the instances. Whichever instance it ends up inside is left out
+    // by the near plane, like the single teapot is; from the inside, it would cover everything else.
+    probeCenter = teapotPivot;
+    probeNear = boundingRadius;
+    if (!instances.empty())
+    {
+        glm::vec3 sum(0.0f);
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            sum += glm::vec3(instanceBounds.x[i], instanceBounds.y[i], instanceBounds.z[i]);
+        }
+        probeCenter = sum / (float) instances.size();
+        probeNear = 1.0f;
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            float distance = glm::length(glm::vec3(instanceBounds.x[i], instanceBounds.y[i], instanceBounds.z[i]) - probeCenter);
+            if (distance < instanceBounds.radius[i])
+            {
+                probeNear = std::max(probeNear, distance + instanceBounds.radius[i]);
+            }
+        }
+    }
+}
+
+int Teapot::instanceCount()
+{
+    return instances.empty() ? 1 : (int)instances.size();
+}
+
+void Teapot::setFrustumCulling(bool enabled)
+{
+    frustumCulling = enabled;
+    instancesDirty = true;
+}
+
+void Teapot::setOcclusionCulling(bool enabled)
+{
+    // Draws the same thing either way, in theory; queries from before a switch may disagree for a frame
+    if (enabled != occlusionCulling)
+    {
+        ++contentVersion;
+    }
+    occlusionCulling = enabled;
+}
+
+bool Teapot::occlusionCullingSupported()
+{
+    return boxProgram != 0;
+}
+
+void Teapot::setLodSelection(bool enabled, float maxErrorPixels)
+{
+    if (enabled != lodSelection || (enabled && maxErrorPixels != lodErrorPixels))
+    {
+        ++contentVersion;
+    }
+    lodSelection = enabled;
+    lodErrorPixels = maxErrorPixels;
+}
+
+int Teapot::lodCount()
+{
+    return (int)lods.size();
+}
+
+void Teapot::setDepthPrepass(bool enabled)
+{
+    // The picture stays the same, but a redraw makes the cost of the switch show up right away
+    if (enabled != depthPrepass)
+    {
+        ++contentVersion;
+    }
+    depthPrepass = enabled;
+}
+
+Teapot::PrepassState Teapot::depthPrepassState()
+{
+    return prepassState;
+}
+
+void Teapot::setShaderFeatures(unsigned enabled)
+{
+    unsigned masked = enabled & (SHADER_BUMP | SHADER_REFLECTION | SHADER_FOG | SHADER_ROUGH);
+    if (!roughReflectionsSupported())
+    {
+        masked &= ~SHADER_ROUGH;
+    }
+    if (masked != features)
+    {
+        ++contentVersion;
+    }
+    features = masked;
+}
+
+unsigned Teapot::shaderFeatures()
+{
+    return features;
+}
+
+unsigned Teapot::defaultShaderFeatures()
+{
+    unsigned defaults = SHADER_BUMP | SHADER_REFLECTION;
+    if (!glCaps().glsl3)
+    {
+        // The bump map lookup and the extra varyings are what hurts most on that class of GPUs
+        defaults &= ~SHADER_BUMP;
+    }
+    return defaults;
+}
+
+void Teapot::setFog(const glm::vec3& color, float density)
+{
+    if ((color != fogColor) || (density != fogDensity))
+    {
+        ++contentVersion;
+    }
+    fogColor = color;
+    fogDensity = density;
+}
+
+void Teapot::setRoughness(float value)
+{
+    value = std::max(0.0f, std::min(value, 1.0f));
+    if (value != roughness && (features & SHADER_ROUGH))
+    {
+        ++contentVersion;
+    }
+    roughness = value;
+}
+
+bool Teapot::roughReflectionsSupported()
+{
+    return tex_prefiltered != 0;
+}
+
+const Teapot::CullingStats& Teapot::cullingStats()
+{
+    return stats;
 }
 
 void Teapot::rotateBy(float angleX, float angleY)
 {
+    if ((angleX != 0.0f) || (angleY != 0.0f))
+    {
+        ++contentVersion;
+    }
     addRotX += angleX;
     addRotY += angleY;
 }
 
 void Teapot::rotateTo(float angleX)
 {
+    if (angleX != rotX)
+    {
+        ++contentVersion;
+    }
     rotX = angleX;
 }
 
 void Teapot::rotateCameraTo(float angleX)
 {
+    cameraDirty |= (angleX != camRX);
     camRX = angleX;
 }
 
 void Teapot::rotateCameraBy(float angleX, float angleY)
 {
+    cameraDirty |= (angleX != 0.0f) || (angleY != 0.0f);
     addCamRX -= angleX;
     addCamRY -= angleY;
 }
 
 void Teapot::zoomBy(float zoomFactor)
 {
+    // Zooming only moves the main camera, but it also drops object rotations that haven't been
+    // applied yet, and other views may already have been drawn expecting them
+    if ((addRotX != 0.0f) || (addRotY != 0.0f))
+    {
+        ++contentVersion;
+    }
+    cameraDirty = true;
     addRotX = 0;
     addRotY = 0;
     addCamRX = 0;
@@ -396,74 +1304,370 @@ void Teapot::zoomBy(float zoomFactor)
     addZoom += zoomFactor;
 }
 
-static GLint compileShader(GLenum shaderType, const char* shaderSrc)
+Teapot::shaderProgram& Teapot::permutation(unsigned permutationFeatures)
 {
-    GLuint shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, &shaderSrc, NULL);
-    glCompileShader(shader);
-    int status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
+    std::unique_ptr<shaderProgram>& slot = permutations[permutationFeatures];
+    if (!slot)
     {
-        // Assume we only care about vertex and fragment shaders
-        Log(LOG_ERROR) << "Could not compile shader! Shader type: " << ((shaderType == GL_VERTEX_SHADER) ? "vertex" : "fragment");
-        GLint logLength;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
-        std::vector<char> infoLog(logLength + 1);
-        glGetShaderInfoLog(shader, infoLog.size(), &logLength, infoLog.data());
-        Log(LOG_ERROR) << "Error log: " << infoLog.data();
-        Log(LOG_ERROR) << "Shader source: " << shaderSrc;
-        glDeleteShader(shader);
-        return -1;
+        slot.reset(new shaderProgram());
+        slot->features = permutationFeatures;
+        slot->program = 0;
+        const char* frag = (permutationFeatures & SHADER_DEPTH_ONLY) ? boxFragShader : fragShader;
+        slot->build.start(featureDefines(permutationFeatures).c_str(), vtxShader, frag);
     }
-    return shader;
+    return *slot;
+}
+
+unsigned Teapot::wantedPermutation(bool instanced)
+{
+    // Roughness only changes the reflection; no point compiling a copy of the plain diffuse program
+    const unsigned used = (features & SHADER_REFLECTION) ? features : (features & ~SHADER_ROUGH);
+    return used | (instanced ? SHADER_INSTANCED : 0) | (packedVertices ? SHADER_QUANTIZED_VERTICES : 0);
 }
 
-bool Teapot::compileShaders() {
-    GLint vertexShader = compileShader(GL_VERTEX_SHADER, vtxShader);
-    GLint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragShader);
-    if (vertexShader < 0 || fragmentShader < 0)
+bool Teapot::needsRedraw()
+{
+    return cameraDirty || programPending || (drawnContent != contentChanges());
+}
+
+unsigned Teapot::contentChanges()
+{
+    return contentVersion + environmentUpdates;
+}
+
+void Teapot::setDynamicEnvironment(bool enabled, int facesPerFrame)
+{
+    if (enabled != dynamicEnvironment)
     {
-        // Delete any shaders that were actually compiled
-        if (vertexShader >= 0) {glDeleteShader(vertexShader);}
-        if (fragmentShader >= 0) {glDeleteShader(fragmentShader);}
-        return false;
+        ++contentVersion;
     }
+    dynamicEnvironment = enabled;
+    environmentFaces = std::max(1, std::min(facesPerFrame, (int) EnvironmentProbe::faceCount));
+}
 
-    program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        Log(LOG_ERROR) << "Could not link shaders; interface mismatch?";
-        GLint logLength;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-        std::vector<char> infoLog(logLength + 1);
-        glGetProgramInfoLog(program, infoLog.size(), &logLength, infoLog.data());
-        Log(LOG_ERROR) << "Error log: " << infoLog.data();
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        glDeleteProgram(program);
-        return false;
+int Teapot::updateEnvironment()
+{
+    if (!dynamicEnvironment)
+    {
+        return 0;
+    }
+    if (!probeInitialized)
+    {
+        // Only paid for once it's asked for
+        probeInitialized = true;
+        probe.init(environmentSize);
+    }
+    if (!probe.ready())
+    {
+        return 0;
+    }
+
+    TRACE_SCOPE("Teapot::updateEnvironment");
+    int updated = 0;
+    int face;
+    while (updated < environmentFaces && (face = probe.nextFace(contentVersion)) >= 0)
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        probe.beginFace(face, tex_skybox, probeCenter, probeNear, 500.0f, view, projection);
+        // The faces reflect the static sky: the cubemap can't be sampled while it's being drawn into
+        if (!drawScene(view, projection, false, false, tex_skybox))
+        {
+            // A stand-in program drew this; leave the face to be redone
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            break;
+        }
+        probe.endFace(face, contentVersion);
+        ++updated;
+    }
+    if (updated != 0)
+    {
+        ++environmentUpdates;
+    }
+    return updated;
+}
+
+GLuint Teapot::environmentTexture()
+{
+    return dynamicEnvironment && probe.complete() ? probe.texture() : tex_skybox;
+}
+
+const Teapot::shaderProgram* Teapot::selectProgram(bool instanced)
+{
+    const unsigned wanted = wantedPermutation(instanced);
+    const shaderProgram& prog = permutation(wanted);
+    updatePrograms();
+    if (prog.program != 0)
+    {
+        lastPermutation = wanted;
+        return &prog;
+    }
+
+    // Still compiling (or failed): keep using the last one, as long as it can draw what we have.
+    // Non-instanced programs can draw instances one by one, instanced ones can't draw a single teapot.
+    if (lastPermutation != SHADER_PERMUTATIONS && (instanced || !(lastPermutation & SHADER_INSTANCED)))
+    {
+        const shaderProgram* last = permutations[lastPermutation].get();
+        if (last != NULL && last->program != 0)
+        {
+            return last;
+        }
     }
+    if (instanced)
+    {
+        const shaderProgram& single = permutation(wanted & ~SHADER_INSTANCED);
+        if (single.program != 0)
+        {
+            return &single;
+        }
+    }
+    return NULL;
+}
+
+const Teapot::shaderProgram* Teapot::depthProgram(const shaderProgram& shading, PrepassState& state)
+{
+    // Has to position vertices exactly the way the shading program does, or GL_EQUAL drops pixels
+    const unsigned transform = shading.features & (SHADER_INSTANCED | SHADER_QUANTIZED_VERTICES);
+    shaderProgram& prog = permutation(transform | SHADER_DEPTH_ONLY);
+    if (prog.program == 0)
+    {
+        // Compiling and picked up by updatePrograms() in a later frame, or failed for good
+        state = prog.build.poll() == ShaderProgram::PROGRAM_FAILED ? PREPASS_FAILED : PREPASS_COMPILING;
+        return NULL;
+    }
+    state = PREPASS_DRAWN;
+    return &prog;
+}
+
+void Teapot::updatePrograms()
+{
+    for (auto& prog : permutations)
+    {
+        if (prog && prog->program == 0 && prog->build.poll() == ShaderProgram::PROGRAM_READY)
+        {
+            resolveLocations(*prog);
+        }
+    }
+#ifdef GL_PROFILE_GL3
+    if (boxProgram == 0 && boxBuild.poll() == ShaderProgram::PROGRAM_READY)
+    {
+        setupBoxProxies();
+    }
+#endif
+}
+
+void Teapot::resolveLocations(shaderProgram& prog)
+{
+    GLuint program = prog.build.id();
+    prog.program = program;
 
     // Get all attribute/uniform locations
 
+    auto& attribs = prog.attribs;
+    auto& uniforms = prog.uniforms;
+
     attribs.g_Position = glGetAttribLocation(program, "g_Position");
     attribs.g_TexCoord0 = glGetAttribLocation(program, "g_TexCoord0");
     attribs.g_Tangent = glGetAttribLocation(program, "g_Tangent");
-    attribs.g_Binormal = glGetAttribLocation(program, "g_Binormal");
     attribs.g_Normal = glGetAttribLocation(program, "g_Normal");
+    attribs.g_InstanceWorld = glGetAttribLocation(program, "g_InstanceWorld");
 
     uniforms.world = glGetUniformLocation(program, "world");
     uniforms.worldInverseTranspose = glGetUniformLocation(program, "worldInverseTranspose");
     uniforms.worldViewProj = glGetUniformLocation(program, "worldViewProj");
     uniforms.viewInverse = glGetUniformLocation(program, "viewInverse");
+    uniforms.viewProj = glGetUniformLocation(program, "viewProj");
     uniforms.normalSampler = glGetUniformLocation(program, "normalSampler");
     uniforms.envSampler = glGetUniformLocation(program, "envSampler");
+    uniforms.fogParams = glGetUniformLocation(program, "fogParams");
+    uniforms.irradianceSampler = glGetUniformLocation(program, "irradianceSampler");
+    uniforms.roughParams = glGetUniformLocation(program, "roughParams");
 
-    return true;
+    if (glCaps().uniformBuffers)
+    {
+        GLuint blockIndex = glGetUniformBlockIndex(program, "TeapotUniforms");
+        if (blockIndex != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, blockIndex, teapotUniformBinding);
+        }
+    }
+}
+
+void Teapot::initOcclusionCulling()
+{
+#ifdef GL_PROFILE_GL3
+    boxBuild.start("", boxVtxShader, boxFragShader);
+#endif
+}
+
+void Teapot::setupBoxProxies()
+{
+#ifdef GL_PROFILE_GL3
+    boxProgram = boxBuild.id();
+    boxPositionLocation = glGetAttribLocation(boxProgram, "g_Position");
+    boxTransformLocation = glGetUniformLocation(boxProgram, "boxTransform");
+
+    // Boxes get a VAO of their own, so switching between them and the teapot is cheap
+    glGenVertexArrays(1, &boxVao);
+    glBindVertexArray(boxVao);
+    glGenBuffers(1, &boxVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, boxVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(boxVertices), boxVertices, GL_STATIC_DRAW);
+    glGenBuffers(1, &boxIbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(boxIndices), boxIndices, GL_STATIC_DRAW);
+    glVertexAttribPointer(boxPositionLocation, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+    glEnableVertexAttribArray(boxPositionLocation);
+    glBindVertexArray(g_vao);
+#endif
+}
+
+void Teapot::buildClusters()
+{
+    deleteClusters();
+    const size_t count = (instances.size() + instancesPerCluster - 1) / instancesPerCluster;
+    clusters.resize(count);
+    for (size_t c = 0; c < count; ++c)
+    {
+        instanceCluster& cluster = clusters[c];
+        size_t end = std::min(instances.size(), (c + 1) * instancesPerCluster);
+        for (size_t i = c * instancesPerCluster; i < end; ++i)
+        {
+            glm::vec3 center(instanceBounds.x[i], instanceBounds.y[i], instanceBounds.z[i]);
+            glm::vec3 radius(instanceBounds.radius[i]);
+            bool first = (i == c * instancesPerCluster);
+            cluster.boxMin = first ? center - radius : glm::min(cluster.boxMin, center - radius);
+            cluster.boxMax = first ? center + radius : glm::max(cluster.boxMax, center + radius);
+        }
+        cluster.query = 0;
+        cluster.queryIssued = false;
+        cluster.occluded = false;
+    }
+#ifdef GL_PROFILE_GL3
+    // The box program may still be compiling at this point
+    if (glCaps().conditionalRender)
+    {
+        for (auto& cluster : clusters)
+        {
+            glGenQueries(1, &cluster.query);
+        }
+    }
+#endif
+}
+
+void Teapot::deleteClusters()
+{
+#ifdef GL_PROFILE_GL3
+    for (const auto& cluster : clusters)
+    {
+        if (cluster.query)
+        {
+            glDeleteQueries(1, &cluster.query);
+        }
+    }
+#endif
+    clusters.clear();
+}
+
+void Teapot::drawClustersOccluded(const shaderProgram& prog, bool issueQueries)
+{
+#ifdef GL_PROFILE_GL3
+    // Boxes closer than this to the camera may be cut by the near plane and show no samples
+    // even though the teapots inside are visible, so those clusters are drawn unconditionally
+    const float nearMargin = 10.0f;
+    const glm::vec3 eye(unfData.viewInverse[3]);
+
+    struct clusterRange {
+        size_t cluster;
+        size_t first;
+        size_t count;
+        float distance;
+    };
+    std::vector<clusterRange> ranges;
+
+    // Instances of a cluster are contiguous and visibleInstances is sorted, so each cluster's
+    // visible instances are a single run in the instance buffer
+    for (size_t i = 0; i < visibleInstances.size();)
+    {
+        size_t cluster = visibleInstances[i] / instancesPerCluster;
+        size_t end = i + 1;
+        while (end < visibleInstances.size() && visibleInstances[end] / instancesPerCluster == cluster)
+        {
+            ++end;
+        }
+        const instanceCluster& c = clusters[cluster];
+        clusterRange range = {cluster, i, end - i, glm::length(0.5f * (c.boxMin + c.boxMax) - eye)};
+        ranges.push_back(range);
+        i = end;
+    }
+
+    // Front to back, so that near clusters are in the depth buffer by the time far ones are tested
+    std::sort(ranges.begin(), ranges.end(), [](const clusterRange& a, const clusterRange& b) {
+        return a.distance < b.distance;
+    });
+
+    for (const auto& range : ranges)
+    {
+        instanceCluster& cluster = clusters[range.cluster];
+        if (issueQueries && cluster.queryIssued)
+        {
+            // Only for the stats; never stall on a result that isn't there yet
+            GLuint available = 0;
+            glGetQueryObjectuiv(cluster.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint anySamples = 0;
+                glGetQueryObjectuiv(cluster.query, GL_QUERY_RESULT, &anySamples);
+                cluster.occluded = (anySamples == 0);
+            }
+        }
+
+        bool eyeNearBox = glm::all(glm::greaterThan(eye, cluster.boxMin - nearMargin)) &&
+                          glm::all(glm::lessThan(eye, cluster.boxMax + nearMargin));
+        if (eyeNearBox)
+        {
+            drawInstanceRuns(prog, range.first, range.count);
+            continue;
+        }
+        if (!issueQueries)
+        {
+            // Shading after the depth pre-pass: its queries for this frame decide
+            glBeginConditionalRender(cluster.query, GL_QUERY_NO_WAIT);
+            drawInstanceRuns(prog, range.first, range.count);
+            glEndConditionalRender();
+            continue;
+        }
+
+        glm::vec3 center = 0.5f * (cluster.boxMin + cluster.boxMax);
+        glm::vec3 halfSize = 0.5f * (cluster.boxMax - cluster.boxMin);
+        glm::mat4 boxTransform = unfData.viewProj * glm::scale(glm::translate(glm::mat4(1.0f), center), halfSize);
+
+        glBindVertexArray(boxVao);
+        glUseProgram(boxProgram);
+        glUniformMatrix4fv(boxTransformLocation, 1, GL_FALSE, &boxTransform[0][0]);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, cluster.query);
+        glDrawElements(GL_TRIANGLES, sizeof(boxIndices) / sizeof(boxIndices[0]), GL_UNSIGNED_SHORT, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        const GLboolean colorWrites = (prog.features & SHADER_DEPTH_ONLY) ? GL_FALSE : GL_TRUE;
+        glColorMask(colorWrites, colorWrites, colorWrites, colorWrites);
+        glDepthMask(GL_TRUE);
+        cluster.queryIssued = true;
+
+        // NO_WAIT: if the result isn't ready by the time the GPU gets here, it just draws
+        glBindVertexArray(g_vao);
+        glUseProgram(prog.program);
+        glBeginConditionalRender(cluster.query, GL_QUERY_NO_WAIT);
+        drawInstanceRuns(prog, range.first, range.count);
+        glEndConditionalRender();
+
+        stats.queriedClusters++;
+        stats.occludedClusters += cluster.occluded ? 1 : 0;
+    }
+    glCheckError();
+#else
+    (void)issueQueries;
+    drawInstanceRuns(prog, 0, visibleInstances.size());
+#endif
 }
@@ -5,12 +5,14 @@
 #ifndef IMGUI_DEMO_TEAPOT_H
 #define IMGUI_DEMO_TEAPOT_H
 
-#ifdef GL_PROFILE_GL3
-#include "gl_glcore_3_3.h"
-#else
-#include <GLES2/gl2.h>
-#endif
+#include "gl_ext.h"
+#include "culling.h"
+#include "shader_program.h"
+#include "environment_probe.h"
+#include "environment_prefilter.h"
 
+#include <memory>
+#include <vector>
 #include <glm/common.hpp>
 #include <glm/matrix.hpp>
 
@@ -27,56 +29,353 @@ public:
     void zoomBy(float zoomFactor);
     float zoomValue();
 
-private:
-    struct vtxData {
-        glm::vec3 pos;
-        glm::vec3 norm;
-        glm::vec3 tangent;
-        glm::vec3 binorm;
-        glm::vec3 texcoord;
+    /**
+     * A camera of its own, for drawing the scene from somewhere else than the one draw() uses
+     */
+    struct View {
+        // Orbit angles around the teapot, radians; camRY is expected within (-pi/2, pi/2)
+        float camRX;
+        float camRY;
+        // 1 is the default field of view, larger zooms in
+        float zoom;
+    };
+
+    /**
+     * Draw the scene into the current viewport from the given camera instead of the main one.
+     * Pending rotations and zoom aren't applied and the main camera is left alone. Occlusion
+     * culling is off for these, since its query results belong to the main camera.
+     * @return false if a program that's still compiling had to be substituted (or nothing could be
+     * drawn yet); the picture should be redone later
+     */
+    bool drawView(const View& camera);
+
+    /**
+     * @return true if draw() would draw something different from the last time: the transforms,
+     * instances, shader features or fog changed since, or the last frame was drawn while the
+     * program it asked for was still compiling. Size and contents of the framebuffer are the
+     * caller's business.
+     */
+    bool needsRedraw();
+
+    /**
+     * @return A counter that changes whenever something other than the main camera changes what's
+     * drawn; compare against the value from the last drawView() to see if a picture is out of date
+     */
+    unsigned contentChanges();
+
+    /**
+     * Draw a copy of the teapot for each of the supplied transforms instead of a single one.
+     * Transforms are applied on top of the teapot's own rotation and are expected to
+     * be rigid with uniform scale (normals are transformed by them as-is).
+     * Uses instanced rendering when available, falls back to one draw call per copy otherwise.
+     * Copies are kept sorted by position for culling, so draw order does not follow the vector.
+     * @param transforms Per-instance world transforms; an empty vector draws a single teapot
+     */
+    void setInstances(const std::vector<glm::mat4>& transforms);
+    int instanceCount();
+
+    /**
+     * Feature bits of the teapot shader; each combination in use is compiled into a program of its own.
+     * Only SHADER_BUMP, SHADER_REFLECTION, SHADER_FOG and SHADER_ROUGH can be changed with
+     * setShaderFeatures(), the others follow from the instance count, the vertex format and the
+     * depth pre-pass.
+     */
+    enum ShaderFeature {
+        // Perturb normals with the bump map; needs texture coordinates and tangents
+        SHADER_BUMP = 1 << 0,
+        // Reflect the environment cubemap; otherwise a plain diffuse surface is drawn
+        SHADER_REFLECTION = 1 << 1,
+        // Blend into the fog color with distance from the camera
+        SHADER_FOG = 1 << 2,
+        SHADER_INSTANCED = 1 << 3,
+        // Half float / 10-bit vertex attributes
+        SHADER_QUANTIZED_VERTICES = 1 << 4,
+        // Reflect the prefiltered sky blurred to the roughness from setRoughness(); only has an
+        // effect together with SHADER_REFLECTION
+        SHADER_ROUGH = 1 << 5,
+        // Positions only, no shading; for the depth pre-pass (see setDepthPrepass())
+        SHADER_DEPTH_ONLY = 1 << 6,
+        SHADER_PERMUTATIONS = 1 << 7
+    };
+
+    /**
+     * Pick the shader variant to draw with. The program is compiled the first time a combination is
+     * used; the previous one keeps being drawn with until it's ready.
+     * @param enabled Combination of SHADER_BUMP, SHADER_REFLECTION, SHADER_FOG and SHADER_ROUGH;
+     * SHADER_ROUGH is dropped where roughReflectionsSupported() is false
+     */
+    void setShaderFeatures(unsigned enabled);
+    unsigned shaderFeatures();
+
+    /**
+     * @return Features worth paying for on this context: bump mapping and reflections, without
+     * bump mapping on GLSL 1.x-only (ES2 class) hardware
+     */
+    static unsigned defaultShaderFeatures();
+
+    /**
+     * @param color Fog color, usually the clear color
+     * @param density Exponential fog density, per world unit
+     */
+    void setFog(const glm::vec3& color, float density);
+
+    /**
+     * @param value Surface roughness for SHADER_ROUGH, 0 (mirror) to 1
+     */
+    void setRoughness(float value);
+
+    /**
+     * @return true if the prefiltered maps were made and shaders can pick their mip level
+     */
+    bool roughReflectionsSupported();
+
+    /**
+     * Reflect a cubemap rendered from the scene instead of the static sky. Its faces are only
+     * redrawn by updateEnvironment(), and only when the scene has changed since.
+     * @param facesPerFrame Faces updateEnvironment() may redraw per call, 1 to 6
+     */
+    void setDynamicEnvironment(bool enabled, int facesPerFrame);
+
+    /**
+     * Redraw the faces of the environment cubemap that are out of date, round robin, up to the
+     * per frame limit. Best called before anything else is drawn in the frame; leaves the default
+     * framebuffer bound and the viewport changed.
+     * @return Faces redrawn
+     */
+    int updateEnvironment();
+
+    /**
+     * What the last draw() call did with the teapots in the scene
+     */
+    struct CullingStats {
+        // Teapots in the scene
+        int objects;
+        // Rejected by the view frustum test
+        int frustumCulled;
+        // Submitted for drawing; occlusion culling may still skip some of them on the GPU
+        int drawn;
+        // Clusters that were drawn behind an occlusion query
+        int queriedClusters;
+        // Clusters whose most recent query found no visible samples
+        int occludedClusters;
+        // Triangles submitted for the drawn teapots, and how many fewer that is than at full detail
+        int triangles;
+        int trianglesSaved;
     };
 
+    /**
+     * Skip teapots whose bounding sphere is outside of the view frustum (on by default)
+     */
+    void setFrustumCulling(bool enabled);
+
+    /**
+     * Draw instanced teapots in spatial clusters, front to back, each behind an occlusion
+     * query against its bounding box, and let the GPU skip clusters that are hidden
+     * (conditional rendering). Only has an effect where occlusionCullingSupported() is true.
+     */
+    void setOcclusionCulling(bool enabled);
+    bool occlusionCullingSupported();
+
+    /**
+     * Draw each teapot with the coarsest level of detail from the mesh file whose error, projected
+     * onto the screen, stays under maxErrorPixels. The main camera only switches a teapot to another
+     * level once the projected error is a margin past the switch point, so teapots near it don't
+     * flicker between two levels; other views pick levels afresh each time.
+     */
+    void setLodSelection(bool enabled, float maxErrorPixels);
+    /**
+     * @return Levels of detail in the mesh, including the full one
+     */
+    int lodCount();
+
+    /**
+     * Fill the depth buffer with a position-only pass first, then shade with GL_EQUAL depth testing
+     * and depth writes off, so the teapot shader runs once per pixel instead of once per overlapping
+     * surface. Pays off when there's a lot of overdraw; costs a second round of vertex work otherwise.
+     * Until the depth-only program has compiled, frames are drawn without the pre-pass.
+     */
+    void setDepthPrepass(bool enabled);
+    enum PrepassState {
+        PREPASS_OFF,
+        PREPASS_DRAWN,
+        // Drawn without it, since the depth-only program isn't ready yet, or never will be
+        PREPASS_COMPILING,
+        PREPASS_FAILED,
+        // No teapot was in view, or nothing could be drawn yet
+        PREPASS_NOTHING_DRAWN
+    };
+    /**
+     * @return What became of the depth pre-pass in the last draw()
+     */
+    PrepassState depthPrepassState();
+    const CullingStats& cullingStats();
+
+private:
+    // Matches the std140 layout of the TeapotUniforms block: each mat4 is four
+    // 16-byte aligned columns, which is exactly how glm stores it.
     struct uniformData {
         glm::mat4 world;
         glm::mat4 worldInverseTranspose;
         glm::mat4 worldViewProj;
         glm::mat4 viewInverse;
+        glm::mat4 viewProj;
     } unfData;
 
 #ifdef GL_PROFILE_GL3
     static GLuint g_vao;
 #endif
+    bool packedVertices;
     int num_vertices;
     int num_indices;
+    GLenum indexType;
     GLuint ibo;
     GLuint vbo;
+    // Positions alone, tightly packed, for the depth pre-pass; 0 if the mesh file has none
+    GLuint positionVbo;
     GLuint tex_skybox;
+    // Prefiltered copies of the sky: blurrier with each mip level, and the diffuse light per direction
+    GLuint tex_prefiltered;
+    GLuint tex_irradiance;
+    int prefilteredLevels;
+    int roughLevels;
     GLuint tex_bump;
+    GLuint ubo;
+
+    std::vector<glm::mat4> instances;
+    GLuint instanceVbo;
+    bool instancesDirty;
+
+    // Bounding sphere radius around the teapot's pivot; doesn't change when the teapot rotates
+    float boundingRadius;
+    bool frustumCulling;
+    bool occlusionCulling;
+    CullingStats stats;
+    // World space bounding spheres, one per instance
+    BoundingSpheres instanceBounds;
+    std::vector<uint32_t> visibleInstances;
+    std::vector<glm::mat4> visibleTransforms;
+
+    // Levels of detail in the index buffer, the full mesh first
+    struct meshLod {
+        GLsizei indexCount;
+        // Byte offset into the index buffer
+        size_t offset;
+        // How far the level strays from the full mesh, relative to the bounding radius
+        float relativeError;
+    };
+    std::vector<meshLod> lods;
+    bool lodSelection;
+    float lodErrorPixels;
+    // Level each instance (or the single teapot) was last drawn with by the main camera
+    std::vector<uint8_t> instanceLods;
+    int teapotLod;
+    // Level per entry of visibleInstances; entries with the same level are kept next to each other
+    std::vector<uint8_t> visibleLods;
+    bool depthPrepass;
+    PrepassState prepassState;
+
+    // A run of spatially close instances (setInstances() sorts them that way) sharing an occlusion query
+    struct instanceCluster {
+        glm::vec3 boxMin;
+        glm::vec3 boxMax;
+        GLuint query;
+        bool queryIssued;
+        bool occluded;
+    };
+    std::vector<instanceCluster> clusters;
+    ShaderProgram boxBuild;
+    // Copy of boxBuild's program once it's ready, 0 until then
+    GLuint boxProgram;
+    GLint boxPositionLocation;
+    GLint boxTransformLocation;
+    GLuint boxVao;
+    GLuint boxVbo;
+    GLuint boxIbo;
+
+    struct shaderProgram {
+        unsigned features;
+        ShaderProgram build;
+        // Copy of build's program once it's ready and the locations below are valid, 0 until then
+        GLuint program;
+
+        struct {
+            GLint g_Position;
+            GLint g_TexCoord0;
+            GLint g_Tangent;
+            GLint g_Normal;
+            GLint g_InstanceWorld;
+        } attribs;
+
+        struct {
+            GLint world;
+            GLint worldInverseTranspose;
+            GLint worldViewProj;
+            GLint viewInverse;
+            GLint viewProj;
+            GLint normalSampler;
+            GLint envSampler;
+            GLint fogParams;
+            GLint irradianceSampler;
+            GLint roughParams;
+        } uniforms;
+    };
+
+    // Indexed by feature bits, created on first use
+    std::unique_ptr<shaderProgram> permutations[SHADER_PERMUTATIONS];
+    unsigned features;
+    // Permutation the last frame was drawn with, SHADER_PERMUTATIONS if none
+    unsigned lastPermutation;
+    glm::vec3 fogColor;
+    float fogDensity;
+    float roughness;
+    // Bumped by the setters that change the picture for every camera; draw() remembers what it saw
+    unsigned contentVersion;
+    unsigned drawnContent;
+    // Set by the setters that only move the main camera, cleared by draw()
+    bool cameraDirty;
+    bool programPending;
 
-    struct {
-        GLint g_Position;
-        GLint g_TexCoord0;
-        GLint g_Tangent;
-        GLint g_Binormal;
-        GLint g_Normal;
-    } attribs;
-
-    struct {
-        GLint world;
-        GLint worldInverseTranspose;
-        GLint worldViewProj;
-        GLint viewInverse;
-        GLint normalSampler;
-        GLint envSampler;
-    } uniforms;
-    GLuint program;
+    EnvironmentProbe probe;
+    bool probeInitialized;
+    bool dynamicEnvironment;
+    int environmentFaces;
+    // Bumped whenever faces were redrawn; the reflections changed, but nothing the faces show did
+    unsigned environmentUpdates;
+    // Middle of the teapot, or of the instances; the near plane leaves out whatever the probe sits in
+    glm::vec3 probeCenter;
+    float probeNear;
 
     GLfloat rotX, rotY, zoom;
     GLfloat camRX, camRY;
     GLfloat addRotX, addRotY, addZoom;
     GLfloat addCamRX, addCamRY;
 
-    bool compileShaders();
+    shaderProgram& permutation(unsigned permutationFeatures);
+    unsigned wantedPermutation(bool instanced);
+    const shaderProgram* selectProgram(bool instanced);
+    const shaderProgram* depthProgram(const shaderProgram& shading, PrepassState& state);
+    void updatePrograms();
+    void resolveLocations(shaderProgram& prog);
+    void loadPrefiltered(const CubeImage& sky);
+    void setupVertexAttribs(const shaderProgram& prog);
+    bool drawFrom(const View& camera, bool mainCamera, bool occlusion);
+    bool drawScene(const glm::mat4& view, const glm::mat4& projection, bool mainCamera, bool occlusion,
+                   GLuint environment);
+    GLuint environmentTexture();
+    void cullInstances(const Frustum& frustum);
+    int pickLod(float radiusPixels, int current);
+    void selectLods(const glm::mat4& projection, bool mainCamera, bool clustered);
+    void drawLod(int lod);
+    void setInstanceAttribs(const shaderProgram& prog, bool enabled);
+    void drawInstanced(const shaderProgram& prog, size_t first, size_t count, int lod);
+    void drawInstanceRuns(const shaderProgram& prog, size_t first, size_t count);
+    void drawClustersOccluded(const shaderProgram& prog, bool issueQueries);
+    void drawTeapots(const shaderProgram& prog, const glm::mat4& model, bool clustered, bool issueQueries);
+    void buildClusters();
+    void deleteClusters();
+    void initOcclusionCulling();
+    void setupBoxProxies();
+    void uploadUniforms(const shaderProgram& prog, const uniformData& data);
 
 };
 
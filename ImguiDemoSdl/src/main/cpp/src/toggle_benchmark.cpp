@@ -0,0 +1,109 @@
+//
+// A/B comparison of GPU frame times with a setting off and on.
+//
+
+#include "toggle_benchmark.h"
+
+#include <cstring>
+
+ToggleBenchmark::ToggleBenchmark(int warmupFrames, int maxRestarts) : warmupFrames(warmupFrames),
+                                                                       maxRestarts(maxRestarts), restarts(0),
+                                                                       framesPerMode(0), mode(2), skipped(0),
+                                                                       measured(0), sumMs(0.0)
+{
+    memset(&last, 0, sizeof(last));
+}
+
+void ToggleBenchmark::start(int framesPerMode)
+{
+    this->framesPerMode = framesPerMode < 1 ? 1 : framesPerMode;
+    mode = 0;
+    restarts = 0;
+    memset(&last, 0, sizeof(last));
+    beginMode();
+}
+
+bool ToggleBenchmark::running() const
+{
+    return mode < 2;
+}
+
+bool ToggleBenchmark::enabled() const
+{
+    return mode == 1;
+}
+
+void ToggleBenchmark::addFrame(float gpuFrameMs)
+{
+    if (!running())
+    {
+        return;
+    }
+    // Still frames from before the switch, or from while the new mode was settling
+    if (skipped < warmupFrames)
+    {
+        ++skipped;
+        return;
+    }
+    sumMs += gpuFrameMs;
+    if (++measured < framesPerMode)
+    {
+        return;
+    }
+
+    const float meanMs = (float)(sumMs / measured);
+    if (mode == 0)
+    {
+        last.offMs = meanMs;
+    }
+    else
+    {
+        last.onMs = meanMs;
+        last.frames = measured;
+        last.valid = true;
+    }
+    ++mode;
+    beginMode();
+}
+
+bool ToggleBenchmark::restartMode()
+{
+    if (!running() || ++restarts > maxRestarts)
+    {
+        return false;
+    }
+    beginMode();
+    return true;
+}
+
+void ToggleBenchmark::abort(const char* reason)
+{
+    if (running())
+    {
+        memset(&last, 0, sizeof(last));
+        last.abortReason = reason;
+        mode = 2;
+    }
+}
+
+void ToggleBenchmark::beginMode()
+{
+    skipped = 0;
+    measured = 0;
+    sumMs = 0.0;
+}
+
+int ToggleBenchmark::progress() const
+{
+    return running() ? mode * framesPerMode + measured : total();
+}
+
+int ToggleBenchmark::total() const
+{
+    return 2 * framesPerMode;
+}
+
+const ToggleBenchmarkResult& ToggleBenchmark::result() const
+{
+    return last;
+}
@@ -0,0 +1,85 @@
+//
+// A/B comparison of GPU frame times with a setting off and on: the same number of frames is
+// measured in each mode, on whatever scene is up, and the means are compared. No GL dependencies;
+// the caller applies the setting and feeds in the times.
+//
+
+#ifndef IMGUI_DEMO_TOGGLE_BENCHMARK_H
+#define IMGUI_DEMO_TOGGLE_BENCHMARK_H
+
+struct ToggleBenchmarkResult {
+    // Mean GPU frame time with the setting off and on, in ms
+    float offMs;
+    float onMs;
+    // Measured frames per mode
+    int frames;
+    // false until a run has finished
+    bool valid;
+    // Why the last run was given up on, NULL if it wasn't
+    const char* abortReason;
+};
+
+class ToggleBenchmark {
+public:
+    /**
+     * @param warmupFrames Measurements to drop after each switch. Times arrive a few frames late,
+     * so this has to cover the frames in flight, plus whatever it takes for the new mode to settle.
+     * @param maxRestarts How often restartMode() may be called in a run before it's given up on
+     */
+    ToggleBenchmark(int warmupFrames, int maxRestarts);
+
+    /**
+     * Start over with the setting off; a run in progress is dropped
+     * @param framesPerMode Frames to measure in each mode
+     */
+    void start(int framesPerMode);
+    bool running() const;
+
+    /**
+     * @return The setting the next frame has to be drawn with while running()
+     */
+    bool enabled() const;
+
+    /**
+     * Record the GPU time of a frame drawn with enabled(). Switches the mode once enough frames
+     * have been measured, and finishes the run after the second one.
+     */
+    void addFrame(float gpuFrameMs);
+
+    /**
+     * Drop what was measured in the current mode and warm up again, e.g. because a frame could not
+     * be drawn the way the mode asks for yet
+     * @return false if that happened too often, without restarting; time to abort()
+     */
+    bool restartMode();
+
+    /**
+     * Stop the run without a result
+     * @param reason String literal; only the pointer is kept
+     */
+    void abort(const char* reason);
+
+    /**
+     * @return Frames measured so far out of the total for both modes, for a progress display
+     */
+    int progress() const;
+    int total() const;
+
+    const ToggleBenchmarkResult& result() const;
+
+private:
+    void beginMode();
+
+    const int warmupFrames;
+    const int maxRestarts;
+    int restarts;
+    int framesPerMode;
+    // 0 off, 1 on, 2 done
+    int mode;
+    int skipped;
+    int measured;
+    double sumMs;
+    ToggleBenchmarkResult last;
+};
+
+#endif //IMGUI_DEMO_TOGGLE_BENCHMARK_H
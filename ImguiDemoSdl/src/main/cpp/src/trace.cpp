@@ -0,0 +1,260 @@
+//
+// Per-thread trace buffers and the Chrome trace writer.
+//
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "logger.h"
+
+namespace {
+    // Events per thread; at a couple dozen events per frame, that's the last half a minute or so
+    const uint32_t ringCapacity = 1 << 16;
+
+    struct traceEvent {
+        const char* name;
+        // Nanoseconds since the first event
+        uint64_t time;
+        double value;
+        // Chrome trace phase: 'B', 'E' or 'C'
+        char phase;
+    };
+
+    /**
+     * Single producer (the owning thread), single consumer (traceWrite()).
+     * head is only written by the producer, tail only by the consumer. The producer never waits
+     * for the consumer: when the ring is full, it overwrites the oldest event, and the consumer
+     * finds out from head which of the events it copied may have changed underneath it.
+     */
+    struct traceRing {
+        traceEvent events[ringCapacity];
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+        std::atomic<const char*> threadName;
+        uint32_t threadId;
+        // Rings are never removed, so the list can be walked without locking
+        traceRing* next;
+    };
+
+    std::atomic<bool> g_enabled(true);
+    std::atomic<traceRing*> g_rings(nullptr);
+    std::atomic<uint32_t> g_threadCount(0);
+    std::atomic<uint64_t> g_dropped(0);
+    thread_local traceRing* t_ring = nullptr;
+
+    uint64_t now()
+    {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    traceRing* threadRing()
+    {
+        if (t_ring == nullptr)
+        {
+            // One allocation per thread; rings outlive their threads so nothing gets lost
+            traceRing* ring = new traceRing();
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->threadName.store(nullptr);
+            ring->threadId = ++g_threadCount;
+            ring->next = g_rings.load(std::memory_order_relaxed);
+            while (!g_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release,
+                                                  std::memory_order_relaxed))
+            {
+            }
+            t_ring = ring;
+        }
+        return t_ring;
+    }
+
+    void record(char phase, const char* name, double value)
+    {
+        if (!g_enabled.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        traceRing* ring = threadRing();
+        const uint32_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= ringCapacity)
+        {
+            // Not written out yet, and about to be gone
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        traceEvent& event = ring->events[head & (ringCapacity - 1)];
+        event.name = name;
+        event.time = now();
+        event.value = value;
+        event.phase = phase;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * Copy the events the consumer hasn't seen yet out of a ring, oldest first, and move its tail
+     * past them. Events the producer may have overwritten during the copy are left out.
+     */
+    void drainRing(traceRing* ring, std::vector<traceEvent>& events)
+    {
+        const uint32_t head = ring->head.load(std::memory_order_acquire);
+        uint32_t first = ring->tail.load(std::memory_order_relaxed);
+        if (head - first > ringCapacity)
+        {
+            first = head - ringCapacity;
+        }
+        events.clear();
+        for (uint32_t i = first; i != head; ++i)
+        {
+            events.push_back(ring->events[i & (ringCapacity - 1)]);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint32_t after = ring->head.load(std::memory_order_relaxed);
+        if (after - first > ringCapacity)
+        {
+            const uint32_t overwritten = after - first - ringCapacity;
+            events.erase(events.begin(), events.begin() + std::min<size_t>(overwritten, events.size()));
+        }
+        ring->tail.store(head, std::memory_order_release);
+    }
+
+    /**
+     * Flag the B and E events that have their counterpart in the list; a slice whose other end
+     * was overwritten or is still to come would show up as never ending, or ending out of nowhere
+     */
+    void matchEvents(const std::vector<traceEvent>& events, std::vector<bool>& keep)
+    {
+        keep.assign(events.size(), true);
+        std::vector<size_t> open;
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            if (events[i].phase == 'B')
+            {
+                open.push_back(i);
+            }
+            else if (events[i].phase == 'E')
+            {
+                if (open.empty())
+                {
+                    keep[i] = false;
+                }
+                else
+                {
+                    open.pop_back();
+                }
+            }
+        }
+        for (size_t i : open)
+        {
+            keep[i] = false;
+        }
+    }
+
+    void writeString(FILE* f, const char* text)
+    {
+        fputc('"', f);
+        for (const char* c = text; *c != '\0'; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                fputc('\\', f);
+            }
+            fputc(*c, f);
+        }
+        fputc('"', f);
+    }
+}
+
+void traceSetEnabled(bool enabled)
+{
+    g_enabled.store(enabled);
+}
+
+bool traceEnabled()
+{
+    return g_enabled.load();
+}
+
+void traceThreadName(const char* name)
+{
+    threadRing()->threadName.store(name);
+}
+
+void traceBegin(const char* name)
+{
+    record('B', name, 0.0);
+}
+
+void traceEnd(const char* name)
+{
+    record('E', name, 0.0);
+}
+
+void traceCounter(const char* name, double value)
+{
+    record('C', name, value);
+}
+
+bool traceWrite(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        Log(LOG_WARN) << "Could not write trace file " << path;
+        return false;
+    }
+
+    size_t written = 0;
+    std::vector<traceEvent> events;
+    std::vector<bool> keep;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    for (traceRing* ring = g_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next)
+    {
+        const char* threadName = ring->threadName.load();
+        if (threadName != nullptr)
+        {
+            fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    written++ ? ",\n" : "", ring->threadId);
+            writeString(f, threadName);
+            fputs("}}", f);
+        }
+
+        drainRing(ring, events);
+        matchEvents(events, keep);
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            if (!keep[i])
+            {
+                continue;
+            }
+            const traceEvent& event = events[i];
+            fprintf(f, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"name\":",
+                    written++ ? ",\n" : "", event.phase, ring->threadId, event.time / 1000.0);
+            writeString(f, event.name);
+            if (event.phase == 'C')
+            {
+                fprintf(f, ",\"args\":{\"value\":%g}", event.value);
+            }
+            fputc('}', f);
+        }
+    }
+    fputs("\n]}\n", f);
+
+    bool ok = (fclose(f) == 0);
+    if (ok)
+    {
+        Log(LOG_INFO) << "Wrote " << written << " trace events to " << path;
+    }
+    else
+    {
+        Log(LOG_WARN) << "Could not write trace file " << path;
+    }
+    return ok;
+}
+
+uint64_t traceDropped()
+{
+    return g_dropped.load();
+}
@@ -0,0 +1,79 @@
+//
+// Lightweight tracing: scoped events and counters recorded into per-thread buffers and written
+// out as a Chrome trace (JSON), which chrome://tracing and the Perfetto UI can both open.
+// The buffers are flight recorders: once full, new events overwrite the oldest, so a trace saved
+// right after a hitch always has the hitch in it.
+// No GL or SDL includes, so the ImGui backends can use this too.
+//
+
+#ifndef IMGUI_DEMO_TRACE_H
+#define IMGUI_DEMO_TRACE_H
+
+#include <cstdint>
+
+/**
+ * Turn recording on or off (it's on from the start, so that startup is in the trace)
+ */
+void traceSetEnabled(bool enabled);
+bool traceEnabled();
+
+/**
+ * Name the calling thread in the trace
+ * @param name String literal; only the pointer is kept
+ */
+void traceThreadName(const char* name);
+
+/**
+ * Mark the beginning and the end of an event on the calling thread. Events nest; each
+ * traceBegin() needs a matching traceEnd() on the same thread.
+ * @param name String literal; only the pointer is kept
+ */
+void traceBegin(const char* name);
+void traceEnd(const char* name);
+
+/**
+ * Record the current value of a counter; shows up as a graph of its own
+ * @param name String literal; only the pointer is kept
+ */
+void traceCounter(const char* name, double value);
+
+/**
+ * Write what the buffers still hold of everything recorded since the previous call to a file, and
+ * clear them. Events whose beginning or end is not in there (overwritten, or not recorded yet)
+ * are left out, so call it outside of any event.
+ * @param path Output file, conventionally with a .json extension
+ * @return false if the file could not be written
+ */
+bool traceWrite(const char* path);
+
+/**
+ * @return Number of events that were overwritten before traceWrite() got to them
+ */
+uint64_t traceDropped();
+
+/**
+ * Event that lasts until the end of the enclosing scope
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name)
+    {
+        traceBegin(name);
+    }
+    ~TraceScope()
+    {
+        traceEnd(name);
+    }
+
+private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+    const char* name;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif //IMGUI_DEMO_TRACE_H
@@ -0,0 +1,128 @@
+//
+// Keeps the scene from being shaded under opaque ImGui windows.
+//
+
+#include "ui_occluders.h"
+
+#include <algorithm>
+#include <cmath>
+#include "imgui.h"
+#include "imgui_internal.h"
+#include "gl_ext.h"
+
+void collectUiOccluders(const ImDrawData* drawData, std::vector<UiOccluderRect>& rects)
+{
+    rects.clear();
+    const ImGuiContext& g = *GImGui;
+    const ImGuiIO& io = g.IO;
+    const float rounding = g.Style.WindowRounding;
+    const float fbHeight = io.DisplaySize.y * io.DisplayFramebufferScale.y;
+
+    // Backgrounds are drawn with one of these; a window that was given its own background
+    // alpha won't match and is simply not treated as an occluder
+    const ImU32 backgrounds[] = {
+            ImGui::GetColorU32(ImGuiCol_WindowBg),
+            ImGui::GetColorU32(ImGuiCol_ChildWindowBg),
+            ImGui::GetColorU32(ImGuiCol_PopupBg)
+    };
+
+    for (int n = 0; n < drawData->CmdListsCount; ++n)
+    {
+        const ImDrawList* cmdList = drawData->CmdLists[n];
+        const ImGuiWindow* window = NULL;
+        for (int w = 0; w < g.Windows.Size; ++w)
+        {
+            if (g.Windows[w]->DrawList == cmdList)
+            {
+                window = g.Windows[w];
+                break;
+            }
+        }
+        if (window == NULL || window->Collapsed || cmdList->VtxBuffer.Size == 0)
+        {
+            continue;
+        }
+
+        // The background fill is the first thing in a window's draw list, and its first
+        // vertex carries the fill color (anti-aliasing only fades the outer fringe).
+        // Colors are ABGR, so alpha is the top byte.
+        const ImU32 color = cmdList->VtxBuffer[0].col;
+        bool opaque = false;
+        for (ImU32 background : backgrounds)
+        {
+            opaque |= (color == background) && ((color >> 24) == 0xFF);
+        }
+        if (!opaque)
+        {
+            continue;
+        }
+
+        // Stay clear of the title bar and the rounded corners
+        float x0 = window->Pos.x + rounding;
+        float y0 = window->Pos.y + window->TitleBarHeight() + rounding;
+        float x1 = window->Pos.x + window->Size.x - rounding;
+        float y1 = window->Pos.y + window->Size.y - rounding;
+        x0 = std::max(x0, 0.0f);
+        y0 = std::max(y0, 0.0f);
+        x1 = std::min(x1, io.DisplaySize.x);
+        y1 = std::min(y1, io.DisplaySize.y);
+        if (x1 <= x0 || y1 <= y0)
+        {
+            continue;
+        }
+
+        // Only whole pixels that are completely covered
+        UiOccluderRect rect;
+        rect.x = (int)std::ceil(x0 * io.DisplayFramebufferScale.x);
+        rect.width = (int)std::floor(x1 * io.DisplayFramebufferScale.x) - rect.x;
+        rect.y = (int)std::ceil(fbHeight - y1 * io.DisplayFramebufferScale.y);
+        rect.height = (int)std::floor(fbHeight - y0 * io.DisplayFramebufferScale.y) - rect.y;
+        if (rect.width > 0 && rect.height > 0)
+        {
+            rects.push_back(rect);
+        }
+    }
+}
+
+void writeUiOccluders(const std::vector<UiOccluderRect>& rects, float scale)
+{
+    if (rects.empty())
+    {
+        return;
+    }
+    // A scissored depth clear per rectangle: no shaders or geometry, and drivers turn it
+    // into a fast clear where they can
+    glEnable(GL_SCISSOR_TEST);
+    glDepthMask(GL_TRUE);
+#ifdef GL_PROFILE_GL3
+    glClearDepth(0.0);
+#else
+    glClearDepthf(0.0f);
+#endif
+    for (const auto& rect : rects)
+    {
+        if (scale == 1.0f)
+        {
+            glScissor(rect.x, rect.y, rect.width, rect.height);
+        }
+        else
+        {
+            int x0 = (int) std::ceil(rect.x * scale);
+            int y0 = (int) std::ceil(rect.y * scale);
+            int x1 = (int) std::floor((rect.x + rect.width) * scale);
+            int y1 = (int) std::floor((rect.y + rect.height) * scale);
+            if (x1 <= x0 || y1 <= y0)
+            {
+                continue;
+            }
+            glScissor(x0, y0, x1 - x0, y1 - y0);
+        }
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+#ifdef GL_PROFILE_GL3
+    glClearDepth(1.0);
+#else
+    glClearDepthf(1.0f);
+#endif
+    glDisable(GL_SCISSOR_TEST);
+}
@@ -0,0 +1,49 @@
+//
+// Keeps the scene from being shaded under opaque ImGui windows: their rectangles are written
+// into the depth buffer at the near plane before the scene is drawn, so early-Z rejects
+// everything behind them.
+//
+
+#ifndef IMGUI_DEMO_UI_OCCLUDERS_H
+#define IMGUI_DEMO_UI_OCCLUDERS_H
+
+#include <vector>
+
+struct ImDrawData;
+
+/**
+ * A rectangle in framebuffer pixels, origin at the bottom left (same as glScissor)
+ */
+struct UiOccluderRect {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    bool operator==(const UiOccluderRect& other) const
+    {
+        return x == other.x && y == other.y && width == other.width && height == other.height;
+    }
+    bool operator!=(const UiOccluderRect& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Find the window backgrounds in the current frame that nothing can be seen through
+ * @param drawData Result of ImGui::Render(); must be called before the backend draws it,
+ *                 since that scales the clip rectangles in place
+ * @param rects Receives the rectangles; rounded corners and title bars are left out
+ */
+void collectUiOccluders(const ImDrawData* drawData, std::vector<UiOccluderRect>& rects);
+
+/**
+ * Set depth to the near plane inside the rectangles. Call after the depth buffer is cleared
+ * and before the scene is drawn; the scene depth test has to be GL_LESS (the default).
+ * @param scale Size of the scene's framebuffer relative to the window's; rectangles are shrunk
+ *              to whole pixels that are covered entirely
+ */
+void writeUiOccluders(const std::vector<UiOccluderRect>& rects, float scale = 1.0f);
+
+#endif //IMGUI_DEMO_UI_OCCLUDERS_H
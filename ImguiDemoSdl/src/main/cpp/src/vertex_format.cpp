@@ -0,0 +1,142 @@
+//
+// Vertex layouts used for static meshes, and helpers to fill them in.
+//
+
+#include "vertex_format.h"
+
+#include <cmath>
+#include <cstring>
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t floatExponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    int32_t exponent = (int32_t)floatExponent - 127 + 15;
+
+    if (floatExponent == 0xff)
+    {
+        // Infinity stays infinity, NaN stays NaN
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31)
+    {
+        // Too large, overflow to infinity
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            // Too small even for a denormal
+            return (uint16_t)sign;
+        }
+        // Denormal: add the implicit bit and shift it into place
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            ++half;
+        }
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    // Round to nearest even; a carry out of the mantissa correctly bumps the exponent
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        ++half;
+    }
+    return (uint16_t)(sign | half);
+}
+
+float halfToFloat(uint16_t value)
+{
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float result = std::ldexp((float)mantissa, -24);
+        return sign ? -result : result;
+    }
+
+    uint32_t bits;
+    if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static uint32_t packSnorm10(float value)
+{
+    if (value > 1.0f)
+    {
+        value = 1.0f;
+    }
+    if (value < -1.0f)
+    {
+        value = -1.0f;
+    }
+    int32_t quantized = (int32_t)std::lround(value * 511.0f);
+    return (uint32_t)quantized & 0x3ff;
+}
+
+uint32_t packSnorm1010102(float x, float y, float z, float w)
+{
+    int32_t sign = (w < 0.0f) ? -2 : 1;
+    return packSnorm10(x)
+           | (packSnorm10(y) << 10)
+           | (packSnorm10(z) << 20)
+           | (((uint32_t)sign & 0x3) << 30);
+}
+
+float binormalSign(const SourceVertex& v)
+{
+    const float* n = v.normal;
+    const float* t = v.tangent;
+    const float* b = v.binormal;
+    float cross[3] = {
+            n[1] * t[2] - n[2] * t[1],
+            n[2] * t[0] - n[0] * t[2],
+            n[0] * t[1] - n[1] * t[0]
+    };
+    float dot = cross[0] * b[0] + cross[1] * b[1] + cross[2] * b[2];
+    return (dot < 0.0f) ? -1.0f : 1.0f;
+}
+
+void packVertex(const SourceVertex& src, PackedVertex& dst)
+{
+    dst.pos[0] = floatToHalf(src.pos[0]);
+    dst.pos[1] = floatToHalf(src.pos[1]);
+    dst.pos[2] = floatToHalf(src.pos[2]);
+    dst.pos[3] = floatToHalf(1.0f);
+    dst.normal = packSnorm1010102(src.normal[0], src.normal[1], src.normal[2], 1.0f);
+    dst.tangent = packSnorm1010102(src.tangent[0], src.tangent[1], src.tangent[2], binormalSign(src));
+    dst.texcoord[0] = floatToHalf(src.texcoord[0]);
+    dst.texcoord[1] = floatToHalf(src.texcoord[1]);
+}
+
+void packVertex(const SourceVertex& src, FloatVertex& dst)
+{
+    memcpy(dst.pos, src.pos, sizeof(dst.pos));
+    memcpy(dst.normal, src.normal, sizeof(dst.normal));
+    memcpy(dst.tangent, src.tangent, sizeof(src.tangent));
+    dst.tangent[3] = binormalSign(src);
+    memcpy(dst.texcoord, src.texcoord, sizeof(dst.texcoord));
+}
@@ -0,0 +1,74 @@
+//
+// Vertex layouts used for static meshes, and helpers to fill them in.
+// No GL dependencies here, so offline tools can use this as well.
+//
+
+#ifndef IMGUI_DEMO_VERTEX_FORMAT_H
+#define IMGUI_DEMO_VERTEX_FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Vertex as it comes from the source data: everything is a float,
+ * and the binormal is stored explicitly.
+ */
+struct SourceVertex {
+    float pos[3];
+    float normal[3];
+    float tangent[3];
+    float binormal[3];
+    float texcoord[2];
+};
+
+/**
+ * Compact vertex for GL3/ES3 (20 bytes):
+ *  - position: half floats, w is always 1.0 (keeps the next attribute 4-byte aligned);
+ *  - normal: GL_INT_2_10_10_10_REV, normalized;
+ *  - tangent: GL_INT_2_10_10_10_REV, normalized, w holds the binormal sign
+ *    (binormal = cross(normal, tangent.xyz) * tangent.w);
+ *  - texcoord: half floats.
+ */
+struct PackedVertex {
+    uint16_t pos[4];
+    uint32_t normal;
+    uint32_t tangent;
+    uint16_t texcoord[2];
+};
+
+/**
+ * Same attributes as PackedVertex, but with plain floats (48 bytes).
+ * Used on ES2, which has neither half float nor 2_10_10_10 vertex attributes.
+ */
+struct FloatVertex {
+    float pos[3];
+    float normal[3];
+    float tangent[4];
+    float texcoord[2];
+};
+
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex should be tightly packed");
+static_assert(sizeof(FloatVertex) == 48, "FloatVertex should be tightly packed");
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+/**
+ * Pack a vector into GL_INT_2_10_10_10_REV format.
+ * @param x,y,z Components in [-1, 1]; values outside the range are clamped
+ * @param w Sign, either -1 or 1. -1 is stored as -2, which decodes to -1.0 with both
+ *          the GL 3.3 and the ES3/GL4.2 signed normalized conversion rules.
+ * @return Packed value
+ */
+uint32_t packSnorm1010102(float x, float y, float z, float w);
+
+/**
+ * Sign of the binormal relative to cross(normal, tangent)
+ * @return 1.0f or -1.0f
+ */
+float binormalSign(const SourceVertex& v);
+
+void packVertex(const SourceVertex& src, PackedVertex& dst);
+void packVertex(const SourceVertex& src, FloatVertex& dst);
+
+#endif //IMGUI_DEMO_VERTEX_FORMAT_H
@@ -0,0 +1,71 @@
+//
+// Converts the teapot from the WebGL shiny-teapot demo (see src/teapot.inl) into a mesh file.
+// Usage: teapot_to_mesh output.mesh
+//
+
+#include "logger.h"
+#include "mesh_file.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+#include "teapot.inl"
+
+static const int maxLods = 5;
+// Each level has about half the triangles of the one before
+static const float lodRatio = 0.5f;
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        Log(LOG_FATAL) << "Not enough arguments! Usage: " << argv[0] << " output.mesh";
+        return 1;
+    }
+
+    const size_t numVertices = (sizeof(teapotPositions) / sizeof(teapotPositions[0])) / 3;
+    const size_t numIndices = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
+
+    std::vector<SourceVertex> vertices(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        SourceVertex& v = vertices[i];
+        for (int c = 0; c < 3; ++c)
+        {
+            v.pos[c] = teapotPositions[3*i+c];
+            v.normal[c] = teapotNormals[3*i+c];
+            v.tangent[c] = teapotTangents[3*i+c];
+            v.binormal[c] = teapotBinormals[3*i+c];
+        }
+        // Texture coordinates are stored as vec3, but the third component is unused
+        v.texcoord[0] = teapotTexCoords[3*i];
+        v.texcoord[1] = teapotTexCoords[3*i+1];
+    }
+    std::vector<uint32_t> indices(teapotIndices, teapotIndices + numIndices);
+
+    MeshOptimizationReport report = optimizeMesh(indices, vertices);
+    Log(LOG_INFO) << "Mesh optimized: ACMR " << report.before.acmr << " -> " << report.after.acmr
+                  << ", ATVR " << report.before.atvr << " -> " << report.after.atvr
+                  << (report.overdrawOptimized ? ", reordered for overdraw" : "");
+
+    // Levels of detail reuse the optimized vertices, in the order the full mesh fetches them
+    const size_t fullIndices = indices.size();
+    std::vector<MeshLodRange> ranges = buildMeshLods(indices, vertices[0].pos, sizeof(SourceVertex), vertices.size(),
+                                                     maxLods, lodRatio);
+    std::vector<MeshFileLod> lods(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        lods[i].firstIndex = ranges[i].firstIndex;
+        lods[i].indexCount = ranges[i].indexCount;
+        lods[i].error = ranges[i].error;
+        lods[i].reserved = 0;
+        Log(LOG_INFO) << "LOD " << i << ": " << ranges[i].indexCount / 3 << " triangles, error " << ranges[i].error;
+    }
+
+    if (!writeMeshFile(argv[1], vertices, indices, lods))
+    {
+        return 1;
+    }
+    Log(LOG_INFO) << "Wrote " << vertices.size() << " vertices, " << fullIndices << " indices and "
+                  << lods.size() - 1 << " coarser levels to " << argv[1];
+    return 0;
+}
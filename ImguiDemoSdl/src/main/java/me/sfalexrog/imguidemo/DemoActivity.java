@@ -28,6 +28,7 @@ public class DemoActivity extends SDLActivity {
             "skybox-posx.jpg",
             "skybox-posy.jpg",
             "skybox-posz.jpg",
+            "teapot.mesh",
             "Roboto-Medium.ttf"
     };
 